@@ -0,0 +1,170 @@
+#include "user_table.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+user_table::user_table()
+{
+    for (int i = 0; i < SHARDS; ++i)
+    {
+        m_shards[i].current.store(new_table(MIN_SLOTS), std::memory_order_relaxed);
+        m_shards[i].count = 0;
+    }
+}
+
+user_table::~user_table()
+{
+    for (int i = 0; i < SHARDS; ++i)
+    {
+        table *t = m_shards[i].current.load(std::memory_order_relaxed);
+        //记录只在当前表中释放一次，旧表中的是同一批指针
+        for (size_t j = 0; j <= t->mask; ++j)
+            free(t->slots[j].load(std::memory_order_relaxed));
+        while (t)
+        {
+            table *retired = t->retired;
+            delete[] t->slots;
+            delete t;
+            t = retired;
+        }
+    }
+}
+
+//FNV-1a之后再做一次混合，高位用于选分片，低位用于选槽，都要分布均匀
+uint64_t user_table::hash_of(const char *s, size_t len)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; ++i)
+        h = (h ^ (unsigned char)s[i]) * 1099511628211ULL;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+user_table::table *user_table::new_table(size_t slots)
+{
+    table *t = new table;
+    t->mask = slots - 1;
+    t->retired = NULL;
+    t->slots = new std::atomic<record *>[slots]();
+    return t;
+}
+
+const user_table::record *user_table::find(const table *t, uint64_t hash, const char *name, size_t len)
+{
+    for (size_t i = hash & t->mask;; i = (i + 1) & t->mask)
+    {
+        const record *r = t->slots[i].load(std::memory_order_acquire);
+        if (!r) //装载率不超过1/2，一定能遇到空槽
+            return NULL;
+        if (r->hash == hash && r->name_len == len && memcmp(r->name(), name, len) == 0)
+            return r;
+    }
+}
+
+void user_table::grow(shard &s, size_t slots)
+{
+    table *old = s.current.load(std::memory_order_relaxed);
+    if (old->mask + 1 >= slots)
+        return;
+    table *t = new_table(slots);
+    for (size_t i = 0; i <= old->mask; ++i)
+    {
+        record *r = old->slots[i].load(std::memory_order_relaxed);
+        if (!r)
+            continue;
+        size_t j = r->hash & t->mask;
+        while (t->slots[j].load(std::memory_order_relaxed))
+            j = (j + 1) & t->mask;
+        t->slots[j].store(r, std::memory_order_relaxed);
+    }
+    //新表填好后整体发布，读者要么看到完整的旧表，要么看到完整的新表
+    t->retired = old;
+    s.current.store(t, std::memory_order_release);
+}
+
+void user_table::reserve(size_t users)
+{
+    //分片之间大致均匀，多留1/4余量，装载率保持在1/2以下
+    size_t per_shard = users / SHARDS + users / SHARDS / 4 + 1;
+    size_t slots = MIN_SLOTS;
+    while (slots < per_shard * 2)
+        slots <<= 1;
+    for (int i = 0; i < SHARDS; ++i)
+    {
+        m_shards[i].lock.lock();
+        grow(m_shards[i], slots);
+        m_shards[i].lock.unlock();
+    }
+}
+
+bool user_table::check(const char *name, const char *password)
+{
+    size_t len = strlen(name);
+    uint64_t hash = hash_of(name, len);
+    const table *t = shard_of(hash).current.load(std::memory_order_acquire);
+    const record *r = find(t, hash, name, len);
+    return r && strcmp(r->password(), password) == 0;
+}
+
+bool user_table::contains(const char *name)
+{
+    size_t len = strlen(name);
+    uint64_t hash = hash_of(name, len);
+    return find(shard_of(hash).current.load(std::memory_order_acquire), hash, name, len) != NULL;
+}
+
+bool user_table::insert(const char *name, const char *password, persist_func persist, void *arg)
+{
+    size_t len = strlen(name);
+    size_t password_len = strlen(password);
+    uint64_t hash = hash_of(name, len);
+    shard &s = shard_of(hash);
+
+    //检查重名、写入数据库和加入表中都在分片的锁内，同名用户的并发注册只有一个成功
+    s.lock.lock();
+    if (find(s.current.load(std::memory_order_relaxed), hash, name, len) || (persist && !persist(name, password, arg)))
+    {
+        s.lock.unlock();
+        return false;
+    }
+    record *r = (record *)malloc(sizeof(record) + len + password_len + 2);
+    if (!r)
+    {
+        s.lock.unlock();
+        throw std::bad_alloc();
+    }
+    r->hash = hash;
+    r->name_len = len;
+    r->password_len = password_len;
+    memcpy((char *)r->name(), name, len + 1);
+    memcpy((char *)r->password(), password, password_len + 1);
+
+    table *t = s.current.load(std::memory_order_relaxed);
+    if ((s.count + 1) * 2 > t->mask + 1)
+    {
+        grow(s, (t->mask + 1) * 2);
+        t = s.current.load(std::memory_order_relaxed);
+    }
+    size_t i = hash & t->mask;
+    while (t->slots[i].load(std::memory_order_relaxed))
+        i = (i + 1) & t->mask;
+    t->slots[i].store(r, std::memory_order_release); //记录的内容在发布之前已写完
+    ++s.count;
+    s.lock.unlock();
+    return true;
+}
+
+size_t user_table::size()
+{
+    size_t n = 0;
+    for (int i = 0; i < SHARDS; ++i)
+    {
+        m_shards[i].lock.lock();
+        n += m_shards[i].count;
+        m_shards[i].lock.unlock();
+    }
+    return n;
+}
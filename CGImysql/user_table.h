@@ -0,0 +1,86 @@
+#ifndef USER_TABLE_H
+#define USER_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+#include "../lock/locker.h"
+
+//user表在内存中的副本，登录校验只查这里，注册时与数据库一起更新
+//按用户名哈希分成SHARDS个分片，每个分片是一张线性探测的开放寻址表，槽中存放指向用户记录的指针
+//读(RCU方式)：记录写入后不再修改，发布时release存指针，读者acquire取表和槽，不加锁也不写任何共享变量，查找过程中不分配内存
+//写：每个分片一把锁，同一分片的注册串行，不同分片互不影响；扩容时复制出两倍大小的新表再整体发布
+//用户不会被删除，旧表和记录都不释放(旧表的总大小不超过当前表)，正在旧表上查找的读者不会访问到已释放的内存，程序退出时统一释放
+//并发的注册和登录之间，登录可能看不到正在注册的用户，与登录先于注册完成等价
+class user_table
+{
+public:
+    static const int SHARD_BITS = 6;
+    static const int SHARDS = 1 << SHARD_BITS; //分片数
+    static const size_t MIN_SLOTS = 16; //每个分片初始的槽数，为2的幂
+
+    //注册时把用户写入持久存储(数据库)，成功返回true；调用时持有用户名所在分片的锁
+    typedef bool (*persist_func)(const char *name, const char *password, void *arg);
+
+    static user_table *get_instance()
+    {
+        static user_table instance;
+        return &instance;
+    }
+
+    //启动时按预计的用户数一次分配好各分片的表，避免加载过程中反复扩容
+    void reserve(size_t users);
+    //用户名存在且密码相同时返回true
+    bool check(const char *name, const char *password);
+    bool contains(const char *name);
+    //用户名不存在时先调用persist(为NULL时不调用)，成功后加入表中；用户名已存在或persist失败时返回false
+    bool insert(const char *name, const char *password, persist_func persist = NULL, void *arg = NULL);
+    size_t size();
+
+private:
+    user_table();
+    ~user_table();
+
+    //用户名和密码紧跟在结构之后，各自以\0结尾
+    struct record
+    {
+        uint64_t hash;
+        uint32_t name_len;
+        uint32_t password_len;
+        const char *name() const
+        {
+            return (const char *)(this + 1);
+        }
+        const char *password() const
+        {
+            return name() + name_len + 1;
+        }
+    };
+    struct table
+    {
+        size_t mask; //槽数减1
+        table *retired; //被本表取代的旧表，程序退出时释放
+        std::atomic<record *> *slots; //mask + 1个槽，NULL为空槽
+    };
+    struct shard
+    {
+        locker lock; //写者之间互斥
+        std::atomic<table *> current;
+        size_t count; //由lock保护
+    };
+
+    static uint64_t hash_of(const char *s, size_t len);
+    shard &shard_of(uint64_t hash)
+    {
+        return m_shards[hash >> (64 - SHARD_BITS)]; //高位选分片，低位选槽，两者互不相关
+    }
+    static const record *find(const table *t, uint64_t hash, const char *name, size_t len);
+    static table *new_table(size_t slots);
+    //持有分片的锁，把表扩大到至少slots个槽并发布
+    static void grow(shard &s, size_t slots);
+
+    shard m_shards[SHARDS];
+};
+
+#endif
@@ -0,0 +1,70 @@
+#include "asset_bundle.h"
+
+#include <stdio.h>
+#include <string.h>
+
+asset_bundle::~asset_bundle()
+{
+    delete[] m_assets;
+}
+
+void asset_bundle::fill(file_cache::entry &e, const bundled_file &f, bool gzip)
+{
+    e.path = f.path;
+    memset(&e.st, 0, sizeof(e.st));
+    e.st.st_mode = S_IFREG | 0444;
+    e.st.st_size = f.length; //压缩版本同样记录源文件的属性
+    e.st.st_mtim.tv_sec = f.mtime;
+    e.length = gzip ? f.gzip_length : f.length;
+    //只读数组不会被写入，也不会被释放：gzip标志为false且引用计数不归零，destroy不会被调用
+    e.addr = e.length ? (char *)(gzip ? f.gzip_data : f.data) : NULL;
+    e.fd = -1;
+    e.gzip = gzip;
+    e.copied = false;
+    e.length_header_len = snprintf(e.length_header, sizeof(e.length_header), "%s",
+                                   gzip ? f.gzip_length_header : f.length_header);
+    e.etag_len = snprintf(e.etag, sizeof(e.etag), "%s", gzip ? f.gzip_etag : f.etag);
+    snprintf(e.last_modified, sizeof(e.last_modified), "%s", f.last_modified);
+    e.checked = 0;
+    e.refs = 1; //资源表持有
+    e.cached = false;
+}
+
+void asset_bundle::init(bool enabled)
+{
+    if (!enabled || m_assets)
+        return;
+    m_assets = new asset[bundled_file_count];
+    m_map.reserve(bundled_file_count);
+    for (int i = 0; i < bundled_file_count; ++i)
+    {
+        const bundled_file &f = bundled_files[i];
+        asset &a = m_assets[i];
+        fill(a.file, f, false);
+        a.has_gzip = f.gzip_data != NULL;
+        if (a.has_gzip)
+            fill(a.gzip, f, true);
+        m_map[f.path] = &a;
+        m_bytes += f.length + f.gzip_length;
+    }
+    m_count = bundled_file_count;
+}
+
+file_cache::entry *asset_bundle::acquire(const char *path)
+{
+    auto it = m_map.find(path);
+    if (it == m_map.end())
+        return NULL;
+    m_hits.fetch_add(1, std::memory_order_relaxed);
+    ++it->second->file.refs;
+    return &it->second->file;
+}
+
+file_cache::entry *asset_bundle::acquire_gzip(const char *path)
+{
+    auto it = m_map.find(path);
+    if (it == m_map.end() || !it->second->has_gzip)
+        return NULL;
+    ++it->second->gzip.refs;
+    return &it->second->gzip;
+}
@@ -0,0 +1,90 @@
+#ifndef ASSET_BUNDLE_H
+#define ASSET_BUNDLE_H
+
+#include <stddef.h>
+#include <string_view>
+#include <unordered_map>
+#include <atomic>
+
+#include "../cache/file_cache.h"
+
+//编译进程序的静态资源
+//构建时由bundle/pack把网站根目录打包成assets.cpp，文件内容和gzip版本是只读数据段中的数组，
+//Content-Length响应头、ETag和Last-Modified也在构建时生成
+//启动时为每个文件建立一个file_cache::entry，内存指向只读数组，没有文件描述符，之后的发送、条件请求、Range和压缩协商与缓存命中完全相同
+//条目的引用计数始终至少为1(由资源表持有)，file_cache::release不会删除它们
+//资源表在启动时(事件循环开始之前)建立，之后只读，查找不加锁也不分配内存
+//ETag由内容哈希生成，与inode无关，同一次构建的多个实例给出相同的ETag
+
+//由pack生成的文件表
+struct bundled_file
+{
+    const char *path; //相对网站根目录，以/开头
+    const char *data;
+    size_t length;
+    const char *length_header; //Content-Length响应头
+    const char *etag; //含引号
+    const char *gzip_data; //没有压缩版本时为NULL
+    size_t gzip_length;
+    const char *gzip_length_header;
+    const char *gzip_etag; //带-gz后缀
+    long long mtime; //打包时文件的修改时间
+    const char *last_modified; //HTTP日期格式的mtime
+};
+extern const bundled_file bundled_files[];
+extern const int bundled_file_count;
+
+class asset_bundle
+{
+public:
+    static asset_bundle *get_instance()
+    {
+        static asset_bundle instance;
+        return &instance;
+    }
+
+    //enabled为false时不提供任何资源，全部从磁盘读取
+    void init(bool enabled);
+    bool enabled() const
+    {
+        return m_count > 0;
+    }
+    //path(相对网站根目录)对应的条目并增加引用，用file_cache::release释放；不在资源表中时返回NULL
+    file_cache::entry *acquire(const char *path);
+    //path的gzip版本，没有压缩版本时返回NULL
+    file_cache::entry *acquire_gzip(const char *path);
+
+    int count() const
+    {
+        return m_count;
+    }
+    size_t bytes() const
+    {
+        return m_bytes;
+    }
+    //命中次数，只用于观察
+    unsigned long long hits() const
+    {
+        return m_hits.load(std::memory_order_relaxed);
+    }
+
+private:
+    asset_bundle() : m_assets(NULL), m_count(0), m_bytes(0), m_hits(0) {}
+    ~asset_bundle();
+
+    struct asset
+    {
+        file_cache::entry file;
+        file_cache::entry gzip;
+        bool has_gzip;
+    };
+    static void fill(file_cache::entry &e, const bundled_file &f, bool gzip);
+
+    asset *m_assets;
+    int m_count;
+    size_t m_bytes; //文件和压缩版本的总大小
+    std::unordered_map<std::string_view, asset *> m_map; //键为bundled_file中的路径
+    std::atomic<unsigned long long> m_hits;
+};
+
+#endif
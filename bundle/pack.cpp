@@ -0,0 +1,238 @@
+//构建时运行的打包工具：把网站根目录下的文件编译进服务器
+//用法 pack <根目录> <输出文件>，生成的源文件中每个文件是一个const数组，链接后位于只读数据段
+//同时生成Content-Length响应头、由内容哈希得到的ETag、HTTP日期格式的修改时间，以及可压缩文件用最高压缩级别生成的gzip版本
+//输出按路径排序，内容不变时生成的文件也不变
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+namespace
+{
+struct packed_file
+{
+    std::string path; //相对根目录，以/开头
+    std::string data;
+    std::string gzip; //没有变小时为空
+    time_t mtime;
+};
+
+//与http_conn.cpp中的compressible一致，只有这些类型在运行时会发送压缩版本
+bool compressible(const std::string &path)
+{
+    static const char *exts[] = {".html", ".htm", ".css", ".js", ".txt", ".svg", ".json", ".xml"};
+    size_t dot = path.rfind('.');
+    if (dot == std::string::npos)
+        return false;
+    for (size_t i = 0; i < sizeof(exts) / sizeof(exts[0]); ++i)
+    {
+        if (strcasecmp(path.c_str() + dot, exts[i]) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool read_file(const std::string &name, std::string &out)
+{
+    FILE *fp = fopen(name.c_str(), "rb");
+    if (!fp)
+        return false;
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        out.append(buf, n);
+    bool ok = !ferror(fp);
+    fclose(fp);
+    return ok;
+}
+
+//gzip格式，构建时只做一次，用最高压缩级别
+bool gzip_data(const std::string &in, std::string &out)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+    out.resize(deflateBound(&zs, in.size()));
+    zs.next_in = (Bytef *)in.data();
+    zs.avail_in = in.size();
+    zs.next_out = (Bytef *)&out[0];
+    zs.avail_out = out.size();
+    int ret = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return ret == Z_STREAM_END;
+}
+
+//递归收集目录下其他用户可读的普通文件，与从磁盘发送时的权限检查一致
+bool collect(const std::string &root, const std::string &rel, std::vector<packed_file> &files)
+{
+    std::string dir = root + rel;
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+    {
+        fprintf(stderr, "pack: cannot open %s\n", dir.c_str());
+        return false;
+    }
+    bool ok = true;
+    while (struct dirent *de = readdir(d))
+    {
+        if (de->d_name[0] == '.') //跳过.和..以及隐藏文件
+            continue;
+        std::string path = rel + "/" + de->d_name;
+        if (path.find_first_of("\"\\?") != std::string::npos) //路径直接写进字面量，含引号、反斜杠的不打包，?开始查询串，请求也到不了
+        {
+            fprintf(stderr, "pack: skip %s\n", path.c_str());
+            continue;
+        }
+        struct stat st;
+        if (stat((root + path).c_str(), &st) < 0)
+            continue;
+        if (S_ISDIR(st.st_mode))
+        {
+            ok = collect(root, path, files) && ok;
+            continue;
+        }
+        if (!S_ISREG(st.st_mode) || !(st.st_mode & S_IROTH))
+            continue;
+        packed_file f;
+        f.path = path;
+        f.mtime = st.st_mtime;
+        if (!read_file(root + path, f.data))
+        {
+            fprintf(stderr, "pack: cannot read %s\n", (root + path).c_str());
+            ok = false;
+            continue;
+        }
+        if (compressible(path) && !f.data.empty() && (!gzip_data(f.data, f.gzip) || f.gzip.size() >= f.data.size()))
+            f.gzip.clear();
+        files.push_back(std::move(f));
+    }
+    closedir(d);
+    return ok;
+}
+
+//64位FNV-1a，作为与文件系统无关的ETag
+unsigned long long content_hash(const std::string &s)
+{
+    unsigned long long h = 14695981039346656037ULL;
+    for (size_t i = 0; i < s.size(); ++i)
+        h = (h ^ (unsigned char)s[i]) * 1099511628211ULL;
+    return h;
+}
+
+//以字符串字面量输出任意字节，不可打印的字节一律写成三位八进制转义，后面紧跟数字也不会被误解析
+void write_literal(FILE *out, const std::string &s)
+{
+    const size_t LINE = 100;
+    size_t col = 0;
+    fputs("    \"", out);
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\' || c == '?')
+            col += fprintf(out, "\\%c", c);
+        else if (c >= 0x20 && c < 0x7f)
+            col += fputc(c, out) != EOF;
+        else
+            col += fprintf(out, "\\%03o", c);
+        if (col >= LINE && i + 1 < s.size())
+        {
+            fputs("\"\n    \"", out);
+            col = 0;
+        }
+    }
+    fputs("\"", out);
+}
+
+void write_source(FILE *out, const std::vector<packed_file> &files)
+{
+    fputs("//由bundle/pack生成，不要手工修改\n\n#include \"asset_bundle.h\"\n\n", out);
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        const packed_file &f = files[i];
+        fprintf(out, "// %s\nstatic const char data_%zu[] =\n", f.path.c_str(), i);
+        write_literal(out, f.data);
+        fputs(";\n", out);
+        if (!f.gzip.empty())
+        {
+            fprintf(out, "static const char gzip_%zu[] =\n", i);
+            write_literal(out, f.gzip);
+            fputs(";\n", out);
+        }
+        fputs("\n", out);
+    }
+
+    fputs("const bundled_file bundled_files[] = {\n", out);
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        const packed_file &f = files[i];
+        unsigned long long h = content_hash(f.data);
+        char date[32];
+        struct tm tm;
+        gmtime_r(&f.mtime, &tm);
+        strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+
+        fprintf(out, "    {\"%s\", data_%zu, %zu, \"Content-Length:%zu\\r\\n\", \"\\\"b%llx-%zx\\\"\", ", f.path.c_str(), i,
+                f.data.size(), f.data.size(), h, f.data.size());
+        if (f.gzip.empty())
+            fputs("NULL, 0, NULL, NULL, ", out);
+        else
+            fprintf(out, "gzip_%zu, %zu, \"Content-Length:%zu\\r\\n\", \"\\\"b%llx-%zx-gz\\\"\", ", i, f.gzip.size(),
+                    f.gzip.size(), h, f.data.size());
+        fprintf(out, "%lld, \"%s\"},\n", (long long)f.mtime, date);
+    }
+    fprintf(out, "};\nconst int bundled_file_count = %zu;\n", files.size());
+}
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: %s <root> <output.cpp>\n", argv[0]);
+        return 1;
+    }
+    std::vector<packed_file> files;
+    if (!collect(argv[1], "", files))
+        return 1;
+    std::sort(files.begin(), files.end(),
+              [](const packed_file &a, const packed_file &b) { return a.path < b.path; });
+    if (files.empty())
+    {
+        fprintf(stderr, "pack: no files under %s\n", argv[1]);
+        return 1;
+    }
+
+    //先写临时文件再改名，中途失败不会留下不完整的源文件
+    std::string tmp = std::string(argv[2]) + ".tmp";
+    FILE *out = fopen(tmp.c_str(), "w");
+    if (!out)
+    {
+        fprintf(stderr, "pack: cannot write %s\n", tmp.c_str());
+        return 1;
+    }
+    write_source(out, files);
+    if (fclose(out) != 0 || rename(tmp.c_str(), argv[2]) != 0)
+    {
+        remove(tmp.c_str());
+        fprintf(stderr, "pack: cannot write %s\n", argv[2]);
+        return 1;
+    }
+    size_t bytes = 0, gzip_bytes = 0;
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        bytes += files[i].data.size();
+        gzip_bytes += files[i].gzip.size();
+    }
+    printf("pack: %zu files, %zu bytes, %zu bytes gzip\n", files.size(), bytes, gzip_bytes);
+    return 0;
+}
@@ -0,0 +1,436 @@
+#include "file_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <zlib.h>
+
+//单调时钟的当前毫秒数，clock_gettime走vDSO，不陷入内核
+static long long cache_now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+//文件是否变化，比较inode、大小、权限以及修改时间和状态改变时间
+static bool same_file(const struct stat &a, const struct stat &b)
+{
+    return a.st_ino == b.st_ino && a.st_dev == b.st_dev && a.st_size == b.st_size && a.st_mode == b.st_mode &&
+           a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec &&
+           a.st_ctim.tv_sec == b.st_ctim.tv_sec && a.st_ctim.tv_nsec == b.st_ctim.tv_nsec;
+}
+
+//读入整个文件，返回malloc分配的内存，失败返回NULL
+//读出文件开头的size字节，文件在此期间被截断时返回NULL
+static char *read_fd(int fd, size_t size)
+{
+    char *buf = (char *)malloc(size > 0 ? size : 1);
+    size_t done = 0;
+    while (buf && done < size)
+    {
+        ssize_t n = read(fd, buf + done, size - done);
+        if (n <= 0)
+        {
+            free(buf);
+            buf = NULL;
+            break;
+        }
+        done += n;
+    }
+    return buf;
+}
+
+static char *read_file(const char *path, size_t size)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    char *buf = read_fd(fd, size);
+    close(fd);
+    return buf;
+}
+
+file_cache::file_cache() : m_capacity(0), m_max_file(0), m_gzip_capacity(0), m_gzip_max_file(0),
+                           m_revalidate_ms(0), m_keep_fd(false),
+                           m_hits(0), m_misses(0), m_evictions(0), m_revalidations(0), m_invalidations(0),
+                           m_gzip_hits(0), m_gzip_siblings(0), m_gzip_compressions(0)
+{
+    for (int i = 0; i < SHARDS; ++i)
+    {
+        m_shards[i].bytes = 0;
+        m_gzip_shards[i].bytes = 0;
+    }
+}
+
+file_cache::~file_cache()
+{
+    clear(m_shards);
+    clear(m_gzip_shards);
+}
+
+void file_cache::clear(shard *shards)
+{
+    for (int i = 0; i < SHARDS; ++i)
+    {
+        shard &s = shards[i];
+        for (std::list<entry *>::iterator it = s.lru.begin(); it != s.lru.end(); ++it)
+        {
+            (*it)->cached = false;
+            release(*it);
+        }
+        s.lru.clear();
+        s.map.clear();
+    }
+}
+
+void file_cache::init(size_t capacity, int revalidate_ms, bool keep_fd, size_t gzip_capacity)
+{
+    m_capacity = capacity;
+    m_max_file = capacity / SHARDS; //单个文件最多占满一个分片
+    m_gzip_capacity = gzip_capacity;
+    m_gzip_max_file = gzip_capacity / SHARDS; //压缩前的大小，压缩后一般远小于它
+    m_revalidate_ms = revalidate_ms < 0 ? 0 : revalidate_ms;
+    m_keep_fd = keep_fd;
+}
+
+file_cache::entry *file_cache::lookup(shard &s, std::string_view key)
+{
+    s.lock.lock();
+    std::unordered_map<std::string_view, entry *>::iterator it = s.map.find(key);
+    entry *e = (it == s.map.end()) ? NULL : it->second;
+    if (e)
+    {
+        ++e->refs;
+        s.lru.splice(s.lru.begin(), s.lru, e->lru);
+    }
+    s.lock.unlock();
+    return e;
+}
+
+file_cache::entry *file_cache::insert(shard &s, entry *e, size_t limit)
+{
+    s.lock.lock();
+    std::unordered_map<std::string_view, entry *>::iterator it = s.map.find(e->path);
+    if (it != s.map.end()) //其他线程已经加载了同一个文件，使用已有的条目
+    {
+        entry *other = it->second;
+        ++other->refs;
+        s.lock.unlock();
+        release(e);
+        return other;
+    }
+    //加入缓存，缓存持有一个引用
+    ++e->refs;
+    e->cached = true;
+    s.lru.push_front(e);
+    e->lru = s.lru.begin();
+    s.map[e->path] = e;
+    s.bytes += e->length;
+
+    //超出分片容量或条目数时从LRU表尾淘汰，正在发送的响应持有引用，不受影响
+    entry *victims[SHARD_ENTRIES + 1];
+    int victim_count = 0;
+    while ((s.bytes > limit || s.map.size() > (size_t)SHARD_ENTRIES) && s.lru.back() != e)
+    {
+        entry *v = s.lru.back();
+        unlink(s, v);
+        victims[victim_count++] = v;
+        if (victim_count == SHARD_ENTRIES + 1)
+            break;
+    }
+    s.lock.unlock();
+
+    m_evictions += victim_count;
+    for (int i = 0; i < victim_count; ++i)
+        release(victims[i]);
+    return e;
+}
+
+void file_cache::drop(shard &s, entry *e)
+{
+    s.lock.lock();
+    bool cached = e->cached;
+    if (cached)
+        unlink(s, e);
+    s.lock.unlock();
+    if (cached)
+        release(e); //缓存持有的引用
+}
+
+file_cache::entry *file_cache::acquire(const char *path)
+{
+    std::string_view key(path);
+    shard &s = shard_of(m_shards, key);
+    long long now = cache_now_ms();
+
+    entry *e = lookup(s, key);
+    if (e)
+    {
+        if (now - e->checked.load(std::memory_order_relaxed) < m_revalidate_ms)
+        {
+            ++m_hits;
+            return e;
+        }
+        //超过检查间隔，在锁外重新stat，文件未变化时继续使用
+        ++m_revalidations;
+        struct stat st;
+        if (stat(path, &st) == 0 && same_file(st, e->st))
+        {
+            e->checked.store(now, std::memory_order_relaxed);
+            ++m_hits;
+            return e;
+        }
+        //文件已变化或被删除，从缓存中移除后按未命中重新加载
+        ++m_invalidations;
+        drop(s, e);
+        release(e); //本次取得的引用
+    }
+
+    ++m_misses;
+    e = load(path);
+    if (!e)
+        return NULL;
+    return insert(s, e, m_capacity / SHARDS);
+}
+
+file_cache::entry *file_cache::acquire_gzip(const char *path, const struct stat &st)
+{
+    if (!gzip_enabled() || (size_t)st.st_size > m_gzip_max_file)
+        return NULL;
+    std::string_view key(path);
+    shard &s = shard_of(m_gzip_shards, key);
+
+    entry *e = lookup(s, key);
+    if (e && !same_file(e->st, st)) //源文件已变化，重新生成
+    {
+        drop(s, e);
+        release(e);
+        e = NULL;
+    }
+    if (!e)
+    {
+        e = load_gzip(path, st);
+        if (!e)
+            return NULL;
+        e = insert(s, e, m_gzip_capacity / SHARDS);
+    }
+    else
+    {
+        ++m_gzip_hits;
+    }
+    if (0 == e->length) //不值得压缩
+    {
+        release(e);
+        return NULL;
+    }
+    return e;
+}
+
+void file_cache::release(entry *e)
+{
+    if (--e->refs == 0)
+        destroy(e);
+}
+
+void file_cache::get_stats(stats &st)
+{
+    st.hits = m_hits;
+    st.misses = m_misses;
+    st.evictions = m_evictions;
+    st.revalidations = m_revalidations;
+    st.invalidations = m_invalidations;
+    st.gzip_hits = m_gzip_hits;
+    st.gzip_siblings = m_gzip_siblings;
+    st.gzip_compressions = m_gzip_compressions;
+    st.bytes = 0;
+    st.entries = 0;
+    st.gzip_bytes = 0;
+    for (int i = 0; i < SHARDS; ++i)
+    {
+        shard &s = m_shards[i];
+        s.lock.lock();
+        st.bytes += s.bytes;
+        st.entries += s.map.size();
+        s.lock.unlock();
+
+        shard &g = m_gzip_shards[i];
+        g.lock.lock();
+        st.gzip_bytes += g.bytes;
+        g.lock.unlock();
+    }
+}
+
+int file_cache::format_etag(const struct stat &st, bool gzip, char *buf, size_t size)
+{
+    return snprintf(buf, size, "\"%llx-%llx-%llx%s\"", (unsigned long long)st.st_ino, (unsigned long long)st.st_size,
+                    (unsigned long long)st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec, gzip ? "-gz" : "");
+}
+
+int file_cache::format_http_date(time_t t, char *buf, size_t size)
+{
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    return strftime(buf, size, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+file_cache::entry *file_cache::new_entry(const char *path, const struct stat &st, size_t length, bool gzip)
+{
+    entry *e = new entry;
+    e->path = path;
+    e->st = st;
+    e->addr = NULL;
+    e->fd = -1;
+    e->length = length;
+    e->gzip = gzip;
+    e->copied = false;
+    e->length_header_len = snprintf(e->length_header, sizeof(e->length_header), "Content-Length:%zu\r\n", length);
+    e->etag_len = format_etag(st, gzip, e->etag, sizeof(e->etag));
+    format_http_date(st.st_mtime, e->last_modified, sizeof(e->last_modified));
+    e->checked = cache_now_ms();
+    e->refs = 1;
+    e->cached = false;
+    return e;
+}
+
+file_cache::entry *file_cache::load(const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) < 0)
+        return NULL;
+    //只缓存其他用户可读的普通文件，其余情况由调用者返回对应的错误
+    if (!S_ISREG(st.st_mode) || !(st.st_mode & S_IROTH) || (size_t)st.st_size > m_max_file)
+        return NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    char *addr = NULL;
+    bool copied = false;
+    if (!m_keep_fd)
+    {
+        //小文件读出副本，之后文件被原地修改或截断也不影响正在发送的响应
+        if (st.st_size > 0 && (size_t)st.st_size <= COPY_MAX)
+        {
+            addr = read_fd(fd, st.st_size);
+            copied = true;
+            if (!addr)
+            {
+                close(fd);
+                return NULL;
+            }
+        }
+        else if (st.st_size > 0)
+        {
+            addr = (char *)mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED)
+            {
+                close(fd);
+                return NULL;
+            }
+        }
+        close(fd);
+        fd = -1;
+    }
+
+    entry *e = new_entry(path, st, st.st_size, false);
+    e->addr = addr;
+    e->fd = fd;
+    e->copied = copied;
+    return e;
+}
+
+file_cache::entry *file_cache::load_gzip(const char *path, const struct stat &st)
+{
+    //优先使用预先压缩好的.gz文件，它比源文件旧时说明源文件改过，不再可信
+    std::string sibling = std::string(path) + ".gz";
+    struct stat gz_st;
+    if (stat(sibling.c_str(), &gz_st) == 0 && S_ISREG(gz_st.st_mode) && gz_st.st_size > 0 &&
+        (size_t)gz_st.st_size < (size_t)st.st_size && gz_st.st_mtime >= st.st_mtime)
+    {
+        char *data = read_file(sibling.c_str(), gz_st.st_size);
+        if (data)
+        {
+            ++m_gzip_siblings;
+            entry *e = new_entry(path, st, gz_st.st_size, true);
+            e->addr = data;
+            return e;
+        }
+    }
+
+    //用zlib压缩源文件，windowBits加16输出gzip格式
+    //读取或压缩失败(如文件正在被修改、内存不足)返回NULL，不记录条目，本次发送原文件，下次请求再尝试
+    char *src = read_file(path, st.st_size);
+    if (!src)
+        return NULL;
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    char *out = NULL;
+    size_t out_len = 0;
+    bool ok = false;
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK)
+    {
+        uLong bound = deflateBound(&zs, st.st_size);
+        out = (char *)malloc(bound);
+        if (out)
+        {
+            zs.next_in = (Bytef *)src;
+            zs.avail_in = st.st_size;
+            zs.next_out = (Bytef *)out;
+            zs.avail_out = bound;
+            if (deflate(&zs, Z_FINISH) == Z_STREAM_END)
+            {
+                out_len = zs.total_out;
+                ok = true;
+            }
+        }
+        deflateEnd(&zs);
+    }
+    free(src);
+    if (!ok)
+    {
+        free(out);
+        return NULL;
+    }
+    ++m_gzip_compressions;
+
+    //压缩成功但没有变小时才记录一个长度为0的条目，之后直接发送原文件，不再反复压缩
+    if (out_len >= (size_t)st.st_size)
+    {
+        free(out);
+        out = NULL;
+        out_len = 0;
+    }
+    else
+    {
+        char *shrunk = (char *)realloc(out, out_len);
+        if (shrunk)
+            out = shrunk;
+    }
+    entry *e = new_entry(path, st, out_len, true);
+    e->addr = out;
+    return e;
+}
+
+void file_cache::unlink(shard &s, entry *e)
+{
+    s.map.erase(e->path);
+    s.lru.erase(e->lru);
+    s.bytes -= e->length;
+    e->cached = false;
+}
+
+void file_cache::destroy(entry *e)
+{
+    if (e->gzip || e->copied)
+        free(e->addr);
+    else if (e->addr)
+        munmap(e->addr, e->st.st_size);
+    if (e->fd >= 0)
+        close(e->fd);
+    delete e;
+}
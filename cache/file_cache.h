@@ -0,0 +1,150 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <sys/stat.h>
+#include <string>
+#include <string_view>
+#include <list>
+#include <unordered_map>
+#include <atomic>
+
+#include "../lock/locker.h"
+
+//静态资源文件缓存
+//以解析后的文件路径为键，缓存文件属性、映射到的内存(mmap方式)或打开的文件描述符(sendfile方式)以及预先生成的Content-Length响应头
+//命中时不再调用stat、open、mmap和close，距上次检查超过revalidate_ms时重新stat一次，文件变化则重新加载
+//按路径哈希分成SHARDS个分片，每个分片一把锁，各自按LRU淘汰，总大小不超过capacity
+//条目带引用计数，排队发送的响应持有引用，条目被淘汰或失效后，最后一个引用释放时才删除映射或关闭文件
+//不超过COPY_MAX的文件读入内存中的副本，不受文件随后被修改的影响；更大的文件映射到内存，映射期间文件被原地截断时
+//访问截断部分会收到SIGBUS，更新网站文件需要先写入临时文件再rename替换，旧文件的映射保持有效，重新stat后加载新文件
+//
+//另有一组独立的分片缓存文件的gzip压缩版本，同样以路径为键，条目记录压缩时源文件的属性，源文件变化后重新生成
+//压缩版本优先读取同目录下不比源文件旧的.gz文件，没有时用zlib压缩源文件，压缩后没有变小的也记录下来，不再反复压缩
+class file_cache
+{
+public:
+    static const int SHARDS = 16; //分片数
+    static const int SHARD_ENTRIES = 64; //每个分片最多缓存的文件数，sendfile方式下同时限制打开的文件数
+    static const size_t COPY_MAX = 256 * 1024; //mmap方式下不超过该大小的文件读入内存，不做映射
+
+    struct entry
+    {
+        std::string path; //文件路径
+        struct stat st; //文件属性，压缩版本为源文件的属性
+        char *addr; //文件映射到的内存、读入内存的副本或压缩后的数据，sendfile方式或空文件为NULL
+        int fd; //sendfile方式下打开的文件，否则为-1
+        size_t length; //响应体长度，压缩版本为压缩后的长度，为0表示不值得压缩
+        bool gzip; //是否为gzip压缩版本，此时addr由malloc分配
+        bool copied; //addr为malloc分配的文件内容副本
+        char length_header[32]; //预先生成的Content-Length响应头
+        int length_header_len;
+        char etag[64]; //由文件属性生成的ETag，含引号，压缩版本带-gz后缀
+        int etag_len;
+        char last_modified[32]; //HTTP日期格式的文件修改时间
+        std::atomic<long long> checked; //上次stat检查的时间(毫秒)
+        std::atomic<int> refs; //引用计数，缓存本身持有一个
+        bool cached; //是否仍在缓存中，由分片的锁保护
+        std::list<entry *>::iterator lru; //在分片LRU链表中的位置
+    };
+
+    //计数器，只用于观察缓存效果
+    struct stats
+    {
+        unsigned long long hits; //命中
+        unsigned long long misses; //未命中，从文件系统加载
+        unsigned long long evictions; //因容量不足淘汰
+        unsigned long long revalidations; //超过检查间隔后重新stat
+        unsigned long long invalidations; //重新stat发现文件已变化
+        size_t bytes; //当前缓存的文件总大小
+        int entries; //当前缓存的文件数
+        unsigned long long gzip_hits; //压缩版本命中
+        unsigned long long gzip_siblings; //读取.gz文件生成压缩版本
+        unsigned long long gzip_compressions; //用zlib压缩生成压缩版本
+        size_t gzip_bytes; //当前缓存的压缩数据总大小
+    };
+
+    static file_cache *get_instance()
+    {
+        static file_cache instance;
+        return &instance;
+    }
+
+    //capacity为0时不启用文件缓存；keep_fd为true时缓存打开的文件而不是映射，用于sendfile
+    //gzip_capacity为0时不提供压缩版本
+    void init(size_t capacity, int revalidate_ms, bool keep_fd, size_t gzip_capacity);
+    bool enabled() const
+    {
+        return m_capacity > 0;
+    }
+    bool gzip_enabled() const
+    {
+        return m_gzip_capacity > 0;
+    }
+    //源文件超过该大小时不缓存压缩版本
+    size_t gzip_max_file() const
+    {
+        return m_gzip_max_file;
+    }
+
+    //取出path对应的条目并增加引用，不存在或已过期时加载
+    //文件不存在、不是其他用户可读的普通文件或太大不适合缓存时返回NULL，由调用者按原方式处理
+    entry *acquire(const char *path);
+    //取出path的gzip压缩版本并增加引用，st为调用者刚取得的源文件属性
+    //不值得压缩、源文件太大或本次读取、压缩失败时返回NULL，调用者发送原文件
+    entry *acquire_gzip(const char *path, const struct stat &st);
+    //释放acquire得到的引用，不需要知道条目属于哪组分片
+    static void release(entry *e);
+
+    void get_stats(stats &s);
+
+    //由inode、大小和修改时间生成ETag，压缩版本是不同的表示，ETag也不同，返回长度
+    static int format_etag(const struct stat &st, bool gzip, char *buf, size_t size);
+    //HTTP日期格式，如Sun, 06 Nov 1994 08:49:37 GMT，返回长度
+    static int format_http_date(time_t t, char *buf, size_t size);
+
+private:
+    file_cache();
+    ~file_cache();
+
+    struct shard
+    {
+        locker lock;
+        std::unordered_map<std::string_view, entry *> map; //键指向条目自己的path，查找时不需要构造string
+        std::list<entry *> lru; //表头为最近使用
+        size_t bytes;
+    };
+
+    static shard &shard_of(shard *shards, std::string_view path)
+    {
+        return shards[std::hash<std::string_view>()(path) % SHARDS];
+    }
+    entry *lookup(shard &s, std::string_view key); //查找并增加引用，移到LRU表头
+    entry *insert(shard &s, entry *e, size_t limit); //加入新加载的条目，已有同名条目时改用已有的，返回调用者应使用的条目
+    void drop(shard &s, entry *e); //条目已失效，仍在缓存中时移除并释放缓存持有的引用
+    void unlink(shard &s, entry *e); //从分片中移除条目，调用者持有分片的锁，之后需要释放缓存持有的引用
+    entry *load(const char *path); //从文件系统加载一个条目，引用计数为1
+    entry *load_gzip(const char *path, const struct stat &st); //生成压缩版本，引用计数为1，读取或压缩失败返回NULL
+    static entry *new_entry(const char *path, const struct stat &st, size_t length, bool gzip);
+    static void destroy(entry *e);
+    static void clear(shard *shards);
+
+    shard m_shards[SHARDS];
+    shard m_gzip_shards[SHARDS];
+    size_t m_capacity; //缓存文件的总大小上限
+    size_t m_max_file; //单个文件超过该大小不缓存
+    size_t m_gzip_capacity; //压缩数据的总大小上限
+    size_t m_gzip_max_file; //源文件超过该大小不压缩
+    int m_revalidate_ms;
+    bool m_keep_fd;
+
+    std::atomic<unsigned long long> m_hits;
+    std::atomic<unsigned long long> m_misses;
+    std::atomic<unsigned long long> m_evictions;
+    std::atomic<unsigned long long> m_revalidations;
+    std::atomic<unsigned long long> m_invalidations;
+    std::atomic<unsigned long long> m_gzip_hits;
+    std::atomic<unsigned long long> m_gzip_siblings;
+    std::atomic<unsigned long long> m_gzip_compressions;
+};
+
+#endif
@@ -30,11 +30,59 @@ Config::Config(){
 
     //并发模型,默认是proactor
     actor_model = 0;
+
+    //事件循环数量,默认1个
+    loop_num = 1;
+
+    //I/O后端,默认是epoll
+    backend = 0;
+
+    //每个连接读缓冲区上限,默认64KB
+    read_max = 64;
+
+    //资源文件发送方式,默认mmap
+    send_file = 0;
+
+    //文件缓存容量,默认64MB
+    cache_mb = 64;
+
+    //文件缓存重新检查文件的间隔,默认1000毫秒
+    revalidate_ms = 1000;
+
+    //gzip压缩版本缓存容量,默认16MB
+    gzip_mb = 16;
+
+    //Cache-Control配置,默认不发送
+    cache_control = "";
+
+    //HTTP/2明文连接,默认接受
+    h2c = 1;
+
+    //keep-alive空闲超时,默认15000毫秒
+    idle_timeout = 15000;
+
+    //读完请求头的期限,默认10000毫秒
+    header_timeout = 10000;
+
+    //读完请求体的期限,默认30000毫秒
+    body_timeout = 30000;
+
+    //每个连接最多处理的请求数,默认1000
+    max_requests = 1000;
+
+    //接收请求的最低速率,默认500字节/秒
+    min_rate = 500;
+
+    //每次写事件最多发送的数据量,默认256KB
+    write_quantum = 256;
+
+    //内置静态资源,默认打开
+    bundle = 1;
 }
 
 void Config::parse_arg(int argc, char*argv[]){
     int opt;
-    const char *str = "p:l:m:o:s:t:c:a:";
+    const char *str = "p:l:m:o:s:t:c:a:r:b:x:f:k:v:z:e:h:i:j:u:n:w:q:g:";
     while ((opt = getopt(argc, argv, str)) != -1) //利用getopt函数为各选项赋参数值
     {
         switch (opt)
@@ -79,6 +127,86 @@ void Config::parse_arg(int argc, char*argv[]){
             actor_model = atoi(optarg);
             break;
         }
+        case 'r':
+        {
+            loop_num = atoi(optarg);
+            break;
+        }
+        case 'b':
+        {
+            backend = atoi(optarg);
+            break;
+        }
+        case 'x':
+        {
+            read_max = atoi(optarg);
+            break;
+        }
+        case 'f':
+        {
+            send_file = atoi(optarg);
+            break;
+        }
+        case 'k':
+        {
+            cache_mb = atoi(optarg);
+            break;
+        }
+        case 'v':
+        {
+            revalidate_ms = atoi(optarg);
+            break;
+        }
+        case 'z':
+        {
+            gzip_mb = atoi(optarg);
+            break;
+        }
+        case 'e':
+        {
+            cache_control = optarg;
+            break;
+        }
+        case 'h':
+        {
+            h2c = atoi(optarg);
+            break;
+        }
+        case 'i':
+        {
+            idle_timeout = atoi(optarg);
+            break;
+        }
+        case 'j':
+        {
+            header_timeout = atoi(optarg);
+            break;
+        }
+        case 'u':
+        {
+            body_timeout = atoi(optarg);
+            break;
+        }
+        case 'n':
+        {
+            max_requests = atoi(optarg);
+            break;
+        }
+        case 'w':
+        {
+            min_rate = atoi(optarg);
+            break;
+        }
+        case 'q':
+        {
+            write_quantum = atoi(optarg);
+            break;
+        }
+        case 'g':
+        {
+            bundle = atoi(optarg);
+            break;
+        }
         default:
             break;
         }
@@ -42,6 +42,54 @@ public:
 
     //并发模型选择
     int actor_model;
+
+    //事件循环数量
+    int loop_num;
+
+    //I/O后端选择
+    int backend;
+
+    //每个连接读缓冲区上限(KB)
+    int read_max;
+
+    //资源文件发送方式
+    int send_file;
+
+    //文件缓存容量(MB)
+    int cache_mb;
+
+    //文件缓存重新检查文件的间隔(毫秒)
+    int revalidate_ms;
+
+    //gzip压缩版本缓存容量(MB)
+    int gzip_mb;
+
+    //按路径前缀配置的Cache-Control
+    string cache_control;
+
+    //是否接受HTTP/2明文连接(h2c)
+    int h2c;
+
+    //keep-alive连接等待下一个请求的超时(毫秒)
+    int idle_timeout;
+
+    //读完请求头的期限(毫秒)
+    int header_timeout;
+
+    //读完请求体的期限(毫秒)
+    int body_timeout;
+
+    //每个连接最多处理的请求数
+    int max_requests;
+
+    //接收请求的最低速率(字节/秒)
+    int min_rate;
+
+    //每次写事件最多发送的数据量(KB)
+    int write_quantum;
+
+    //是否使用编译进程序的静态资源
+    int bundle;
 };
 
 #endif
\ No newline at end of file
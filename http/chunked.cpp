@@ -0,0 +1,226 @@
+#include "chunked.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+void chunked_decoder::init()
+{
+    m_state = SIZE;
+    m_size = 0;
+    m_digits = 0;
+    m_line_len = 0;
+}
+
+chunked_decoder::RESULT chunked_decoder::decode(char *buf, int &in, int end, int &out)
+{
+    while (in < end)
+    {
+        if (DATA == m_state) //块数据整段前移，其余状态逐字节处理
+        {
+            int n = end - in;
+            if ((long long)n > m_size)
+                n = m_size;
+            if (out != in)
+                memmove(buf + out, buf + in, n);
+            in += n;
+            out += n;
+            m_size -= n;
+            if (0 == m_size)
+                m_state = DATA_CR;
+            continue;
+        }
+
+        char c = buf[in++];
+        switch (m_state)
+        {
+        case SIZE:
+        {
+            int v;
+            if (c >= '0' && c <= '9')
+                v = c - '0';
+            else if (c >= 'a' && c <= 'f')
+                v = c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F')
+                v = c - 'A' + 10;
+            else if (0 == m_digits)
+                return CHUNK_BAD;
+            else if (';' == c || ' ' == c || '\t' == c)
+            {
+                m_state = EXTENSION;
+                break;
+            }
+            else if ('\r' == c)
+            {
+                m_state = SIZE_LF;
+                break;
+            }
+            else
+                return CHUNK_BAD;
+            m_size = m_size * 16 + v;
+            ++m_digits;
+            if (m_size > MAX_CHUNK)
+                return CHUNK_BAD;
+            break;
+        }
+        case EXTENSION:
+            if ('\r' == c)
+                m_state = SIZE_LF;
+            break;
+        case SIZE_LF:
+            if ('\n' != c)
+                return CHUNK_BAD;
+            if (0 == m_size) //结束块
+            {
+                m_state = TRAILER;
+                m_line_len = 0;
+            }
+            else
+                m_state = DATA;
+            break;
+        case DATA_CR:
+            if ('\r' != c)
+                return CHUNK_BAD;
+            m_state = DATA_LF;
+            break;
+        case DATA_LF:
+            if ('\n' != c)
+                return CHUNK_BAD;
+            m_state = SIZE;
+            m_size = 0;
+            m_digits = 0;
+            break;
+        case TRAILER:
+            if ('\r' == c)
+                m_state = TRAILER_LF;
+            else
+                ++m_line_len;
+            break;
+        case TRAILER_LF:
+            if ('\n' != c)
+                return CHUNK_BAD;
+            if (0 == m_line_len)
+                return CHUNK_DONE;
+            m_line_len = 0;
+            m_state = TRAILER;
+            break;
+        default:
+            return CHUNK_BAD;
+        }
+    }
+    return CHUNK_MORE;
+}
+
+gzip_file_stream::gzip_file_stream() : m_fd(-1), m_zinit(false), m_input_end(false), m_eof(false)
+{
+}
+
+gzip_file_stream::~gzip_file_stream()
+{
+    if (m_zinit)
+        deflateEnd(&m_zs);
+    if (m_fd >= 0)
+        close(m_fd);
+}
+
+bool gzip_file_stream::open(const char *path)
+{
+    m_fd = ::open(path, O_RDONLY);
+    if (m_fd < 0)
+        return false;
+    memset(&m_zs, 0, sizeof(m_zs));
+    //与压缩缓存相同的参数，15 + 16表示输出gzip格式
+    if (deflateInit2(&m_zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+    m_zinit = true;
+    return true;
+}
+
+int gzip_file_stream::read(char *buf, int len)
+{
+    m_zs.next_out = (Bytef *)buf;
+    m_zs.avail_out = len;
+    while (m_zs.avail_out > 0 && !m_eof)
+    {
+        if (0 == m_zs.avail_in && !m_input_end)
+        {
+            ssize_t n = ::read(m_fd, m_in, IN_SIZE);
+            if (n < 0)
+                return -1;
+            if (0 == n)
+                m_input_end = true;
+            m_zs.next_in = (Bytef *)m_in;
+            m_zs.avail_in = n;
+        }
+        int ret = deflate(&m_zs, m_input_end ? Z_FINISH : Z_NO_FLUSH);
+        if (Z_STREAM_END == ret)
+            m_eof = true;
+        else if (Z_OK != ret && Z_BUF_ERROR != ret)
+            return -1;
+    }
+    return len - m_zs.avail_out;
+}
+
+chunked_encoder::chunked_encoder() : m_src(0), m_buf(0), m_done(false)
+{
+}
+
+chunked_encoder::~chunked_encoder()
+{
+    reset();
+}
+
+void chunked_encoder::start(body_stream *src)
+{
+    reset();
+    m_src = src;
+}
+
+void chunked_encoder::reset()
+{
+    delete m_src;
+    m_src = 0;
+    free(m_buf);
+    m_buf = 0;
+    m_done = false;
+}
+
+bool chunked_encoder::next(char *&data, int &len)
+{
+    //块长度行 + 数据 + CRLF + 结束块"0\r\n\r\n"
+    if (!m_buf)
+        m_buf = (char *)malloc(HEAD_RESERVE + CHUNK_SIZE + 2 + 5);
+    if (!m_buf)
+        return false;
+    char *body = m_buf + HEAD_RESERVE;
+    int n = m_src->read(body, CHUNK_SIZE);
+    if (n < 0)
+        return false;
+    data = body;
+    len = 0;
+    if (n > 0)
+    {
+        //块长度行写在数据前面预留的空间里
+        static const char hex[] = "0123456789abcdef";
+        char line[HEAD_RESERVE];
+        int digits = 0;
+        for (int v = n; v > 0; v >>= 4)
+            ++digits;
+        for (int i = digits - 1, v = n; i >= 0; --i, v >>= 4)
+            line[i] = hex[v & 15];
+        line[digits] = '\r';
+        line[digits + 1] = '\n';
+        data = body - digits - 2;
+        memcpy(data, line, digits + 2);
+        memcpy(body + n, "\r\n", 2);
+        len = digits + 2 + n + 2;
+    }
+    if (m_src->eof())
+    {
+        memcpy(data + len, "0\r\n\r\n", 5);
+        len += 5;
+        m_done = true;
+    }
+    return len > 0;
+}
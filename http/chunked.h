@@ -0,0 +1,110 @@
+#ifndef HTTP_CHUNKED_H
+#define HTTP_CHUNKED_H
+
+#include <zlib.h>
+
+//chunked传输编码
+
+//请求体的流式解码器
+//逐字节推进状态机，数据不完整时记住所处状态，读到更多数据后从断开处继续，不需要整行都已读入
+//块数据在读缓冲区内原地前移拼接，解码完成后请求体连续存放，之后与Content-Length请求体一样处理
+class chunked_decoder
+{
+public:
+    enum RESULT
+    {
+        CHUNK_MORE, //数据已全部消耗，请求体还没有结束
+        CHUNK_DONE, //读到结束块和尾部，in指向请求体之后的数据
+        CHUNK_BAD //格式错误
+    };
+    static const long long MAX_CHUNK = 1LL << 30; //单个块长度上限，实际还受读缓冲区上限限制
+
+    void init();
+    //解码buf中[in, end)的数据，块数据写到out处，out始终不超过in，两者随解码前进
+    RESULT decode(char *buf, int &in, int end, int &out);
+
+private:
+    enum STATE
+    {
+        SIZE, //块长度(十六进制)
+        EXTENSION, //块扩展，忽略到行尾
+        SIZE_LF,
+        DATA,
+        DATA_CR, //块数据之后的CRLF
+        DATA_LF,
+        TRAILER, //结束块之后的尾部字段，忽略，以空行结束
+        TRAILER_LF
+    };
+    STATE m_state;
+    long long m_size; //当前块剩余的长度
+    int m_digits; //块长度的位数
+    int m_line_len; //当前尾部字段行的长度，为0时遇到的CRLF是结尾的空行
+};
+
+//长度事先未知、边生成边发送的响应体
+class body_stream
+{
+public:
+    virtual ~body_stream() {}
+    //向buf写入最多len字节，返回写入的字节数，出错返回-1
+    virtual int read(char *buf, int len) = 0;
+    //数据是否已全部产生
+    virtual bool eof() const = 0;
+};
+
+//边读文件边做gzip压缩，用于太大而不进入压缩缓存的文本文件
+//文件按顺序读取，不映射，发送过程中文件被截短也只会提前结束
+class gzip_file_stream : public body_stream
+{
+public:
+    static const int IN_SIZE = 32768; //每次从文件读取的长度
+
+    gzip_file_stream();
+    ~gzip_file_stream();
+    bool open(const char *path);
+    int read(char *buf, int len);
+    bool eof() const
+    {
+        return m_eof;
+    }
+
+private:
+    int m_fd;
+    z_stream m_zs;
+    bool m_zinit; //m_zs是否已初始化
+    bool m_input_end; //文件已读完
+    bool m_eof; //压缩数据已全部输出
+    char m_in[IN_SIZE];
+};
+
+//chunked响应体编码器
+//每次从body_stream取一段数据，前面加上十六进制的块长度行，后面加上CRLF，最后一段之后紧跟结束块
+//同一时刻只在缓冲区中保存一块，发送完再生成下一块，大响应不需要整个放在内存中
+class chunked_encoder
+{
+public:
+    static const int CHUNK_SIZE = 16384; //每块最多的数据长度
+
+    chunked_encoder();
+    ~chunked_encoder();
+    void start(body_stream *src); //开始编码，接管src
+    void reset(); //释放数据源和缓冲区
+    bool active() const
+    {
+        return m_src != 0;
+    }
+    bool done() const
+    {
+        return m_done;
+    }
+    //生成下一块，data和len为编码后的数据，包含结束块时done()变为true；数据源出错返回false
+    bool next(char *&data, int &len);
+
+private:
+    static const int HEAD_RESERVE = 8; //块长度行预留的空间，CHUNK_SIZE的十六进制加CRLF不超过它
+    body_stream *m_src;
+    char *m_buf;
+    bool m_done;
+};
+
+#endif
@@ -0,0 +1,140 @@
+#include <strings.h>
+
+#include "header_table.h"
+
+namespace
+{
+struct known_name
+{
+    const char *name;
+    size_t len;
+};
+#define KNOWN_NAME(s) {s, sizeof(s) - 1}
+
+//小写形式的常用字段名，下标即编号
+constexpr known_name header_names[HDR_COUNT] = {
+    KNOWN_NAME(""),
+    KNOWN_NAME("accept"),
+    KNOWN_NAME("accept-encoding"),
+    KNOWN_NAME("accept-language"),
+    KNOWN_NAME("authorization"),
+    KNOWN_NAME("cache-control"),
+    KNOWN_NAME("connection"),
+    KNOWN_NAME("content-length"),
+    KNOWN_NAME("content-type"),
+    KNOWN_NAME("cookie"),
+    KNOWN_NAME("host"),
+    KNOWN_NAME("http2-settings"),
+    KNOWN_NAME("if-modified-since"),
+    KNOWN_NAME("if-none-match"),
+    KNOWN_NAME("if-range"),
+    KNOWN_NAME("origin"),
+    KNOWN_NAME("range"),
+    KNOWN_NAME("referer"),
+    KNOWN_NAME("transfer-encoding"),
+    KNOWN_NAME("upgrade"),
+    KNOWN_NAME("user-agent"),
+};
+
+//不区分大小写的FNV-1a
+constexpr uint32_t name_hash(const char *s, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; ++i)
+    {
+        unsigned char c = s[i];
+        if (c >= 'A' && c <= 'Z')
+            c += 32;
+        h = (h ^ c) * 16777619u;
+    }
+    return h;
+}
+
+const int SLOTS = 64; //开放寻址的槽数，为2的幂
+
+struct intern_slots
+{
+    unsigned char id[SLOTS]; //0表示空槽
+};
+
+//编译期按字段名的哈希把编号填入槽中
+constexpr intern_slots build_slots()
+{
+    intern_slots t = {};
+    for (int i = 1; i < HDR_COUNT; ++i)
+    {
+        unsigned s = name_hash(header_names[i].name, header_names[i].len) & (SLOTS - 1);
+        while (t.id[s])
+            s = (s + 1) & (SLOTS - 1);
+        t.id[s] = i;
+    }
+    return t;
+}
+
+constexpr intern_slots slots = build_slots();
+
+void rebase_view(std::string_view &v, const char *old_buf, const char *old_end, const char *new_buf)
+{
+    if (v.data() >= old_buf && v.data() <= old_end)
+        v = std::string_view(new_buf + (v.data() - old_buf), v.size());
+}
+}
+
+HEADER_ID header_table::intern(const char *name, size_t len)
+{
+    for (unsigned s = name_hash(name, len) & (SLOTS - 1); slots.id[s]; s = (s + 1) & (SLOTS - 1))
+    {
+        const known_name &known = header_names[slots.id[s]];
+        if (known.len == len && strncasecmp(known.name, name, len) == 0)
+            return (HEADER_ID)slots.id[s];
+    }
+    return HDR_OTHER;
+}
+
+HEADER_ID header_table::add(const char *name, size_t name_len, const char *value, size_t value_len)
+{
+    HEADER_ID id = intern(name, name_len);
+    if (HDR_OTHER != id)
+    {
+        if (!has(id))
+        {
+            m_known[id] = std::string_view(value, value_len);
+            m_present |= 1u << id;
+        }
+    }
+    else if (m_other_count < MAX_OTHERS)
+    {
+        header_field &f = m_others[m_other_count++];
+        f.name = std::string_view(name, name_len);
+        f.value = std::string_view(value, value_len);
+    }
+    return id;
+}
+
+std::string_view header_table::find(const char *name, size_t len) const
+{
+    HEADER_ID id = intern(name, len);
+    if (HDR_OTHER != id)
+        return get(id);
+    for (int i = 0; i < m_other_count; ++i)
+    {
+        if (m_others[i].name.size() == len && strncasecmp(m_others[i].name.data(), name, len) == 0)
+            return m_others[i].value;
+    }
+    return std::string_view();
+}
+
+void header_table::rebase(const char *old_buf, size_t size, const char *new_buf)
+{
+    const char *old_end = old_buf + size;
+    for (int i = 1; i < HDR_COUNT; ++i)
+    {
+        if (has((HEADER_ID)i))
+            rebase_view(m_known[i], old_buf, old_end, new_buf);
+    }
+    for (int i = 0; i < m_other_count; ++i)
+    {
+        rebase_view(m_others[i].name, old_buf, old_end, new_buf);
+        rebase_view(m_others[i].value, old_buf, old_end, new_buf);
+    }
+}
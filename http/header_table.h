@@ -0,0 +1,90 @@
+#ifndef HTTP_HEADER_TABLE_H
+#define HTTP_HEADER_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string_view>
+
+//请求头表，字段名和值都是指向读缓冲区(HTTP/2为流的请求头)的视图，不拷贝
+//常用的字段名归并为HEADER_ID，按编号直接存取；其余字段依次存放，超过MAX_OTHERS个时丢弃
+//值的视图之后紧跟\0，可以直接当作C字符串使用
+
+enum HEADER_ID
+{
+    HDR_OTHER = 0, //不在常用字段表中
+    HDR_ACCEPT,
+    HDR_ACCEPT_ENCODING,
+    HDR_ACCEPT_LANGUAGE,
+    HDR_AUTHORIZATION,
+    HDR_CACHE_CONTROL,
+    HDR_CONNECTION,
+    HDR_CONTENT_LENGTH,
+    HDR_CONTENT_TYPE,
+    HDR_COOKIE,
+    HDR_HOST,
+    HDR_HTTP2_SETTINGS,
+    HDR_IF_MODIFIED_SINCE,
+    HDR_IF_NONE_MATCH,
+    HDR_IF_RANGE,
+    HDR_ORIGIN,
+    HDR_RANGE,
+    HDR_REFERER,
+    HDR_TRANSFER_ENCODING,
+    HDR_UPGRADE,
+    HDR_USER_AGENT,
+    HDR_COUNT
+};
+
+struct header_field
+{
+    std::string_view name;
+    std::string_view value;
+};
+
+class header_table
+{
+public:
+    static const int MAX_OTHERS = 32;
+
+    header_table() : m_present(0), m_other_count(0) {}
+
+    //字段名(不区分大小写)对应的编号，不是常用字段时返回HDR_OTHER，只做一次哈希和一两次比较
+    static HEADER_ID intern(const char *name, size_t len);
+
+    void clear()
+    {
+        m_present = 0;
+        m_other_count = 0;
+    }
+    //加入一个字段，返回它的编号；同名的常用字段只保留第一个
+    HEADER_ID add(const char *name, size_t name_len, const char *value, size_t value_len);
+    bool has(HEADER_ID id) const
+    {
+        return m_present >> id & 1;
+    }
+    //常用字段的值，没有该字段时data()为NULL
+    std::string_view get(HEADER_ID id) const
+    {
+        return has(id) ? m_known[id] : std::string_view();
+    }
+    //按名字查找任意字段，常用字段同样可以查到
+    std::string_view find(const char *name, size_t len) const;
+    int other_count() const
+    {
+        return m_other_count;
+    }
+    const header_field &other(int i) const
+    {
+        return m_others[i];
+    }
+    //读缓冲区搬移后修正指向[old_buf, old_buf + size)的视图
+    void rebase(const char *old_buf, size_t size, const char *new_buf);
+
+private:
+    std::string_view m_known[HDR_COUNT];
+    uint32_t m_present; //第i位表示有编号为i的字段
+    header_field m_others[MAX_OTHERS];
+    int m_other_count;
+};
+
+#endif
@@ -0,0 +1,433 @@
+#include "hpack.h"
+
+#include <string.h>
+#include <stdint.h>
+
+//静态表(RFC 7541附录A)
+static const struct
+{
+    const char *name;
+    const char *value;
+} static_table[hpack_table::STATIC_COUNT] = {
+    {":authority", ""}, {":method", "GET"},
+    {":method", "POST"}, {":path", "/"},
+    {":path", "/index.html"}, {":scheme", "http"},
+    {":scheme", "https"}, {":status", "200"},
+    {":status", "204"}, {":status", "206"},
+    {":status", "304"}, {":status", "400"},
+    {":status", "404"}, {":status", "500"},
+    {"accept-charset", ""}, {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""}, {"accept-ranges", ""},
+    {"accept", ""}, {"access-control-allow-origin", ""},
+    {"age", ""}, {"allow", ""},
+    {"authorization", ""}, {"cache-control", ""},
+    {"content-disposition", ""}, {"content-encoding", ""},
+    {"content-language", ""}, {"content-length", ""},
+    {"content-location", ""}, {"content-range", ""},
+    {"content-type", ""}, {"cookie", ""},
+    {"date", ""}, {"etag", ""},
+    {"expect", ""}, {"expires", ""},
+    {"from", ""}, {"host", ""},
+    {"if-match", ""}, {"if-modified-since", ""},
+    {"if-none-match", ""}, {"if-range", ""},
+    {"if-unmodified-since", ""}, {"last-modified", ""},
+    {"link", ""}, {"location", ""},
+    {"max-forwards", ""}, {"proxy-authenticate", ""},
+    {"proxy-authorization", ""}, {"range", ""},
+    {"referer", ""}, {"refresh", ""},
+    {"retry-after", ""}, {"server", ""},
+    {"set-cookie", ""}, {"strict-transport-security", ""},
+    {"transfer-encoding", ""}, {"user-agent", ""},
+    {"vary", ""}, {"via", ""},
+    {"www-authenticate", ""},
+};
+
+//Huffman编码表(RFC 7541附录B)，下标为字节值，256为EOS
+static const struct
+{
+    uint32_t code;
+    int bits;
+} huffman_codes[257] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28}, {0xfffffe4, 28}, {0xfffffe5, 28},
+    {0xfffffe6, 28}, {0xfffffe7, 28}, {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28}, {0xfffffed, 28}, {0xfffffee, 28},
+    {0xfffffef, 28}, {0xffffff0, 28}, {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28}, {0xffffff8, 28}, {0xffffff9, 28},
+    {0xffffffa, 28}, {0xffffffb, 28}, {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+    {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11}, {0x3fa, 10}, {0x3fb, 10},
+    {0xf9, 8}, {0x7fb, 11}, {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+    {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6}, {0x1a, 6}, {0x1b, 6},
+    {0x1c, 6}, {0x1d, 6}, {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+    {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10}, {0x1ffa, 13}, {0x21, 6},
+    {0x5d, 7}, {0x5e, 7}, {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+    {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7}, {0x67, 7}, {0x68, 7},
+    {0x69, 7}, {0x6a, 7}, {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7}, {0xfc, 8}, {0x73, 7},
+    {0xfd, 8}, {0x1ffb, 13}, {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5}, {0x24, 6}, {0x5, 5},
+    {0x25, 6}, {0x26, 6}, {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+    {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5}, {0x2b, 6}, {0x76, 7},
+    {0x2c, 6}, {0x8, 5}, {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+    {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15}, {0x7fc, 11}, {0x3ffd, 14},
+    {0x1ffd, 13}, {0xffffffc, 28}, {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+    {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23}, {0x3fffd6, 22}, {0x7fffda, 23},
+    {0x7fffdb, 23}, {0x7fffdc, 23}, {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+    {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23}, {0xffffee, 24}, {0x7fffe1, 23},
+    {0x7fffe2, 23}, {0x7fffe3, 23}, {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+    {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24}, {0x3fffda, 22}, {0x1fffdd, 21},
+    {0xfffe9, 20}, {0x3fffdb, 22}, {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+    {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24}, {0x1fffdf, 21}, {0x3fffdf, 22},
+    {0x7fffeb, 23}, {0x7fffec, 23}, {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+    {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23}, {0xfffea, 20}, {0x3fffe2, 22},
+    {0x3fffe3, 22}, {0x3fffe4, 22}, {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+    {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19}, {0x3fffe7, 22}, {0x7ffff2, 23},
+    {0x3fffe8, 22}, {0x1ffffec, 25}, {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+    {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25}, {0x7fff2, 19}, {0x1fffe3, 21},
+    {0x3ffffe6, 26}, {0x7ffffe0, 27}, {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+    {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26}, {0xffffffd, 28}, {0x7ffffe3, 27},
+    {0x7ffffe4, 27}, {0x7ffffe5, 27}, {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+    {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23}, {0x3fffea, 22}, {0x3fffeb, 22},
+    {0x1ffffee, 25}, {0x1ffffef, 25}, {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+    {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26}, {0x7ffffe7, 27}, {0x7ffffe8, 27},
+    {0x7ffffe9, 27}, {0x7ffffea, 27}, {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+    {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26}, {0x3fffffff, 30},
+};
+
+//由编码表生成的解码树，逐位走到叶子得到一个字节，首次使用时构造
+struct huffman_tree
+{
+    short child[513][2];
+    short sym[513]; //叶子对应的符号，内部节点为-1
+    huffman_tree()
+    {
+        memset(child, -1, sizeof(child));
+        memset(sym, -1, sizeof(sym));
+        int count = 1;
+        for (int s = 0; s < 257; ++s)
+        {
+            int node = 0;
+            for (int i = huffman_codes[s].bits - 1; i >= 0; --i)
+            {
+                int bit = (huffman_codes[s].code >> i) & 1;
+                if (child[node][bit] < 0)
+                    child[node][bit] = count++;
+                node = child[node][bit];
+            }
+            sym[node] = s;
+        }
+    }
+};
+
+static const huffman_tree &huffman()
+{
+    static const huffman_tree tree;
+    return tree;
+}
+
+//结尾不足一个字节的部分是填充，必须是EOS编码的前缀(全1)且不超过7位，中间出现EOS是错误
+static bool huffman_decode(const unsigned char *p, size_t len, std::string &out)
+{
+    const huffman_tree &t = huffman();
+    int node = 0;
+    int depth = 0; //当前符号已读的位数
+    bool ones = true; //当前符号已读的位是否全为1
+    for (size_t i = 0; i < len; ++i)
+    {
+        for (int b = 7; b >= 0; --b)
+        {
+            int bit = (p[i] >> b) & 1;
+            node = t.child[node][bit];
+            if (node < 0)
+                return false;
+            ++depth;
+            ones = ones && bit;
+            if (t.sym[node] >= 0)
+            {
+                if (256 == t.sym[node])
+                    return false;
+                out += (char)t.sym[node];
+                node = 0;
+                depth = 0;
+                ones = true;
+            }
+        }
+    }
+    return depth <= 7 && ones;
+}
+
+static size_t huffman_length(const char *s, size_t len)
+{
+    size_t bits = 0;
+    for (size_t i = 0; i < len; ++i)
+        bits += huffman_codes[(unsigned char)s[i]].bits;
+    return (bits + 7) / 8;
+}
+
+static void huffman_encode(std::string &out, const char *s, size_t len)
+{
+    uint64_t acc = 0;
+    int bits = 0;
+    for (size_t i = 0; i < len; ++i)
+    {
+        const int n = huffman_codes[(unsigned char)s[i]].bits;
+        acc = (acc << n) | huffman_codes[(unsigned char)s[i]].code;
+        bits += n;
+        while (bits >= 8)
+        {
+            bits -= 8;
+            out += (char)(acc >> bits);
+        }
+        acc &= ((uint64_t)1 << bits) - 1;
+    }
+    if (bits > 0) //不足一个字节的部分用1填充
+        out += (char)((acc << (8 - bits)) | (0xff >> bits));
+}
+
+//前缀为prefix位的整数，超过前缀能表示的部分按7位一组续写
+static bool decode_int(const unsigned char *&p, const unsigned char *end, int prefix, size_t &v)
+{
+    if (p >= end)
+        return false;
+    const size_t max = (1u << prefix) - 1;
+    v = *p++ & max;
+    if (v < max)
+        return true;
+    for (int shift = 0; p < end && shift <= 28; shift += 7)
+    {
+        unsigned char b = *p++;
+        v += (size_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+static void encode_int(std::string &out, unsigned char first, int prefix, size_t v)
+{
+    const size_t max = (1u << prefix) - 1;
+    if (v < max)
+    {
+        out += (char)(first | v);
+        return;
+    }
+    out += (char)(first | max);
+    for (v -= max; v >= 128; v >>= 7)
+        out += (char)(0x80 | (v & 0x7f));
+    out += (char)v;
+}
+
+static bool decode_string(const unsigned char *&p, const unsigned char *end, std::string &s)
+{
+    if (p >= end)
+        return false;
+    bool huff = *p & 0x80;
+    size_t len;
+    if (!decode_int(p, end, 7, len) || len > (size_t)(end - p))
+        return false;
+    if (huff)
+    {
+        if (!huffman_decode(p, len, s))
+            return false;
+    }
+    else
+        s.assign((const char *)p, len);
+    p += len;
+    return true;
+}
+
+static void encode_string(std::string &out, const char *s, size_t len)
+{
+    size_t hlen = huffman_length(s, len);
+    if (hlen < len)
+    {
+        encode_int(out, 0x80, 7, hlen);
+        huffman_encode(out, s, len);
+        return;
+    }
+    encode_int(out, 0, 7, len);
+    out.append(s, len);
+}
+
+void hpack_table::set_max_size(size_t size)
+{
+    m_max_size = size;
+    evict(size);
+}
+
+//比上限还大的条目使动态表清空，本身也不加入
+void hpack_table::add(const char *name, size_t name_len, const char *value, size_t value_len)
+{
+    size_t size = name_len + value_len + ENTRY_OVERHEAD;
+    if (size > m_max_size)
+    {
+        evict(0);
+        return;
+    }
+    evict(m_max_size - size);
+    m_entries.push_front(hpack_header(std::string(name, name_len), std::string(value, value_len)));
+    m_size += size;
+}
+
+bool hpack_table::get(size_t index, const char *&name, size_t &name_len, const char *&value, size_t &value_len) const
+{
+    if (0 == index)
+        return false;
+    if (index <= STATIC_COUNT)
+    {
+        name = static_table[index - 1].name;
+        name_len = strlen(name);
+        value = static_table[index - 1].value;
+        value_len = strlen(value);
+        return true;
+    }
+    index -= STATIC_COUNT + 1;
+    if (index >= m_entries.size())
+        return false;
+    const hpack_header &h = m_entries[index];
+    name = h.first.data();
+    name_len = h.first.size();
+    value = h.second.data();
+    value_len = h.second.size();
+    return true;
+}
+
+size_t hpack_table::find(const char *name, size_t name_len, const char *value, size_t value_len, size_t &name_index) const
+{
+    name_index = 0;
+    for (int i = 0; i < STATIC_COUNT; ++i)
+    {
+        if (strlen(static_table[i].name) != name_len || memcmp(static_table[i].name, name, name_len) != 0)
+            continue;
+        if (!name_index)
+            name_index = i + 1;
+        if (strlen(static_table[i].value) == value_len && memcmp(static_table[i].value, value, value_len) == 0)
+            return i + 1;
+    }
+    for (size_t i = 0; i < m_entries.size(); ++i)
+    {
+        const hpack_header &h = m_entries[i];
+        if (h.first.size() != name_len || memcmp(h.first.data(), name, name_len) != 0)
+            continue;
+        if (!name_index)
+            name_index = STATIC_COUNT + 1 + i;
+        if (h.second.size() == value_len && memcmp(h.second.data(), value, value_len) == 0)
+            return STATIC_COUNT + 1 + i;
+    }
+    return 0;
+}
+
+void hpack_table::evict(size_t limit)
+{
+    while (m_size > limit && !m_entries.empty())
+    {
+        const hpack_header &h = m_entries.back();
+        m_size -= h.first.size() + h.second.size() + ENTRY_OVERHEAD;
+        m_entries.pop_back();
+    }
+}
+
+//表大小更新只能出现在头部块开头
+hpack_decoder::RESULT hpack_decoder::decode(const unsigned char *p, size_t len, std::vector<hpack_header> &headers)
+{
+    const unsigned char *end = p + len;
+    bool fields = false; //已解码出字段
+    size_t list_size = 0;
+    while (p < end)
+    {
+        unsigned char b = *p;
+        size_t index;
+        const char *name, *value;
+        size_t name_len, value_len;
+        if (b & 0x80) //下标表示的完整字段
+        {
+            if (!decode_int(p, end, 7, index) || !m_table.get(index, name, name_len, value, value_len))
+                return HPACK_BAD;
+            list_size += name_len + value_len + hpack_table::ENTRY_OVERHEAD;
+            if (list_size > m_max_list)
+                return HPACK_TOO_LARGE;
+            headers.push_back(hpack_header(std::string(name, name_len), std::string(value, value_len)));
+            fields = true;
+            continue;
+        }
+        if (0x20 == (b & 0xe0)) //动态表大小更新
+        {
+            if (fields || !decode_int(p, end, 5, index) || index > m_limit)
+                return HPACK_BAD;
+            m_table.set_max_size(index);
+            continue;
+        }
+        //字面值，01开头的加入动态表，0000和0001开头的不加入
+        bool incremental = 0x40 == (b & 0xc0);
+        if (!decode_int(p, end, incremental ? 6 : 4, index))
+            return HPACK_BAD;
+        hpack_header h;
+        if (index)
+        {
+            if (!m_table.get(index, name, name_len, value, value_len))
+                return HPACK_BAD;
+            h.first.assign(name, name_len);
+        }
+        else if (!decode_string(p, end, h.first))
+            return HPACK_BAD;
+        if (!decode_string(p, end, h.second))
+            return HPACK_BAD;
+        list_size += h.first.size() + h.second.size() + hpack_table::ENTRY_OVERHEAD;
+        if (list_size > m_max_list)
+            return HPACK_TOO_LARGE;
+        if (incremental)
+            m_table.add(h.first.data(), h.first.size(), h.second.data(), h.second.size());
+        headers.push_back(h);
+        fields = true;
+    }
+    return HPACK_OK;
+}
+
+//动态表最多使用默认大小，对方允许更大时也不扩大
+//先缩小到期间的最小值再恢复，与对方按顺序处理两次更新后的动态表一致
+void hpack_encoder::set_max_size(size_t size)
+{
+    if (size > hpack_table::DEFAULT_SIZE)
+        size = hpack_table::DEFAULT_SIZE;
+    if (!m_update)
+    {
+        if (size == m_table.max_size())
+            return;
+        m_update_min = m_table.max_size();
+    }
+    if (size < m_update_min)
+        m_update_min = size;
+    m_table.set_max_size(m_update_min);
+    m_table.set_max_size(size);
+    m_update = true;
+}
+
+void hpack_encoder::begin(std::string &out)
+{
+    if (!m_update)
+        return;
+    if (m_update_min < m_table.max_size())
+        encode_int(out, 0x20, 5, m_update_min);
+    encode_int(out, 0x20, 5, m_table.max_size());
+    m_update = false;
+}
+
+void hpack_encoder::encode(std::string &out, const char *name, size_t name_len, const char *value, size_t value_len,
+                           bool index)
+{
+    size_t name_index;
+    size_t i = m_table.find(name, name_len, value, value_len, name_index);
+    if (i)
+    {
+        encode_int(out, 0x80, 7, i);
+        return;
+    }
+    if (index)
+        encode_int(out, 0x40, 6, name_index);
+    else
+        encode_int(out, 0x00, 4, name_index);
+    if (!name_index)
+        encode_string(out, name, name_len);
+    encode_string(out, value, value_len);
+    if (index)
+        m_table.add(name, name_len, value, value_len);
+}
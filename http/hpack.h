@@ -0,0 +1,83 @@
+#ifndef HTTP_HPACK_H
+#define HTTP_HPACK_H
+
+#include <stddef.h>
+#include <string>
+#include <deque>
+#include <vector>
+#include <utility>
+
+//HPACK(RFC 7541)头部压缩，HTTP/2的请求头和响应头都以它编码
+//字段名一律为小写，first为字段名，second为值
+typedef std::pair<std::string, std::string> hpack_header;
+
+//静态表和动态表组成的索引空间，下标从1开始，1到61为静态表，之后为动态表
+//动态表新条目插在表头，总大小超过上限时从表尾淘汰
+class hpack_table
+{
+public:
+    static const int STATIC_COUNT = 61; //静态表条目数
+    static const int ENTRY_OVERHEAD = 32; //每个条目在名字和值之外计入的大小
+    static const int DEFAULT_SIZE = 4096; //SETTINGS_HEADER_TABLE_SIZE的默认值
+
+    hpack_table() : m_size(0), m_max_size(DEFAULT_SIZE) {}
+    void set_max_size(size_t size); //调整上限，超出的条目立即淘汰
+    size_t max_size() const
+    {
+        return m_max_size;
+    }
+    void add(const char *name, size_t name_len, const char *value, size_t value_len);
+    //按下标取出条目，越界返回false
+    bool get(size_t index, const char *&name, size_t &name_len, const char *&value, size_t &value_len) const;
+    //查找名字和值都相同的条目，返回下标；没有时返回0，name_index为第一个名字相同的下标，也没有时为0
+    size_t find(const char *name, size_t name_len, const char *value, size_t value_len, size_t &name_index) const;
+
+private:
+    void evict(size_t limit);
+    std::deque<hpack_header> m_entries;
+    size_t m_size;
+    size_t m_max_size;
+};
+
+//头部块解码器，每个连接一个，动态表随对方发送的头部块更新
+class hpack_decoder
+{
+public:
+    enum RESULT
+    {
+        HPACK_OK,
+        HPACK_BAD, //格式错误
+        HPACK_TOO_LARGE //解码出的字段列表超过上限
+    };
+    //max_list为本端通告的SETTINGS_MAX_HEADER_LIST_SIZE
+    explicit hpack_decoder(size_t max_list) : m_limit(hpack_table::DEFAULT_SIZE), m_max_list(max_list) {}
+    //解码一个完整的头部块，字段追加到headers
+    //字段列表的大小按每个字段的名字、值的长度加32累计，超过max_list立即停止，很小的头部块经下标引用也无法展开成大量内存
+    //返回HPACK_OK以外的值时动态表已不可用，需要按连接错误处理
+    RESULT decode(const unsigned char *p, size_t len, std::vector<hpack_header> &headers);
+
+private:
+    hpack_table m_table;
+    size_t m_limit; //本端通告的SETTINGS_HEADER_TABLE_SIZE，对方更新表大小时不能超过它
+    size_t m_max_list;
+};
+
+//头部块编码器，每个连接一个
+//完全匹配的字段只写下标，名字匹配的写名字下标加值，字符串在Huffman编码更短时使用Huffman编码
+class hpack_encoder
+{
+public:
+    hpack_encoder() : m_update(false), m_update_min(hpack_table::DEFAULT_SIZE) {}
+    //对方的SETTINGS_HEADER_TABLE_SIZE，下一个头部块开头需要发送表大小更新
+    void set_max_size(size_t size);
+    void begin(std::string &out); //开始一个头部块，有待发送的表大小更新时先写入
+    //写入一个字段，index为false时不加入动态表，用于每个响应都不同的值(如Content-Length)，避免挤掉可复用的条目
+    void encode(std::string &out, const char *name, size_t name_len, const char *value, size_t value_len, bool index);
+
+private:
+    hpack_table m_table;
+    bool m_update; //表大小有变化尚未通知对方
+    size_t m_update_min; //两次头部块之间出现过的最小表大小，需要先通知它再通知最终大小
+};
+
+#endif
@@ -0,0 +1,754 @@
+#include "http2.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+//帧类型
+enum
+{
+    FRAME_DATA = 0x0,
+    FRAME_HEADERS = 0x1,
+    FRAME_PRIORITY = 0x2,
+    FRAME_RST_STREAM = 0x3,
+    FRAME_SETTINGS = 0x4,
+    FRAME_PUSH_PROMISE = 0x5,
+    FRAME_PING = 0x6,
+    FRAME_GOAWAY = 0x7,
+    FRAME_WINDOW_UPDATE = 0x8,
+    FRAME_CONTINUATION = 0x9
+};
+//帧标志
+enum
+{
+    FLAG_END_STREAM = 0x1,
+    FLAG_ACK = 0x1,
+    FLAG_END_HEADERS = 0x4,
+    FLAG_PADDED = 0x8,
+    FLAG_PRIORITY = 0x20
+};
+//SETTINGS参数
+enum
+{
+    SETTINGS_HEADER_TABLE_SIZE = 0x1,
+    SETTINGS_ENABLE_PUSH = 0x2,
+    SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+    SETTINGS_INITIAL_WINDOW_SIZE = 0x4,
+    SETTINGS_MAX_FRAME_SIZE = 0x5,
+    SETTINGS_MAX_HEADER_LIST_SIZE = 0x6
+};
+
+static const char preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+static const long long MAX_WINDOW = 0x7fffffff;
+
+static unsigned get32(const unsigned char *p)
+{
+    return (unsigned)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static void put32(unsigned char *p, unsigned v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+//帧头：24位长度、类型、标志、31位流标识符
+static void put_header(unsigned char *h, int type, int flags, unsigned id, size_t len)
+{
+    h[0] = len >> 16;
+    h[1] = len >> 8;
+    h[2] = len;
+    h[3] = type;
+    h[4] = flags;
+    put32(h + 5, id);
+}
+
+//HTTP2-Settings为不带填充的base64url
+static bool base64url_decode(const char *s, std::string &out)
+{
+    unsigned acc = 0;
+    int bits = 0;
+    for (; *s && '=' != *s && ' ' != *s && '\t' != *s; ++s)
+    {
+        int v;
+        if (*s >= 'A' && *s <= 'Z')
+            v = *s - 'A';
+        else if (*s >= 'a' && *s <= 'z')
+            v = *s - 'a' + 26;
+        else if (*s >= '0' && *s <= '9')
+            v = *s - '0' + 52;
+        else if ('-' == *s)
+            v = 62;
+        else if ('_' == *s)
+            v = 63;
+        else
+            return false;
+        acc = (acc << 6) | v;
+        bits += 6;
+        if (bits >= 8)
+        {
+            bits -= 8;
+            out += (char)(acc >> bits);
+        }
+    }
+    return true;
+}
+
+static h2_stream *new_stream(unsigned id, long long send_window)
+{
+    h2_stream *s = new h2_stream();
+    s->id = id;
+    s->recv_window = h2_session::WINDOW;
+    s->send_window = send_window;
+    s->fd = -1;
+    return s;
+}
+
+h2_session::h2_session(int max_body, bool upgrade)
+    : m_decoder(max_body), m_block_id(0), m_block_flags(0), m_last_id(0), m_max_body(max_body), m_send_window(WINDOW),
+      m_recv_window(WINDOW), m_recv_unacked(0), m_initial_window(WINDOW), m_preface(true), m_settings(true),
+      m_goaway_sent(false), m_peer_goaway(false)
+{
+    if (upgrade)
+        m_out.append("HTTP/1.1 101 Switching Protocols\r\nConnection:Upgrade\r\nUpgrade:h2c\r\n\r\n");
+    //服务器的连接前言，只通告与默认值不同的设置
+    unsigned char payload[12];
+    payload[0] = 0;
+    payload[1] = SETTINGS_MAX_CONCURRENT_STREAMS;
+    put32(payload + 2, MAX_STREAMS);
+    payload[6] = 0;
+    payload[7] = SETTINGS_MAX_HEADER_LIST_SIZE;
+    put32(payload + 8, max_body);
+    write_frame(FRAME_SETTINGS, 0, 0, payload, sizeof(payload));
+}
+
+h2_session::~h2_session()
+{
+    for (std::map<unsigned, h2_stream *>::iterator it = m_streams.begin(); it != m_streams.end(); ++it)
+    {
+        release_body(it->second);
+        delete it->second;
+    }
+}
+
+int h2_session::match_preface(const char *buf, int len)
+{
+    int n = len < PREFACE_LEN ? len : PREFACE_LEN;
+    if (memcmp(buf, preface, n) != 0)
+        return -1;
+    return n == PREFACE_LEN ? 1 : 0;
+}
+
+h2_stream *h2_session::upgrade(const char *settings)
+{
+    std::string payload;
+    if (!base64url_decode(settings, payload) || payload.size() % 6 != 0 ||
+        on_settings((const unsigned char *)payload.data(), payload.size()) != 0)
+        return NULL;
+    h2_stream *s = new_stream(1, m_initial_window);
+    s->request_done = true;
+    m_streams[1] = s;
+    m_last_id = 1;
+    return s;
+}
+
+h2_stream *h2_session::find(unsigned id)
+{
+    std::map<unsigned, h2_stream *>::iterator it = m_streams.find(id);
+    return it == m_streams.end() ? NULL : it->second;
+}
+
+h2_session::RESULT h2_session::consume(char *buf, int &in, int end, h2_stream *&req)
+{
+    if (m_goaway_sent) //连接错误之后的数据不再处理
+    {
+        in = end;
+        return H2_CLOSE;
+    }
+    if (m_preface)
+    {
+        int ret = match_preface(buf + in, end - in);
+        if (ret < 0)
+            return connection_error(H2_PROTOCOL_ERROR, in, end);
+        if (0 == ret)
+            return H2_MORE;
+        in += PREFACE_LEN;
+        m_preface = false;
+    }
+    while (end - in >= FRAME_HEADER_LEN)
+    {
+        const unsigned char *h = (const unsigned char *)buf + in;
+        size_t len = (size_t)h[0] << 16 | h[1] << 8 | h[2];
+        int type = h[3];
+        int flags = h[4];
+        unsigned id = get32(h + 5) & 0x7fffffff;
+        if (len > (size_t)MAX_FRAME)
+            return connection_error(H2_FRAME_SIZE_ERROR, in, end);
+        if ((size_t)(end - in) < FRAME_HEADER_LEN + len) //帧不完整
+            break;
+        in += FRAME_HEADER_LEN + len;
+        //连接前言中的第一帧必须是SETTINGS
+        if (m_settings && FRAME_SETTINGS != type)
+            return connection_error(H2_PROTOCOL_ERROR, in, end);
+        req = NULL;
+        int err = on_frame(type, flags, id, h + FRAME_HEADER_LEN, len, req);
+        if (err)
+            return connection_error(err, in, end);
+        if (req)
+            return H2_REQUEST;
+    }
+    return H2_MORE;
+}
+
+int h2_session::on_frame(int type, int flags, unsigned id, const unsigned char *p, size_t len, h2_stream *&req)
+{
+    //头部块未结束时只能接着收到同一个流的CONTINUATION帧
+    if (m_block_id && (FRAME_CONTINUATION != type || id != m_block_id))
+        return H2_PROTOCOL_ERROR;
+    switch (type)
+    {
+    case FRAME_DATA:
+        return on_data(flags, id, p, len, req);
+    case FRAME_HEADERS:
+        return on_headers(flags, id, p, len, req);
+    case FRAME_CONTINUATION:
+        if (!m_block_id)
+            return H2_PROTOCOL_ERROR;
+        if (m_block.size() + len > (size_t)m_max_body)
+            return H2_ENHANCE_YOUR_CALM;
+        m_block.append((const char *)p, len);
+        return (flags & FLAG_END_HEADERS) ? end_headers(req) : 0;
+    case FRAME_PRIORITY: //不按优先级调度，只检查格式
+        if (0 == id)
+            return H2_PROTOCOL_ERROR;
+        if (5 != len)
+            stream_error(id, H2_FRAME_SIZE_ERROR);
+        return 0;
+    case FRAME_RST_STREAM:
+    {
+        if (0 == id)
+            return H2_PROTOCOL_ERROR;
+        if (4 != len)
+            return H2_FRAME_SIZE_ERROR;
+        if (id > m_last_id) //空闲的流
+            return H2_PROTOCOL_ERROR;
+        h2_stream *s = find(id);
+        if (s)
+            close_stream(s);
+        return 0;
+    }
+    case FRAME_SETTINGS:
+    {
+        if (0 != id)
+            return H2_PROTOCOL_ERROR;
+        if (flags & FLAG_ACK)
+            return 0 == len ? 0 : H2_FRAME_SIZE_ERROR;
+        if (len % 6 != 0)
+            return H2_FRAME_SIZE_ERROR;
+        m_settings = false;
+        int err = on_settings(p, len);
+        if (!err)
+            write_frame(FRAME_SETTINGS, FLAG_ACK, 0, NULL, 0);
+        return err;
+    }
+    case FRAME_PUSH_PROMISE: //客户端不能推送
+        return H2_PROTOCOL_ERROR;
+    case FRAME_PING:
+        if (0 != id)
+            return H2_PROTOCOL_ERROR;
+        if (8 != len)
+            return H2_FRAME_SIZE_ERROR;
+        if (!(flags & FLAG_ACK))
+            write_frame(FRAME_PING, FLAG_ACK, 0, p, len);
+        return 0;
+    case FRAME_GOAWAY: //已开始的流照常完成，之后关闭连接
+        if (0 != id)
+            return H2_PROTOCOL_ERROR;
+        if (len < 8)
+            return H2_FRAME_SIZE_ERROR;
+        m_peer_goaway = true;
+        return 0;
+    case FRAME_WINDOW_UPDATE:
+        return on_window_update(id, p, len);
+    default: //未知类型的帧忽略
+        return 0;
+    }
+}
+
+//整个帧长度(含填充)都计入流量控制
+//连接和流的接收窗口用掉一半以上时才以WINDOW_UPDATE归还，避免每个DATA帧都回复一帧
+int h2_session::on_data(int flags, unsigned id, const unsigned char *p, size_t len, h2_stream *&req)
+{
+    if (0 == id)
+        return H2_PROTOCOL_ERROR;
+    if ((long long)len > m_recv_window)
+        return H2_FLOW_CONTROL_ERROR;
+    m_recv_window -= len;
+    m_recv_unacked += len;
+    if (m_recv_unacked >= WINDOW / 2)
+    {
+        write_window_update(0, m_recv_unacked);
+        m_recv_window += m_recv_unacked;
+        m_recv_unacked = 0;
+    }
+    size_t data_len = len;
+    if (flags & FLAG_PADDED)
+    {
+        if (len < 1 || p[0] >= len)
+            return H2_PROTOCOL_ERROR;
+        data_len = len - 1 - p[0];
+        ++p;
+    }
+
+    h2_stream *s = find(id);
+    if (!s)
+    {
+        if (id > m_last_id)
+            return H2_PROTOCOL_ERROR;
+        return 0; //已关闭(如被重置)的流，数据丢弃
+    }
+    if (s->request_done)
+    {
+        stream_error(id, H2_STREAM_CLOSED);
+        return 0;
+    }
+    if ((long long)len > s->recv_window)
+    {
+        stream_error(id, H2_FLOW_CONTROL_ERROR);
+        return 0;
+    }
+    s->recv_window -= len;
+    if (s->content.size() + data_len > (size_t)m_max_body) //请求体过大
+    {
+        stream_error(id, H2_CANCEL);
+        return 0;
+    }
+    s->content.append((const char *)p, data_len);
+    if (flags & FLAG_END_STREAM)
+    {
+        s->request_done = true;
+        req = s;
+        return 0;
+    }
+    s->recv_unacked += len;
+    if (s->recv_unacked >= WINDOW / 2)
+    {
+        write_window_update(id, s->recv_unacked);
+        s->recv_window += s->recv_unacked;
+        s->recv_unacked = 0;
+    }
+    return 0;
+}
+
+int h2_session::on_headers(int flags, unsigned id, const unsigned char *p, size_t len, h2_stream *&req)
+{
+    if (0 == id)
+        return H2_PROTOCOL_ERROR;
+    if (flags & FLAG_PADDED)
+    {
+        if (len < 1 || p[0] >= len)
+            return H2_PROTOCOL_ERROR;
+        len -= 1 + p[0];
+        ++p;
+    }
+    if (flags & FLAG_PRIORITY) //依赖关系和权重不使用
+    {
+        if (len < 5)
+            return H2_PROTOCOL_ERROR;
+        p += 5;
+        len -= 5;
+    }
+    if (len > (size_t)m_max_body)
+        return H2_ENHANCE_YOUR_CALM;
+    m_block.assign((const char *)p, len);
+    m_block_id = id;
+    m_block_flags = flags;
+    return (flags & FLAG_END_HEADERS) ? end_headers(req) : 0;
+}
+
+//头部块必须解码，即使流随后被拒绝，否则两端的动态表不再一致
+int h2_session::end_headers(h2_stream *&req)
+{
+    unsigned id = m_block_id;
+    bool end_stream = m_block_flags & FLAG_END_STREAM;
+    m_block_id = 0;
+    std::vector<hpack_header> headers;
+    hpack_decoder::RESULT ret = m_decoder.decode((const unsigned char *)m_block.data(), m_block.size(), headers);
+    if (hpack_decoder::HPACK_TOO_LARGE == ret) //超过通告的SETTINGS_MAX_HEADER_LIST_SIZE，头部块没有解码完，动态表已不一致
+        return H2_ENHANCE_YOUR_CALM;
+    if (hpack_decoder::HPACK_OK != ret)
+        return H2_COMPRESSION_ERROR;
+
+    h2_stream *s = find(id);
+    if (s) //请求体之后的尾部字段，内容忽略，必须结束流
+    {
+        if (s->request_done)
+            stream_error(id, H2_STREAM_CLOSED);
+        else if (!end_stream)
+            stream_error(id, H2_PROTOCOL_ERROR);
+        else
+        {
+            s->request_done = true;
+            req = s;
+        }
+        return 0;
+    }
+    //客户端发起的流为奇数，且必须递增
+    if (0 == (id & 1))
+        return H2_PROTOCOL_ERROR;
+    if (id <= m_last_id)
+        return H2_STREAM_CLOSED;
+    m_last_id = id;
+    if (m_streams.size() >= (size_t)MAX_STREAMS)
+    {
+        stream_error(id, H2_REFUSED_STREAM);
+        return 0;
+    }
+    s = new_stream(id, m_initial_window);
+    if (!parse_request(s, headers))
+    {
+        delete s;
+        stream_error(id, H2_PROTOCOL_ERROR);
+        return 0;
+    }
+    m_streams[id] = s;
+    if (end_stream)
+    {
+        s->request_done = true;
+        req = s;
+    }
+    return 0;
+}
+
+//伪首部在前，字段名都是小写，不允许HTTP/1.1的逐跳字段
+bool h2_session::parse_request(h2_stream *s, std::vector<hpack_header> &headers)
+{
+    std::string scheme, authority;
+    bool regular = false;
+    for (size_t i = 0; i < headers.size(); ++i)
+    {
+        hpack_header &h = headers[i];
+        const std::string &name = h.first;
+        for (size_t j = 0; j < name.size(); ++j)
+        {
+            if (name[j] >= 'A' && name[j] <= 'Z')
+                return false;
+        }
+        if (!name.empty() && ':' == name[0])
+        {
+            std::string *field = NULL;
+            if (name == ":method")
+                field = &s->method;
+            else if (name == ":path")
+                field = &s->path;
+            else if (name == ":scheme")
+                field = &scheme;
+            else if (name == ":authority")
+                field = &authority;
+            if (regular || !field || !field->empty())
+                return false;
+            field->swap(h.second);
+            continue;
+        }
+        regular = true;
+        if (name == "connection" || name == "keep-alive" || name == "proxy-connection" ||
+            name == "transfer-encoding" || name == "upgrade")
+            return false;
+        if (name == "te" && h.second != "trailers")
+            return false;
+        s->headers.push_back(hpack_header());
+        s->headers.back().first.swap(h.first);
+        s->headers.back().second.swap(h.second);
+    }
+    return !s->method.empty() && !scheme.empty() && !s->path.empty();
+}
+
+int h2_session::on_settings(const unsigned char *p, size_t len)
+{
+    for (size_t i = 0; i + 6 <= len; i += 6)
+    {
+        int param = p[i] << 8 | p[i + 1];
+        unsigned value = get32(p + i + 2);
+        switch (param)
+        {
+        case SETTINGS_HEADER_TABLE_SIZE:
+            m_encoder.set_max_size(value);
+            break;
+        case SETTINGS_ENABLE_PUSH:
+            if (value > 1)
+                return H2_PROTOCOL_ERROR;
+            break;
+        case SETTINGS_INITIAL_WINDOW_SIZE: //已开始的流按差值调整发送窗口
+        {
+            if (value > MAX_WINDOW)
+                return H2_FLOW_CONTROL_ERROR;
+            long long delta = (long long)value - m_initial_window;
+            for (std::map<unsigned, h2_stream *>::iterator it = m_streams.begin(); it != m_streams.end(); ++it)
+            {
+                if (it->second->send_window + delta > MAX_WINDOW)
+                    return H2_FLOW_CONTROL_ERROR;
+                it->second->send_window += delta;
+            }
+            m_initial_window = value;
+            break;
+        }
+        case SETTINGS_MAX_FRAME_SIZE: //发送的帧不超过默认大小，只检查取值
+            if (value < (unsigned)MAX_FRAME || value > 0xffffff)
+                return H2_PROTOCOL_ERROR;
+            break;
+        default:
+            break;
+        }
+    }
+    return 0;
+}
+
+int h2_session::on_window_update(unsigned id, const unsigned char *p, size_t len)
+{
+    if (4 != len)
+        return H2_FRAME_SIZE_ERROR;
+    long long increment = get32(p) & 0x7fffffff;
+    if (0 == id)
+    {
+        if (0 == increment)
+            return H2_PROTOCOL_ERROR;
+        if (m_send_window + increment > MAX_WINDOW)
+            return H2_FLOW_CONTROL_ERROR;
+        m_send_window += increment;
+        return 0;
+    }
+    h2_stream *s = find(id);
+    if (!s)
+        return id > m_last_id ? H2_PROTOCOL_ERROR : 0;
+    if (0 == increment)
+        stream_error(id, H2_PROTOCOL_ERROR);
+    else if (s->send_window + increment > MAX_WINDOW)
+        stream_error(id, H2_FLOW_CONTROL_ERROR);
+    else
+        s->send_window += increment;
+    return 0;
+}
+
+h2_session::RESULT h2_session::connection_error(int code, int &in, int end)
+{
+    unsigned char payload[8];
+    put32(payload, m_last_id);
+    put32(payload + 4, code);
+    write_frame(FRAME_GOAWAY, 0, 0, payload, sizeof(payload));
+    m_goaway_sent = true;
+    in = end;
+    return H2_CLOSE;
+}
+
+void h2_session::stream_error(unsigned id, int code)
+{
+    unsigned char payload[4];
+    put32(payload, code);
+    write_frame(FRAME_RST_STREAM, 0, id, payload, sizeof(payload));
+    h2_stream *s = find(id);
+    if (s)
+        close_stream(s);
+}
+
+void h2_session::reset(h2_stream *s, int code)
+{
+    stream_error(s->id, code);
+}
+
+//只在没有待发送的批次时调用，流的数据不会被正在发送的iovec引用
+void h2_session::close_stream(h2_stream *s)
+{
+    m_streams.erase(s->id);
+    m_active.remove(s);
+    release_body(s);
+    delete s;
+}
+
+void h2_session::release_body(h2_stream *s)
+{
+    if (s->entry) //缓存条目的映射和文件由缓存管理
+    {
+        file_cache::release(s->entry);
+        s->entry = NULL;
+    }
+    else
+    {
+        if (s->body)
+            munmap(s->body, s->body_len);
+        if (s->fd >= 0)
+            close(s->fd);
+    }
+    s->body = NULL;
+    s->fd = -1;
+}
+
+void h2_session::write_frame(int type, int flags, unsigned id, const void *payload, size_t len)
+{
+    unsigned char h[FRAME_HEADER_LEN];
+    put_header(h, type, flags, id, len);
+    m_out.append((const char *)h, FRAME_HEADER_LEN);
+    if (len)
+        m_out.append((const char *)payload, len);
+}
+
+void h2_session::write_window_update(unsigned id, long long increment)
+{
+    unsigned char payload[4];
+    put32(payload, increment);
+    write_frame(FRAME_WINDOW_UPDATE, 0, id, payload, sizeof(payload));
+}
+
+//状态行中的状态码作为:status，响应头名字转为小写
+//随响应变化的Content-Length和Content-Range不加入动态表
+void h2_session::respond(h2_stream *s, const char *text, int len)
+{
+    const char *end = text + len;
+    s->head.clear();
+    m_encoder.begin(s->head);
+    m_encoder.encode(s->head, ":status", 7, text + 9, 3, true); //"HTTP/1.1 "之后的三位数字
+    const char *p = (const char *)memchr(text, '\n', len);
+    p = p ? p + 1 : end;
+    while (p + 2 <= end && !('\r' == p[0] && '\n' == p[1]))
+    {
+        const char *eol = (const char *)memchr(p, '\r', end - p);
+        if (!eol)
+            eol = end;
+        const char *colon = (const char *)memchr(p, ':', eol - p);
+        char name[64];
+        size_t name_len = colon ? colon - p : 0;
+        if (name_len > 0 && name_len < sizeof(name))
+        {
+            for (size_t i = 0; i < name_len; ++i)
+                name[i] = (p[i] >= 'A' && p[i] <= 'Z') ? p[i] + 32 : p[i];
+            const char *value = colon + 1;
+            while (value < eol && (' ' == *value || '\t' == *value))
+                ++value;
+            bool hop = (10 == name_len && memcmp(name, "connection", 10) == 0) ||
+                       (17 == name_len && memcmp(name, "transfer-encoding", 17) == 0) ||
+                       (10 == name_len && memcmp(name, "keep-alive", 10) == 0);
+            bool varies = (14 == name_len && memcmp(name, "content-length", 14) == 0) ||
+                          (13 == name_len && memcmp(name, "content-range", 13) == 0);
+            if (!hop)
+                m_encoder.encode(s->head, name, name_len, value, eol - value, !varies);
+        }
+        p = eol + 2;
+    }
+    p += 2;
+    if (p < end) //响应体在写缓冲区中，拷贝到流里
+    {
+        s->inline_body.assign(p, end - p);
+        s->send_off = 0;
+        s->send_left = s->inline_body.size();
+    }
+    //请求已处理完，不再需要
+    std::vector<hpack_header>().swap(s->headers);
+    std::string().swap(s->content);
+    m_active.push_back(s);
+}
+
+//载荷不拷贝，另外作为一块
+void h2_session::frame_header(int type, int flags, unsigned id, size_t len, h2_segment *segs, int &n)
+{
+    m_out.resize(m_out.size() + FRAME_HEADER_LEN);
+    unsigned char *h = (unsigned char *)&m_out[m_out.size() - FRAME_HEADER_LEN];
+    put_header(h, type, flags, id, len);
+    h2_segment &seg = segs[n++];
+    seg.base = (char *)h;
+    seg.len = FRAME_HEADER_LEN;
+    seg.fd = -1;
+    seg.off = 0;
+}
+
+//各流每轮最多发送一帧，发送过的流移到队尾，下一批从没轮到的流开始，小响应不必等待大文件发送完
+int h2_session::schedule(h2_segment *segs, int max)
+{
+    //先预留本批所有帧头的空间，之后追加时不会重新分配，已记录的指针保持有效
+    m_out.reserve(m_out.size() + FRAME_HEADER_LEN * max);
+    int n = 0;
+    if (!m_out.empty())
+    {
+        h2_segment &seg = segs[n++];
+        seg.base = &m_out[0];
+        seg.len = m_out.size();
+        seg.fd = -1;
+        seg.off = 0;
+    }
+    //Upgrade切换后，流1的响应等客户端的连接前言和SETTINGS到达后再发送，101之后先只有服务器的SETTINGS
+    if (m_goaway_sent || m_settings)
+        return n;
+
+    size_t idle = 0; //连续没有帧可发的流数，转过一整轮时停止
+    while (!m_active.empty() && n + 2 <= max && idle < m_active.size())
+    {
+        h2_stream *s = m_active.front();
+        m_active.pop_front();
+        bool sent = false;
+        if (!s->head_sent) //响应头不受流量控制
+        {
+            int flags = FLAG_END_HEADERS | (0 == s->send_left ? FLAG_END_STREAM : 0);
+            frame_header(FRAME_HEADERS, flags, s->id, s->head.size(), segs, n);
+            h2_segment &seg = segs[n++];
+            seg.base = &s->head[0];
+            seg.len = s->head.size();
+            seg.fd = -1;
+            seg.off = 0;
+            s->head_sent = true;
+            s->done = 0 == s->send_left;
+            sent = true;
+        }
+        else if (s->send_left > 0 && s->send_window > 0 && m_send_window > 0)
+        {
+            long long len = s->send_left;
+            if (len > MAX_FRAME)
+                len = MAX_FRAME;
+            if (len > s->send_window)
+                len = s->send_window;
+            if (len > m_send_window)
+                len = m_send_window;
+            frame_header(FRAME_DATA, (size_t)len == s->send_left ? FLAG_END_STREAM : 0, s->id, len, segs, n);
+            h2_segment &seg = segs[n++];
+            seg.len = len;
+            seg.fd = -1;
+            seg.off = 0;
+            if (!s->inline_body.empty())
+                seg.base = &s->inline_body[s->send_off];
+            else if (s->body)
+                seg.base = s->body + s->send_off;
+            else
+            {
+                seg.base = NULL;
+                seg.fd = s->fd;
+                seg.off = s->send_off;
+            }
+            s->send_off += len;
+            s->send_left -= len;
+            s->send_window -= len;
+            m_send_window -= len;
+            s->done = 0 == s->send_left;
+            sent = true;
+        }
+        if (s->done)
+        {
+            m_finished.push_back(s);
+            idle = 0;
+            continue;
+        }
+        m_active.push_back(s);
+        idle = sent ? 0 : idle + 1;
+    }
+    return n;
+}
+
+void h2_session::sent()
+{
+    m_out.clear();
+    for (size_t i = 0; i < m_finished.size(); ++i)
+    {
+        m_streams.erase(m_finished[i]->id);
+        release_body(m_finished[i]);
+        delete m_finished[i];
+    }
+    m_finished.clear();
+}
@@ -0,0 +1,143 @@
+#ifndef HTTP_HTTP2_H
+#define HTTP_HTTP2_H
+
+#include <sys/types.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+
+#include "hpack.h"
+#include "../cache/file_cache.h"
+
+//HTTP/2明文连接(h2c)，由连接前言直接开始(prior knowledge)，或由HTTP/1.1请求的Upgrade: h2c切换
+//这里负责帧的解析和生成、流的状态和流量控制，流的请求完整后交给http_conn按原有流程生成响应
+//响应头编码为HEADERS帧，响应体按连接和流的发送窗口切成DATA帧，各流轮流发送，大文件不会阻塞其他流
+
+//一批待发送数据中的一块，fd不为-1时表示以sendfile发送文件的一段，此时base为NULL
+struct h2_segment
+{
+    char *base;
+    size_t len;
+    int fd;
+    off_t off;
+};
+
+//一个流，请求部分由h2_session解析填写，响应体由http_conn填写
+struct h2_stream
+{
+    unsigned id;
+    bool request_done; //请求已完整，对方一端已关闭
+    std::string method;
+    std::string path;
+    std::vector<hpack_header> headers; //普通请求头，不含伪首部
+    std::string content; //请求体
+    long long recv_window; //对方还可以发送的请求体长度
+    long long recv_unacked; //已接收但尚未以WINDOW_UPDATE归还的长度
+    long long send_window; //还可以发送的响应体长度，对方减小初始窗口时可能为负
+
+    std::string head; //编码后的响应头块
+    std::string inline_body; //写缓冲区中生成的响应体(错误页面等)，有它时不使用下面的文件
+    char *body; //资源文件映射到的内存或缓存条目的数据
+    int fd; //以sendfile发送时资源文件的描述符
+    file_cache::entry *entry; //响应体来自文件缓存时为对应的条目，body和fd属于条目
+    size_t body_len; //映射的长度
+    size_t send_off; //下一段响应体在文件中的位置
+    size_t send_left; //尚未发送的响应体长度
+    bool head_sent; //HEADERS帧已排入发送
+    bool done; //带END_STREAM的帧已排入发送
+};
+
+class h2_session
+{
+public:
+    enum RESULT
+    {
+        H2_MORE, //已处理完所有完整的帧，需要继续接收
+        H2_REQUEST, //一个流的请求已完整
+        H2_CLOSE //连接错误，已写入GOAWAY，发送完后关闭连接
+    };
+    enum ERROR_CODE
+    {
+        H2_NO_ERROR = 0x0,
+        H2_PROTOCOL_ERROR = 0x1,
+        H2_INTERNAL_ERROR = 0x2,
+        H2_FLOW_CONTROL_ERROR = 0x3,
+        H2_STREAM_CLOSED = 0x5,
+        H2_FRAME_SIZE_ERROR = 0x6,
+        H2_REFUSED_STREAM = 0x7,
+        H2_CANCEL = 0x8,
+        H2_COMPRESSION_ERROR = 0x9,
+        H2_ENHANCE_YOUR_CALM = 0xb
+    };
+    static const int PREFACE_LEN = 24; //客户端连接前言"PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+    static const int FRAME_HEADER_LEN = 9;
+    static const int MAX_FRAME = 16384; //SETTINGS_MAX_FRAME_SIZE的默认值，接收和发送的帧都不超过它
+    static const int READ_MIN = FRAME_HEADER_LEN + MAX_FRAME; //读缓冲区至少要放得下一个完整的帧
+    static const int MAX_STREAMS = 100; //通告的SETTINGS_MAX_CONCURRENT_STREAMS
+    static const int WINDOW = 65535; //初始窗口大小
+
+    //max_body为请求体和请求头块的长度上限；upgrade为true时由Upgrade切换而来，先写入101响应
+    h2_session(int max_body, bool upgrade);
+    ~h2_session();
+
+    //buf开头是否为连接前言，返回1表示是，0表示数据还不够无法判断，-1表示不是
+    static int match_preface(const char *buf, int len);
+    //应用Upgrade请求HTTP2-Settings中的设置，并把该请求作为流1，格式错误返回NULL，此时不应切换
+    h2_stream *upgrade(const char *settings);
+    h2_stream *find(unsigned id);
+
+    //解析buf中[in, end)的完整帧，in随之前进，某个流的请求完整时返回H2_REQUEST，req为该流
+    //帧不完整时停在帧开头，连接错误时丢弃剩余数据
+    RESULT consume(char *buf, int &in, int end, h2_stream *&req);
+    //把http_conn生成的HTTP/1.1格式响应(状态行、响应头、空行和可能的响应体)转换为流的响应
+    //响应体的文件字段由调用者先填写，逐跳的响应头(Connection等)丢弃
+    void respond(h2_stream *s, const char *text, int len);
+    void reset(h2_stream *s, int code); //以RST_STREAM结束流，用于生成响应失败
+    //组织下一批待发送的帧，写入segs，返回块数，最多max块
+    //先是积累的控制帧，然后各流轮流发送一帧，受连接和流的发送窗口限制
+    int schedule(h2_segment *segs, int max);
+    void sent(); //上一批已全部发送，释放已结束的流
+    bool closing() const //发送完后关闭连接
+    {
+        return m_goaway_sent || (m_peer_goaway && m_streams.empty());
+    }
+
+private:
+    int on_frame(int type, int flags, unsigned id, const unsigned char *p, size_t len, h2_stream *&req);
+    int on_data(int flags, unsigned id, const unsigned char *p, size_t len, h2_stream *&req);
+    int on_headers(int flags, unsigned id, const unsigned char *p, size_t len, h2_stream *&req);
+    int end_headers(h2_stream *&req); //头部块完整，解码并建立流
+    int on_settings(const unsigned char *p, size_t len); //应用对方的设置，返回错误码，0表示成功
+    int on_window_update(unsigned id, const unsigned char *p, size_t len);
+    bool parse_request(h2_stream *s, std::vector<hpack_header> &headers); //检查伪首部和普通请求头，请求格式错误返回false
+    RESULT connection_error(int code, int &in, int end);
+    void stream_error(unsigned id, int code); //发送RST_STREAM，流存在时关闭
+    void close_stream(h2_stream *s);
+    void write_frame(int type, int flags, unsigned id, const void *payload, size_t len);
+    void write_window_update(unsigned id, long long increment);
+    void frame_header(int type, int flags, unsigned id, size_t len, h2_segment *segs, int &n);
+    static void release_body(h2_stream *s);
+
+    std::map<unsigned, h2_stream *> m_streams; //未结束的流
+    std::list<h2_stream *> m_active; //有响应待发送的流，按轮转顺序排列
+    std::vector<h2_stream *> m_finished; //响应已全部排入发送的流，本批发送完后释放
+    std::string m_out; //待发送的控制帧和本批的帧头
+    hpack_decoder m_decoder;
+    hpack_encoder m_encoder;
+    std::string m_block; //正在接收的头部块，跨CONTINUATION帧拼接
+    unsigned m_block_id; //头部块所属的流，没有未完成的头部块时为0
+    int m_block_flags; //头部块第一帧(HEADERS)的标志
+    unsigned m_last_id; //对方发起的最大流标识符
+    int m_max_body;
+    long long m_send_window; //连接的发送窗口
+    long long m_recv_window; //连接的接收窗口
+    long long m_recv_unacked;
+    long long m_initial_window; //对方的SETTINGS_INITIAL_WINDOW_SIZE
+    bool m_preface; //还在等待客户端连接前言
+    bool m_settings; //还在等待连接前言之后的第一个SETTINGS帧
+    bool m_goaway_sent;
+    bool m_peer_goaway;
+};
+
+#endif
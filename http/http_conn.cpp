@@ -5,6 +5,10 @@
 
 //定义http响应的一些状态信息
 const char *ok_200_title = "OK";
+const char *ok_206_title = "Partial Content";
+const char *error_416_title = "Range Not Satisfiable";
+const char *ok_304_title = "Not Modified";
+const char *ok_204_title = "No Content";
 const char *error_400_title = "Bad Request";
 const char *error_400_form = "Your request has bad syntax or is inherently impossible to staisfy.\n";
 const char *error_403_title = "Forbidden";
@@ -14,11 +18,143 @@ const char *error_404_form = "The requested file was not found on this server.\n
 const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the request file.\n";
 
-locker m_lock;
-map<string, string> users; //用于存储从数据库查询到的所有用户、密码结果集
+//预先拼好的状态行，不在表中的状态码才用格式化拼接
+struct status_fragment
+{
+    int status;
+    const char *line;
+    int len;
+};
+#define STATUS_FRAGMENT(status, line) {status, line, sizeof(line) - 1}
+static const status_fragment status_lines[] = {
+    STATUS_FRAGMENT(200, "HTTP/1.1 200 OK\r\n"),
+    STATUS_FRAGMENT(204, "HTTP/1.1 204 No Content\r\n"),
+    STATUS_FRAGMENT(206, "HTTP/1.1 206 Partial Content\r\n"),
+    STATUS_FRAGMENT(304, "HTTP/1.1 304 Not Modified\r\n"),
+    STATUS_FRAGMENT(403, "HTTP/1.1 403 Forbidden\r\n"),
+    STATUS_FRAGMENT(404, "HTTP/1.1 404 Not Found\r\n"),
+    STATUS_FRAGMENT(416, "HTTP/1.1 416 Range Not Satisfiable\r\n"),
+    STATUS_FRAGMENT(500, "HTTP/1.1 500 Internal Error\r\n"),
+};
+
+//无符号整数转十进制，每次查表写两位，返回长度，buf至少20字节
+static int format_uint(char *buf, unsigned long long v)
+{
+    static const char digits[] = "00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+    char tmp[20];
+    char *p = tmp + sizeof(tmp);
+    while (v >= 100)
+    {
+        const char *d = digits + (v % 100) * 2;
+        v /= 100;
+        *--p = d[1];
+        *--p = d[0];
+    }
+    if (v >= 10)
+    {
+        *--p = digits[v * 2 + 1];
+        *--p = digits[v * 2];
+    }
+    else
+    {
+        *--p = '0' + v;
+    }
+    int len = tmp + sizeof(tmp) - p;
+    memcpy(buf, p, len);
+    return len;
+}
+
+//Accept-Encoding是否接受gzip，逐个检查以逗号分隔的编码，q=0表示明确拒绝
+static bool accepts_gzip(const char *value)
+{
+    while (*value)
+    {
+        value += strspn(value, " \t,");
+        size_t len = strcspn(value, ";, \t");
+        bool match = (len == 4 && strncasecmp(value, "gzip", 4) == 0) || (len == 1 && value[0] == '*');
+        value += len;
+        value += strspn(value, " \t");
+        double q = 1;
+        if (*value == ';')
+        {
+            const char *p = strchr(value, '=');
+            const char *next = strchr(value, ',');
+            if (p && (!next || p < next))
+                q = atof(p + 1);
+        }
+        if (match)
+            return q > 0;
+        value += strcspn(value, ",");
+    }
+    return false;
+}
+
+//Upgrade中是否有h2c，逐个检查以逗号分隔的协议
+static bool upgrades_h2c(const char *value)
+{
+    while (*value)
+    {
+        value += strspn(value, " \t,");
+        size_t len = strcspn(value, " \t,");
+        if (3 == len && strncasecmp(value, "h2c", 3) == 0)
+            return true;
+        value += len;
+    }
+    return false;
+}
+
+//按扩展名判断资源是否为值得压缩的文本
+static bool compressible(const char *path)
+{
+    static const char *exts[] = {".html", ".htm", ".css", ".js", ".txt", ".svg", ".json", ".xml"};
+    const char *dot = strrchr(path, '.');
+    if (!dot)
+        return false;
+    for (size_t i = 0; i < sizeof(exts) / sizeof(exts[0]); ++i)
+    {
+        if (strcasecmp(dot, exts[i]) == 0)
+            return true;
+    }
+    return false;
+}
+
+//If-None-Match中是否有与etag相同的实体标签，按弱比较忽略W/前缀，*匹配任何版本
+static bool etag_match(const char *list, const char *etag, int etag_len)
+{
+    while (*list)
+    {
+        list += strspn(list, " \t,");
+        if ('*' == *list)
+            return true;
+        if (strncmp(list, "W/", 2) == 0)
+            list += 2;
+        if ('"' != *list)
+            return false;
+        const char *close = strchr(list + 1, '"');
+        if (!close)
+            return false;
+        if (close + 1 - list == etag_len && memcmp(list, etag, etag_len) == 0)
+            return true;
+        list = close + 1;
+    }
+    return false;
+}
+
+//解析HTTP日期(IMF-fixdate)，格式错误返回-1
+static time_t parse_http_date(const char *value)
+{
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(value, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (!end)
+        return -1;
+    return timegm(&tm);
+}
 
 void http_conn::initmysql_result(connection_pool *connPool)
 {
+    int m_close_log = connPool->m_close_log; //静态成员函数中使用连接池的日志开关
+
     //先从连接池中取一个连接
     MYSQL *mysql = NULL;
     connectionRAII mysqlcon(&mysql, connPool);
@@ -38,13 +174,92 @@ void http_conn::initmysql_result(connection_pool *connPool)
     //返回所有字段结构的数组
     MYSQL_FIELD *fields = mysql_fetch_fields(result);
 
-    //从结果集中获取下一行，将对应的用户名和密码，存入map中
+    //按行数一次分配好用户表，再从结果集中逐行取出用户名和密码存入
+    user_table *table = user_table::get_instance();
+    table->reserve(mysql_num_rows(result));
     while (MYSQL_ROW row = mysql_fetch_row(result))
     {
-        string temp1(row[0]);
-        string temp2(row[1]);
-        users[temp1] = temp2;
+        table->insert(row[0], row[1]);
     }
+    mysql_free_result(result);
+}
+
+//从请求体user=123&password=123中取出用户名和密码，拷贝到请求的arena中，格式不对时返回false
+static bool parse_user(const route_request &req, const char *&name, const char *&password)
+{
+    if (!req.body || strncmp(req.body, "user=", 5) != 0)
+        return false;
+    const char *amp = strchr(req.body + 5, '&');
+    if (!amp || strncmp(amp, "&password=", 10) != 0)
+        return false;
+    name = req.mem->strndup(req.body + 5, amp - req.body - 5);
+    password = req.mem->strndup(amp + 10, strlen(amp + 10));
+    return true;
+}
+
+//登录，若浏览器端输入的用户名和密码在表中可以查找到则进入欢迎页面
+static const char *login_route(const route_request &req)
+{
+    const char *name, *password;
+    if (!parse_user(req, name, password))
+        return "/logError.html";
+    if (user_table::get_instance()->check(name, password))
+        return "/welcome.html";
+    return "/logError.html";
+}
+
+//注册时写入数据库，在用户名所在分片的锁内调用，成功后才加入用户表
+static bool insert_user(const char *name, const char *password, void *arg)
+{
+    const route_request &req = *(const route_request *)arg;
+    //sql_insert用于存储sql插入语句，按用户名和密码的长度在arena中分配
+    size_t size = strlen(name) + strlen(password) + 64;
+    char *sql_insert = (char *)req.mem->alloc(size);
+    snprintf(sql_insert, size, "INSERT INTO user(username, passwd) VALUES('%s', '%s')", name, password);
+    return mysql_query(req.mysql, sql_insert) == 0;
+}
+
+//注册，先检测数据库中是否有重名的，没有重名的再插入
+static const char *register_route(const route_request &req)
+{
+    const char *name, *password;
+    //重名或写入数据库失败时返回错误页面，同名用户的并发注册只有一个成功
+    if (!parse_user(req, name, password) ||
+        !user_table::get_instance()->insert(name, password, insert_user, (void *)&req))
+        return "/registerError.html";
+    return "/log.html";
+}
+
+//OPTIONS响应的Allow，按路由接受的方法(ROUTE_METHOD的组合)取，GET同时允许HEAD
+struct allow_fragment
+{
+    const char *field;
+    int len;
+};
+#define ALLOW_FRAGMENT(s) {s, sizeof(s) - 1}
+static const allow_fragment allow_fields[] = {
+    ALLOW_FRAGMENT("Allow:OPTIONS\r\n"),
+    ALLOW_FRAGMENT("Allow:GET, HEAD, OPTIONS\r\n"),
+    ALLOW_FRAGMENT("Allow:POST, OPTIONS\r\n"),
+    ALLOW_FRAGMENT("Allow:GET, HEAD, POST, OPTIONS\r\n"),
+};
+
+//内置路由，页面中的表单和链接使用这些路径，哈希在编译期算出
+static constexpr route builtin_routes[] = {
+    {ROUTE_PATH("/0"), ROUTE_EXACT, ROUTE_ANY, "/register.html", NULL},
+    {ROUTE_PATH("/1"), ROUTE_EXACT, ROUTE_ANY, "/log.html", NULL},
+    {ROUTE_PATH("/5"), ROUTE_EXACT, ROUTE_ANY, "/picture.html", NULL},
+    {ROUTE_PATH("/6"), ROUTE_EXACT, ROUTE_ANY, "/video.html", NULL},
+    {ROUTE_PATH("/7"), ROUTE_EXACT, ROUTE_ANY, "/fans.html", NULL},
+    {ROUTE_PATH("/2"), ROUTE_PREFIX, ROUTE_POST, NULL, login_route}, //表单提交到2CGISQL.cgi
+    {ROUTE_PATH("/3"), ROUTE_PREFIX, ROUTE_POST, NULL, register_route}, //表单提交到3CGISQL.cgi
+};
+
+void http_conn::init_routes()
+{
+    router *r = router::get_instance();
+    for (size_t i = 0; i < sizeof(builtin_routes) / sizeof(builtin_routes[0]); ++i)
+        r->add(builtin_routes[i]);
 }
 
 //对文件描述符设置非阻塞
@@ -94,8 +309,64 @@ void modfd(int epollfd, int fd, int ev, int TRIGMode)
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
 }
 
-int http_conn::m_user_count = 0;
-int http_conn::m_epollfd = -1;
+std::atomic<int> http_conn::m_user_count(0);
+std::atomic<unsigned long long> http_conn::m_requests(0);
+std::atomic<unsigned long long> http_conn::m_alloc_requests(0);
+std::atomic<unsigned long long> http_conn::m_heap_allocs(0);
+std::atomic<unsigned long long> http_conn::m_shed(0);
+int http_conn::m_read_max = 64 * 1024;
+bool http_conn::m_sendfile = false;
+bool http_conn::m_h2c = true;
+int http_conn::m_idle_timeout = 15000;
+int http_conn::m_header_timeout = 10000;
+int http_conn::m_body_timeout = 30000;
+int http_conn::m_max_keepalive = 1000;
+int http_conn::m_min_rate = 500;
+int http_conn::m_write_quantum = 256 * 1024;
+std::vector<std::pair<string, string> > http_conn::m_cache_control;
+char http_conn::m_date_header[2][DATE_HEADER_LEN + 1];
+std::atomic<int> http_conn::m_date_idx(0);
+time_t http_conn::m_date_sec = 0;
+
+//写入不在使用的一份再切换下标，读者总能看到完整的字符串
+//同一份要到两秒后才会再次被改写，拷贝36字节不会跨越这么久
+void http_conn::update_date()
+{
+    time_t now = time(NULL);
+    if (now == m_date_sec)
+        return;
+    m_date_sec = now;
+    int next = 1 - m_date_idx.load(std::memory_order_relaxed);
+    char *buf = m_date_header[next];
+    memcpy(buf, "Date:", 5);
+    file_cache::format_http_date(now, buf + 5, DATE_HEADER_LEN - 6);
+    memcpy(buf + DATE_HEADER_LEN - 2, "\r\n", 3);
+    m_date_idx.store(next, std::memory_order_release);
+}
+
+void http_conn::set_cache_control(const string &spec)
+{
+    m_cache_control.clear();
+    size_t pos = 0;
+    while (pos < spec.size())
+    {
+        size_t end = spec.find(';', pos);
+        if (end == string::npos)
+            end = spec.size();
+        string item = spec.substr(pos, end - pos);
+        pos = end + 1;
+        size_t eq = item.find('=');
+        if (eq == string::npos || 0 == eq || eq + 1 == item.size() || item[0] != '/')
+            continue;
+        m_cache_control.push_back(std::make_pair(item.substr(0, eq), "Cache-Control:" + item.substr(eq + 1) + "\r\n"));
+    }
+    //长的前缀优先匹配
+    for (size_t i = 1; i < m_cache_control.size(); ++i)
+    {
+        for (size_t j = i; j > 0 && m_cache_control[j].first.size() > m_cache_control[j - 1].first.size(); --j)
+            std::swap(m_cache_control[j], m_cache_control[j - 1]);
+    }
+}
 
 //关闭连接，关闭一个连接，客户总量减一
 void http_conn::close_conn(bool real_close)
@@ -110,18 +381,21 @@ void http_conn::close_conn(bool real_close)
 }
 
 //初始化连接,外部调用初始化套接字地址
-void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMode,
-                     int close_log, string user, string passwd, string sqlname)
+void http_conn::init(int sockfd, const sockaddr_in &addr, int epollfd, completion_queue<http_conn> *cq,
+                     char *root, int TRIGMode, int close_log, string user, string passwd, string sqlname)
 {
     m_sockfd = sockfd;
     m_address = addr;
+    m_epollfd = epollfd;
+    m_cq = cq;
+    m_TRIGMode = TRIGMode; //注册事件前先确定触发模式
 
-    addfd(m_epollfd, sockfd, true, m_TRIGMode);
+    if (m_epollfd >= 0)
+        addfd(m_epollfd, sockfd, true, m_TRIGMode);
     m_user_count++;
 
     //当浏览器出现连接重置时，可能是网站根目录出错或http响应格式出错或者访问的文件中内容完全为空
     doc_root = root;
-    m_TRIGMode = TRIGMode;
     m_close_log = close_log;
 
     strcpy(sql_user, user.c_str());
@@ -132,82 +406,221 @@ void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMo
 }
 
 //初始化新接受的连接
-//check_state默认为分析请求行状态
 void http_conn::init()
 {
     mysql = NULL;
     bytes_to_send = 0;
     bytes_have_send = 0;
-    m_check_state = CHECK_STATE_REQUESTLINE;
-    m_linger = false;
-    m_method = GET;
-    m_url = 0;
-    m_version = 0;
-    m_content_length = 0;
-    m_host = 0;
     m_start_line = 0;
     m_checked_idx = 0;
     m_read_idx = 0;
     m_write_idx = 0;
-    cgi = 0;
+    m_resp_count = 0;
+    m_part_count = 0;
+    m_more = false;
+    m_iv_count = 0;
+    m_iv_idx = 0;
+    m_file_address = 0;
+    m_file_fd = -1;
+    m_file_entry = 0;
+    m_string = 0;
     m_state = 0;
     timer_flag = 0;
-    improv = 0;
+    m_served = 0;
+    m_phase = CONN_BUSY;
+    set_phase(CONN_IDLE); //新连接等待第一个请求
 
-    memset(m_read_buf, '\0', READ_BUFFER_SIZE);
+    shrink_read_buf();
+    memset(m_read_buf, '\0', READ_BUFFER_SIZE + 1);
     memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
+    init_request();
+}
+
+//一个请求处理完后重置请求相关状态
+//check_state默认为分析请求行状态，读缓冲区中该请求之后的数据保留，作为下一个流水线请求继续解析
+void http_conn::init_request()
+{
+    if (m_string) //恢复请求体结尾被覆盖的字节
+    {
+        m_string[m_content_length] = m_content_saved;
+        m_string = 0;
+    }
+    m_check_state = CHECK_STATE_REQUESTLINE;
+    m_linger = false;
+    m_method = GET;
+    m_url = 0;
+    m_version = 0;
+    m_content_length = 0;
+    cgi = 0;
+    m_vary = false;
+    m_chunked = false;
+    m_headers.clear();
+    m_range_count = 0;
+    m_send_off = 0;
+    m_send_len = 0;
+    m_multipart = false;
+    m_start_line = m_checked_idx; //下一个请求从已解析位置开始
+    m_arena.reset(); //归还上一个请求在arena中分配的内存
+
     memset(m_real_file, '\0', FILENAME_LEN);
 }
 
+//将未处理的数据移到读缓冲区开头，为后续接收腾出空间
+//只在请求行尚未解析时移动，此时没有指向读缓冲区的请求字段
+void http_conn::compact()
+{
+    if (m_check_state != CHECK_STATE_REQUESTLINE || m_start_line == 0)
+        return;
+    int left = m_read_idx - m_start_line;
+    memmove(m_read_buf, m_read_buf + m_start_line, left);
+    m_read_buf[left] = '\0';
+    m_read_idx = left;
+    m_checked_idx -= m_start_line;
+    m_start_line = 0;
+    shrink_read_buf();
+}
+
+//扩大读缓冲区，容量按倍数增长，最大为m_read_max
+//已解析的请求字段指向旧缓冲区，搬移后需要修正
+bool http_conn::grow_read_buf(int need)
+{
+    if (m_read_cap - m_read_idx >= need)
+        return true;
+    int cap = m_read_cap;
+    int limit = read_limit();
+    while (cap - m_read_idx < need && cap < limit)
+        cap *= 2;
+    if (cap > limit)
+        cap = limit;
+    if (cap <= m_read_cap)
+        return false;
+
+    char *buf = (char *)malloc(cap + 1);
+    if (!buf)
+        return false;
+    memcpy(buf, m_read_buf, m_read_idx);
+    buf[m_read_idx] = '\0';
+    rebase(m_read_buf, buf);
+    if (m_read_buf != m_inline_buf)
+        free(m_read_buf);
+    m_read_buf = buf;
+    m_read_cap = cap;
+    return m_read_cap - m_read_idx >= need;
+}
+
+//大请求处理完后，剩余数据放得下时换回连接自带的缓冲区，空闲连接不长期占用大块内存
+//只在请求行尚未解析时调用，此时没有指向读缓冲区的请求字段
+void http_conn::shrink_read_buf()
+{
+    if (m_read_buf == m_inline_buf || m_read_idx > READ_BUFFER_SIZE)
+        return;
+    memcpy(m_inline_buf, m_read_buf, m_read_idx);
+    m_inline_buf[m_read_idx] = '\0';
+    free(m_read_buf);
+    m_read_buf = m_inline_buf;
+    m_read_cap = READ_BUFFER_SIZE;
+}
+
+void http_conn::rebase(const char *old_buf, char *new_buf)
+{
+    const char *old_end = old_buf + m_read_cap;
+    //m_url也可能指向常量字符串，只修正指向旧缓冲区的
+    if (m_url >= old_buf && m_url <= old_end)
+        m_url = new_buf + (m_url - old_buf);
+    if (m_version)
+        m_version = new_buf + (m_version - old_buf);
+    m_headers.rebase(old_buf, m_read_cap, new_buf);
+    if (m_string)
+        m_string = new_buf + (m_string - old_buf);
+}
+
+//读缓冲区剩余空间不够时，超出部分先读入栈上的溢出区，再扩大读缓冲区把它拷贝进去
+//小请求不会触发扩容，大请求也只需一次系统调用就能读入
+int http_conn::readv_once(char *extra)
+{
+    struct iovec iov[2];
+    int space = m_read_cap - m_read_idx;
+    int extra_len = read_limit() - m_read_cap;
+    if (extra_len > READ_EXTRA_SIZE)
+        extra_len = READ_EXTRA_SIZE;
+    iov[0].iov_base = m_read_buf + m_read_idx;
+    iov[0].iov_len = space;
+    iov[1].iov_base = extra;
+    iov[1].iov_len = extra_len > 0 ? extra_len : 0;
+
+    int bytes_read = readv(m_sockfd, iov, 2);
+    if (bytes_read <= 0)
+        return bytes_read;
+    if (CONN_IDLE == m_phase && !m_h2) //下一个请求开始到达，请求头的期限从现在算起
+        set_phase(CONN_HEADER);
+    if (CONN_HEADER == m_phase || CONN_BODY == m_phase)
+        m_recv_bytes.store(m_recv_bytes.load(std::memory_order_relaxed) + bytes_read, std::memory_order_relaxed);
+    if (bytes_read <= space)
+    {
+        m_read_idx += bytes_read;
+        return bytes_read;
+    }
+    m_read_idx = m_read_cap;
+    int left = bytes_read - space;
+    grow_read_buf(left); //溢出区长度不超过上限 - m_read_cap，一定放得下
+    memcpy(m_read_buf + m_read_idx, extra, left);
+    m_read_idx += left;
+    m_read_buf[m_read_idx] = '\0';
+    return bytes_read;
+}
+
 //从状态机，用于分析出一行内容
 //返回值为行的读取状态，有LINE_OK,LINE_BAD,LINE_OPEN
+//用向量化的scan_either直接跳到下一个\r或\n，不再逐字节判断
 http_conn::LINE_STATUS http_conn::parse_line()
 {
-    char temp;
-    for (; m_checked_idx < m_read_idx; ++m_checked_idx)
+    if (m_checked_idx >= m_read_idx)
+        return LINE_OPEN;
+    char *end = m_read_buf + m_read_idx;
+    m_checked_idx = scan_either(m_read_buf + m_checked_idx, end, '\r', '\n') - m_read_buf;
+    if (m_checked_idx == m_read_idx)
+        return LINE_OPEN;
+
+    if (m_read_buf[m_checked_idx] == '\r')
     {
-        temp = m_read_buf[m_checked_idx];
-        if (temp == '\r')
+        if ((m_checked_idx + 1) == m_read_idx)
+            return LINE_OPEN;
+        else if (m_read_buf[m_checked_idx + 1] == '\n')
         {
-            if ((m_checked_idx + 1) == m_read_idx)
-                return LINE_OPEN;
-            else if (m_read_buf[m_checked_idx + 1] == '\n')
-            {
-                m_read_buf[m_checked_idx++] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
-        }
-        else if (temp == '\n')
-        {
-            if (m_checked_idx > 1 && m_read_buf[m_checked_idx - 1] == '\r')
-            {
-                m_read_buf[m_checked_idx - 1] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
+            m_line_end = m_checked_idx;
+            m_read_buf[m_checked_idx++] = '\0';
+            m_read_buf[m_checked_idx++] = '\0';
+            return LINE_OK;
         }
+        return LINE_BAD;
     }
-    return LINE_OPEN;
+    //\n，上次读到的数据恰好以\r结尾时从这里继续
+    if (m_checked_idx > 1 && m_read_buf[m_checked_idx - 1] == '\r')
+    {
+        m_line_end = m_checked_idx - 1;
+        m_read_buf[m_checked_idx - 1] = '\0';
+        m_read_buf[m_checked_idx++] = '\0';
+        return LINE_OK;
+    }
+    return LINE_BAD;
 }
 
 //循环从监听的socket上读取客户数据进入读缓冲区，直到无数据可读或对方关闭连接
 //非阻塞ET工作模式下，需要一次性将数据读完
 bool http_conn::read_once()
 {
-    if (m_read_idx >= READ_BUFFER_SIZE)
+    //读缓冲区已达上限且已满，请求过大
+    if (m_read_idx >= m_read_cap && !grow_read_buf(1))
     {
         return false;
     }
     int bytes_read = 0;
+    char extra[READ_EXTRA_SIZE];
 
     //LT读取数据
     if (0 == m_TRIGMode)
     {
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
-        m_read_idx += bytes_read;
+        bytes_read = readv_once(extra);
 
         if (bytes_read <= 0)
         {
@@ -221,7 +634,10 @@ bool http_conn::read_once()
     {
         while (true)
         {
-            bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+            //缓冲区已达上限且已满时先处理已读入的流水线请求，剩余数据在重新注册事件后会再次通知
+            if (m_read_idx >= m_read_cap && !grow_read_buf(1))
+                break;
+            bytes_read = readv_once(extra);
             if (bytes_read == -1)
             {
                 if (errno == EAGAIN || errno == EWOULDBLOCK)
@@ -232,7 +648,6 @@ bool http_conn::read_once()
             {
                 return false;
             }
-            m_read_idx += bytes_read;
         }
         return true;
     }
@@ -243,12 +658,14 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
 {
     //要访问的资源以及所使用的HTTP版本，其中各个部分之间通过\t或空格分隔。
     //strpbrk在源字符串（s1）中找出最先含有搜索字符串（s2）中任一字符的位置并返回，若找不到则返回空指针
-    m_url = strpbrk(text, " \t");
-    if (!m_url)
+    //parse_line已记录行尾，分隔符用scan_either在[text, end)中查找，不再用strpbrk
+    char *end = m_read_buf + m_line_end;
+    char *url = scan_either(text, end, ' ', '\t');
+    if (url == end)
     {
         return BAD_REQUEST;
     }
-    *m_url++ = '\0'; //将该位置改为\0，用于将前面数据取出，已读取的数据不再会匹配到\t
+    *url++ = '\0'; //将该位置改为\0，用于将前面数据取出，已读取的数据不再会匹配到\t
     char *method = text; //取出数据，并通过与GET和POST比较，以确定请求方式
     if (strcasecmp(method, "GET") == 0) //strcasecmp用于比较字符串，第三个int型参数可以限定比较长度，相同返回0    
         m_method = GET;
@@ -257,6 +674,10 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
         m_method = POST;
         cgi = 1;    //是否启用POST
     }
+    else if (strcasecmp(method, "HEAD") == 0)
+        m_method = HEAD;
+    else if (strcasecmp(method, "OPTIONS") == 0)
+        m_method = OPTIONS;
     else
         return BAD_REQUEST;
 
@@ -264,35 +685,45 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
     //将m_url向后偏移，通过查找继续跳过空格和\t字符，指向请求资源的第一个字符
     //strspn:检索字符串 str1 中第一个不在字符串 str2 中出现的字符下标
     //即m_url跳过匹配的" \t"片段,保持在统一资源标识符开头
-    m_url += strspn(m_url, " \t");   
-    m_version = strpbrk(m_url, " \t");
-    if (!m_version)
+    url += strspn(url, " \t");   
+    m_version = scan_either(url, end, ' ', '\t');
+    if (m_version == end)
         return BAD_REQUEST;
     *m_version++ = '\0';
     m_version += strspn(m_version, " \t");  //m_version同理有，来到http协议版本的开头，并比较协议版本格式
     if (strcasecmp(m_version, "HTTP/1.1") != 0)
         return BAD_REQUEST;
 
+    //OPTIONS *询问服务器整体支持的方法
+    if (OPTIONS == m_method && strcmp(url, "*") == 0)
+    {
+        m_url = url;
+        m_check_state = CHECK_STATE_HEADER;
+        return NO_REQUEST;
+    }
+
     //通常的访问资源都跟在单独的 / 后面
     //这里主要是有些报文的请求资源中会带有 http:// 或者 https://
     //这里需要对这两种情况进行单独处理
-    if (strncasecmp(m_url, "http://", 7) == 0)
+    if (strncasecmp(url, "http://", 7) == 0)
     {
-        m_url += 7;
-        m_url = strchr(m_url, '/');  //m_url移动到访问资源前面的 /, strchr返回s1中字符c第一次出现的位置
+        url += 7;
+        url = strchr(url, '/');  //url移动到访问资源前面的 /, strchr返回s1中字符c第一次出现的位置
     }
 
-    if (strncasecmp(m_url, "https://", 8) == 0)
+    if (url && strncasecmp(url, "https://", 8) == 0)
     {
-        m_url += 8;
-        m_url = strchr(m_url, '/');  
+        url += 8;
+        url = strchr(url, '/');  
     }
 
-    if (!m_url || m_url[0] != '/')
+    if (!url || url[0] != '/')
         return BAD_REQUEST;
+    m_url = url;
     //当url为/时，显示判断界面
+    //不再把judge.html拼接到读缓冲区中，那样会覆盖其后的数据
     if (strlen(m_url) == 1)
-        strcat(m_url, "judge.html");   //strcat将字符串s2接续到s1的结尾
+        m_url = "/judge.html";
     m_check_state = CHECK_STATE_HEADER;   //请求行处理完毕，主状态机状态转移为解析请求头
     return NO_REQUEST;
 }
@@ -302,37 +733,78 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
 {
     if (text[0] == '\0') //检查是否为空行，因为如果是空行，原本的回车符或换行符，已被parse_line()覆写为/0
     {
+        if (m_chunked) //chunked请求体忽略Content-length，边读边解码
+        {
+            m_check_state = CHECK_STATE_CONTENT;
+            m_chunk_decoder.init();
+            m_body_start = m_body_out = m_checked_idx;
+            set_phase(CONN_BODY);
+            return NO_REQUEST;
+        }
         if (m_content_length != 0)  //请求体为空，则是GET请求，不为空则为POST请求
         {
             m_check_state = CHECK_STATE_CONTENT;  //主状态机转化状态为解析请求体
+            set_phase(CONN_BODY);
             return NO_REQUEST;
         }
         return GET_REQUEST;
     }
-    else if (strncasecmp(text, "Connection:", 11) == 0)  //字段是Connection
+
+    //先找到冒号，再按字段名处理
+    char *end = m_read_buf + m_line_end;
+    char *colon = scan_either(text, end, ':', ':');
+    char *value = colon == end ? end : colon + 1;
+    value += strspn(value, " \t");
+    return parse_field(text, colon == end ? 0 : colon - text, value, end - value);
+}
+
+//所有字段存入请求头表，字段名归并为编号只需一次哈希
+//条件请求、Range、压缩等在确定资源后按编号从表中取值，这里只处理决定请求体长度和连接状态的字段
+http_conn::HTTP_CODE http_conn::parse_field(const char *name, int name_len, const char *value, int value_len)
+{
+    //重复的Content-Length只接受相同的值，请求头表保留第一个，这里也只用第一个
+    bool repeated = m_headers.has(HDR_CONTENT_LENGTH);
+    switch (m_headers.add(name, name_len, value, value_len))
     {
-        text += 11;
-        text += strspn(text, " \t");
-        if (strcasecmp(text, "keep-alive") == 0)       //连接状态
+    case HDR_CONNECTION:
+        if (strcasecmp(value, "keep-alive") == 0)       //连接状态
         {
             m_linger = true;    //连接活跃则将m_linger设为true
         }
-    }
-    else if (strncasecmp(text, "Content-length:", 15) == 0)  //字段是Content-length
-    {
-        text += 15;
-        text += strspn(text, " \t");
-        m_content_length = atol(text);   //取出主体长度
-    }
-    else if (strncasecmp(text, "Host:", 5) == 0)  //字段是Host
+        break;
+    case HDR_CONTENT_LENGTH:
     {
-        text += 5;
-        text += strspn(text, " \t");
-        m_host = text;  //取出hos/*  */t内容
+        //只接受十进制数字，且不超过读缓冲区上限；无法确定请求体在哪里结束时之后的数据也无法再解析
+        size_t length = 0;
+        int i = 0;
+        for (; i < value_len && value[i] >= '0' && value[i] <= '9'; ++i)
+        {
+            length = length * 10 + (value[i] - '0');
+            if (length > (size_t)m_read_max)
+                break;
+        }
+        int digits = i;
+        while (i < value_len && (value[i] == ' ' || value[i] == '\t'))
+            ++i;
+        if (digits == 0 || i < value_len || length > (size_t)m_read_max || (repeated && length != m_content_length))
+        {
+            m_linger = false;
+            return BAD_REQUEST;
+        }
+        m_content_length = length;   //取出主体长度
+        break;
     }
-    else
-    {
-        LOG_INFO("oop!unknow header: %s", text);
+    case HDR_TRANSFER_ENCODING:
+        //只支持chunked，其他传输编码无法确定请求体在哪里结束，之后的数据也无法再解析
+        if (strcasecmp(value, "chunked") != 0)
+        {
+            m_linger = false;
+            return BAD_REQUEST;
+        }
+        m_chunked = true;
+        break;
+    default:
+        break;
     }
     return NO_REQUEST;
 }
@@ -340,15 +812,45 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
 //判断http请求是否被完整读入
 http_conn::HTTP_CODE http_conn::parse_content(char *text)
 {
-    if (m_read_idx >= (m_content_length + m_checked_idx)) //此时请求体之前的数据已被checked
+    if ((size_t)(m_read_idx - m_checked_idx) >= m_content_length) //此时请求体之前的数据已被checked
     {
-        text[m_content_length] = '\0';  //如果已完整读入，则将最后一位覆写为/0表示已读
+        //如果已完整读入，则将最后一位覆写为/0表示已读
+        //被覆盖的字节可能属于下一个流水线请求，先保存，请求处理完后恢复
+        m_content_saved = text[m_content_length];
+        text[m_content_length] = '\0';
         m_string = text;  //存储POST请求体最后的用户名和密码字符串
+        m_checked_idx += m_content_length; //请求体也已处理，下一个请求从其后开始
         return GET_REQUEST;
     }
     return NO_REQUEST;
 }
 
+//chunked请求体，块数据在读缓冲区内原地拼接
+http_conn::HTTP_CODE http_conn::parse_chunked()
+{
+    int in = m_checked_idx;
+    chunked_decoder::RESULT ret = m_chunk_decoder.decode(m_read_buf, in, m_read_idx, m_body_out);
+    if (chunked_decoder::CHUNK_BAD == ret) //请求体边界已无法确定，响应后关闭连接
+    {
+        m_linger = false;
+        return BAD_REQUEST;
+    }
+    if (chunked_decoder::CHUNK_MORE == ret)
+    {
+        //已读入的数据全部解码，块长度行占用的空间收回，继续从已解码数据之后接收
+        m_read_idx = m_body_out;
+        m_checked_idx = m_body_out;
+        return NO_REQUEST;
+    }
+    //解码后的请求体比原数据短，结尾之后到in之间是已处理的分块格式，写入\0不会影响下一个流水线请求
+    m_checked_idx = in;
+    m_content_length = m_body_out - m_body_start;
+    m_string = m_read_buf + m_body_start;
+    m_content_saved = m_string[m_content_length];
+    m_string[m_content_length] = '\0';
+    return GET_REQUEST;
+}
+
 http_conn::HTTP_CODE http_conn::process_read() //主状态机处理请求报文
 {
     LINE_STATUS line_status = LINE_OK;
@@ -358,7 +860,7 @@ http_conn::HTTP_CODE http_conn::process_read() //主状态机处理请求报文
     //此处的循环逻辑，若请求报文的每一行末尾都是回车符 + 换行符，则只需要(line_status = parse_line()) == LINE_OK）
     //但为了避免登录和注册操作过程中用户名和密码直接暴露在url中，将其封装在请求体的末尾，因此请求体最后一行不是以回车符 + 换行符结尾
     //读请求体的非结尾行时，满足m_check_state == CHECK_STATE_CONTENT && line_status == LINE_OK
-    //读完请求体结尾行，line_status != LINE_OK，以此退出循环
+    //请求体在CHECK_STATE_CONTENT分支中按Content-Length一次判断，完整时处理请求，不完整时直接返回
     //POST和GET的区别就是有无请求体，因此CHECK_STATE_CONTENT状态是特意为POST设计的
     while ((m_check_state == CHECK_STATE_CONTENT && line_status == LINE_OK) || ((line_status = parse_line()) == LINE_OK))
     {
@@ -381,21 +883,28 @@ http_conn::HTTP_CODE http_conn::process_read() //主状态机处理请求报文
                 return BAD_REQUEST;
             else if (ret == GET_REQUEST)
             {
+                //没有请求体的请求才切换，之后的do_request已按HTTP/2连接处理
+                if (m_h2c && 0 == m_resp_count && m_headers.has(HDR_HTTP2_SETTINGS) && m_headers.has(HDR_UPGRADE) &&
+                    upgrades_h2c(m_headers.get(HDR_UPGRADE).data()))
+                    h2_upgrade();
                 return do_request();
             }
             break;
         }
         case CHECK_STATE_CONTENT:
         {
+            if (m_chunked) //请求体不完整时直接返回，不能再按行解析，否则会改写块数据中的CRLF
+            {
+                ret = parse_chunked();
+                return ret == GET_REQUEST ? do_request() : ret;
+            }
             ret = parse_content(text);       //请求体
             if (ret == GET_REQUEST)
                 return do_request();
 
-            //每读完一行请求体，都将从状态机设为LINE_OPEN
-            //在解析请求体非结尾行时，从状态机能够通过parse_line()重新回到LINE_OK进入循环
-            //在解析请求体结尾行时，从状态机保持LINE_OPEN状态，从而退出循环
-            line_status = LINE_OPEN;  
-            break;
+            //请求体不完整时直接返回，等待后续数据
+            //不能回到循环条件再调用parse_line()，否则m_checked_idx会越过已收到的部分请求体，分多次到达的请求体永远等不到完整
+            return NO_REQUEST;
         }
         default:
             return INTERNAL_ERROR;
@@ -409,113 +918,66 @@ http_conn::HTTP_CODE http_conn::do_request()
     //将初始化的m_real_file赋值为网站根目录
     strcpy(m_real_file, doc_root);
     int len = strlen(doc_root);  //记录网站根目录长度
-    //printf("m_url:%s\n", m_url);
-    const char *p = strrchr(m_url, '/'); //获取m_url中/的位置
-
-    //处理cgi
-    if (cgi == 1 && (*(p + 1) == '2' || *(p + 1) == '3'))  //2为登录，3为注册
-    {
-
-        //根据标志判断是登录检测还是注册检测
-        char flag = m_url[1];
-
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/");
-        strcat(m_url_real, m_url + 2); //把请求资源开头的标志位去掉，保留真正的请求资源名
-        strncpy(m_real_file + len, m_url_real, FILENAME_LEN - len - 1); //m_real_file开头是网站根目录，在后面接上请求资源名
-        free(m_url_real); //释放m_url_real
-
-        //将用户名和密码提取出来
-        //user=123&passwd=123，放在请求体的最后
-        char name[100], password[100];
-        int i;
-        for (i = 5; m_string[i] != '&'; ++i)
-            name[i - 5] = m_string[i];
-        name[i - 5] = '\0';
-
-        int j = 0;
-        for (i = i + 10; m_string[i] != '\0'; ++i, ++j)
-            password[j] = m_string[i];
-        password[j] = '\0';
-
-        if (*(p + 1) == '3')
-        {
-            char *sql_insert = (char *)malloc(sizeof(char) * 200);  //sql_insert用于存储sql插入语句
-            strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
-            strcat(sql_insert, "'");
-            strcat(sql_insert, name);
-            strcat(sql_insert, "', '");
-            strcat(sql_insert, password);
-            strcat(sql_insert, "')");
-
-            if (users.find(name) == users.end()) //如果是注册，先检测数据库中是否有重名的
-            {
-                m_lock.lock();
-                int res = mysql_query(mysql, sql_insert);  //没有重名的，进行增加数据, 要上锁
-                users.insert(pair<string, string>(name, password)); 
-                m_lock.unlock();
-
-                if (!res)  
-                    strcpy(m_url, "/log.html"); //根据结果的不同，给m_url赋不同的资源名
-                else
-                    strcpy(m_url, "/registerError.html");
-            }
-            else
-                strcpy(m_url, "/registerError.html");
-        }
-        //如果是登录，直接判断
-        //若浏览器端输入的用户名和密码在表中可以查找到，返回1，否则返回0
-        else if (*(p + 1) == '2')
-        {
-            if (users.find(name) != users.end() && users[name] == password)
-                strcpy(m_url, "/welcome.html");
-            else
-                strcpy(m_url, "/logError.html");
-        }
-    }
 
-    if (*(p + 1) == '0') //只需补齐m_real_file
-    {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/register.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));   
+    //Range在确定资源之前解析，压缩版本的选择要先知道是否为Range请求
+    if (m_headers.has(HDR_RANGE))
+        parse_range(m_headers.get(HDR_RANGE).data());
 
-        free(m_url_real);
-    }
-    else if (*(p + 1) == '1')  //只需补齐m_real_file
+    //按路由表把特殊路径换成对应的页面，登录和注册由处理函数校验后选择页面
+    size_t path_len = strcspn(m_url, "?");
+    const route *r = '*' == m_url[0] ? NULL : router::get_instance()->match(m_url, path_len);
+    //OPTIONS只按路由表回答允许的方法，不调用处理函数，也不访问文件系统
+    //没有路由的路径是静态资源，*表示服务器整体
+    if (OPTIONS == m_method)
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/log.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        m_allow = r ? r->methods : '*' == m_url[0] ? ROUTE_ANY : ROUTE_GET;
+        return OPTIONS_REQUEST;
     }
-    else if (*(p + 1) == '5')  //只需补齐m_real_file
+    //HEAD与GET选择同一个资源
+    if (r && (r->methods & (POST == m_method ? ROUTE_POST : ROUTE_GET)))
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/picture.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        const char *page = r->page;
+        if (r->handler)
+        {
+            route_request req = {POST == m_method ? ROUTE_POST : ROUTE_GET, m_url, path_len, m_string,
+                                 m_content_length, mysql, &m_arena, &m_headers};
+            page = r->handler(req);
+        }
+        if (page)
+            m_url = page;
     }
-    else if (*(p + 1) == '6')  //只需补齐m_real_file
-    {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/video.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+    strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1); //m_real_file开头是网站根目录，在后面接上请求资源名
 
-        free(m_url_real);
-    }
-    else if (*(p + 1) == '7')  //只需补齐m_real_file
+    //先查编译进程序的资源，压缩版本也是构建时生成的，不在资源表中的再查文件缓存和文件系统
+    asset_bundle *bundle = asset_bundle::get_instance();
+    if (bundle->enabled())
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/fans.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+        m_file_entry = bundle->acquire(m_url);
+        if (m_file_entry)
+        {
+            m_file_stat = m_file_entry->st;
+            file_cache::entry *gz = wants_gzip() ? bundle->acquire_gzip(m_url) : NULL;
+            if (gz)
+            {
+                file_cache::release(m_file_entry);
+                m_file_entry = gz;
+            }
+            return FILE_REQUEST;
+        }
+    }
 
-        free(m_url_real);
+    //再查文件缓存，命中时不访问文件系统
+    file_cache *cache = file_cache::get_instance();
+    if (cache->enabled())
+    {
+        m_file_entry = cache->acquire(m_real_file);
+        if (m_file_entry)
+        {
+            m_file_stat = m_file_entry->st;
+            choose_gzip();
+            return FILE_REQUEST;
+        }
     }
-    else
-        strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
 
     if (stat(m_real_file, &m_file_stat) < 0) //判断文件资源是否存在
         return NO_RESOURCE;
@@ -526,33 +988,99 @@ http_conn::HTTP_CODE http_conn::do_request()
     if (S_ISDIR(m_file_stat.st_mode)) //判断文件是否为目录
         return BAD_REQUEST;
 
+    //HEAD与GET选择相同的版本，响应头中的长度和ETag才一致
+    if (choose_gzip()) //发送压缩版本，不需要打开源文件
+        return FILE_REQUEST;
+
+    if (HEAD == m_method) //HEAD只需要stat得到的长度和修改时间，不打开和映射文件
+        return FILE_REQUEST;
+
     int fd = open(m_real_file, O_RDONLY);
+    if (m_sendfile) //不映射，保留文件描述符，发送响应头后由sendfile直接从页缓存发送
+    {
+        if (fd < 0)
+            return NO_RESOURCE;
+        m_file_fd = fd;
+        return FILE_REQUEST;
+    }
     m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0); //将文件内容映射到内存中
     close(fd);
+    if (m_file_address == MAP_FAILED) //空文件无法映射
+        m_file_address = 0;
     return FILE_REQUEST; //请求资源文件正常，跳转process_write
 }
 void http_conn::unmap() //删除特定区域的映射
+{
+    m_encoder.reset();
+    for (int i = 0; i < m_resp_count; ++i)
+    {
+        if (m_resp[i].entry) //缓存条目的映射和文件由缓存管理
+        {
+            file_cache::get_instance()->release(m_resp[i].entry);
+            m_resp[i].entry = 0;
+            m_resp[i].body = 0;
+            m_resp[i].fd = -1;
+            continue;
+        }
+        if (m_resp[i].body)
+        {
+            munmap(m_resp[i].body, m_resp[i].body_len);
+            m_resp[i].body = 0;
+        }
+        if (m_resp[i].fd >= 0)
+        {
+            close(m_resp[i].fd);
+            m_resp[i].fd = -1;
+        }
+    }
+    release_file();
+}
+void http_conn::release_file()
 {
     if (m_file_address)
     {
         munmap(m_file_address, m_file_stat.st_size);
         m_file_address = 0;
     }
+    if (m_file_fd >= 0)
+    {
+        close(m_file_fd);
+        m_file_fd = -1;
+    }
+    if (m_file_entry)
+    {
+        file_cache::get_instance()->release(m_file_entry);
+        m_file_entry = 0;
+    }
 }
 bool http_conn::write()
 {
-    int temp = 0;
+    ssize_t temp = 0;
 
     if (bytes_to_send == 0) //要发送的响应报文为空
     {
+        finish_responses();
         modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode); //修改文件描述符上的监听事件为读事件
-        init();  //初始化接收新连接
         return true;
     }
 
+    size_t sent = 0; //本次写事件已发送的字节数
     while (1) //循环writev，需要不断重置iovec数组
     {
-        temp = writev(m_sockfd, m_iv, m_iv_count); //将响应报文的状态行、消息头、空行和响应正文发送给浏览器端
+        //本次写事件的配额已用完，让出循环，等待下一次写事件继续发送，其他连接不必等大文件发完
+        if (m_write_quantum > 0 && sent >= (size_t)m_write_quantum)
+        {
+            modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+            return true;
+        }
+        //一次writev发出排队的响应，遇到以sendfile发送的响应体时在它之前停下，由sendfile单独发送
+        //对端读得快时一次系统调用就能发出几MB，每次调用的长度也限制在剩余配额之内
+        int run = iov_run();
+        size_t limit = m_write_quantum > 0 ? m_write_quantum - sent : 0;
+        if (run > 0)
+            temp = send_iov(run, limit); //将响应报文的状态行、消息头、空行和响应正文发送给浏览器端
+        else
+            temp = send_body(limit);
 
         if (temp < 0) //发送失败
         {
@@ -568,36 +1096,258 @@ bool http_conn::write()
             return false;
         }
 
-        bytes_have_send += temp;
-        bytes_to_send -= temp;
-        if (bytes_have_send >= m_iv[0].iov_len) //状态行、响应头、空行已发送完毕
+        sent += temp;
+        if (advance(temp)) //全部发送完成
         {
-            m_iv[0].iov_len = 0; 
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx); //记录请求资源文件未发送的数据的起始位置
-            m_iv[1].iov_len = bytes_to_send; //记录请求资源文件未发送的数据长度
+            int more = m_h2 ? next_h2() : next_chunk(); //HTTP/2组织下一批帧，流式响应继续生成下一块
+            if (more > 0)
+                continue;
+            if (more < 0)
+            {
+                unmap();
+                return false;
+            }
+            //删除映射，清空响应队列
+            //先清空再重新监听读事件，Reactor模式下write在工作线程中执行，
+            //重新监听后下一个请求可能立即被另一个工作线程处理
+            if (!finish_responses()) //最后一个响应要求关闭连接
+            {
+                return false;
+            }
+            //读缓冲区中还有完整的请求，由调用者继续处理，不等待读事件
+            if (!m_more)
+            {
+                modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode); //重新开始监听读事件
+            }
+            return true;
         }
-        else  //状态行、响应头、空行未发送完毕，则更新m_iv[0]
+    }
+}
+//已发送bytes字节后更新iovec数组，跳过已发送完的块，全部发送完毕返回true
+bool http_conn::advance(size_t bytes)
+{
+    if (bytes > 0) //发送有进展，顺延期限
+        set_phase(CONN_BUSY);
+    bytes_have_send += bytes;
+    bytes_to_send -= bytes;
+    while (bytes > 0 && m_iv_idx < m_iv_count)
+    {
+        if (bytes >= m_iv[m_iv_idx].iov_len) //这一块已发送完毕
         {
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;  
-            m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
+            bytes -= m_iv[m_iv_idx].iov_len;
+            m_iv[m_iv_idx].iov_len = 0;
+            ++m_iv_idx;
         }
-
-        if (bytes_to_send <= 0) //全部发送完成
+        else //这一块只发送了一部分
         {
-            unmap(); //删除映射
-            modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode); //重新开始监听读事件
-
-            if (m_linger) //连接正常
-            {
-                init();  //初始化新接受的连接
-                return true;
-            }
+            //以sendfile发送的块只记录剩余长度，前移文件偏移
+            if (m_iv_fd[m_iv_idx] >= 0)
+                m_iv_off[m_iv_idx] += bytes;
             else
+                m_iv[m_iv_idx].iov_base = (char *)m_iv[m_iv_idx].iov_base + bytes;
+            m_iv[m_iv_idx].iov_len -= bytes;
+            bytes = 0;
+        }
+    }
+    return 0 == bytes_to_send;
+}
+//按排队顺序组织iovec数组，相邻的响应头在写缓冲区中连续存放，合并为一块
+void http_conn::build_iovec()
+{
+    m_iv_count = 0;
+    m_iv_idx = 0;
+    bytes_to_send = 0;
+    bytes_have_send = 0;
+    for (int i = 0; i < m_resp_count; ++i)
+    {
+        response &r = m_resp[i];
+        push_iov(m_write_buf + r.head_off, r.head_len, -1, 0);
+        if (r.multipart) //每个范围依次为分隔行和该范围的内容，最后是结尾分隔行
+        {
+            for (int j = 0; j < m_part_count; ++j)
             {
-                return false;
+                part &p = m_parts[j];
+                push_iov(m_write_buf + p.head_off, p.head_len, -1, 0);
+                push_iov(r.body ? r.body + p.off : NULL, p.len, r.fd, p.off);
             }
+            push_iov(m_write_buf + m_tail_off, m_tail_len, -1, 0);
+        }
+        else if (r.stream) //第一块已在生成响应头时准备好
+        {
+            push_iov(m_chunk_data, m_chunk_len, -1, 0);
         }
+        else
+        {
+            push_iov(r.body ? r.body + r.send_off : NULL, r.send_len, r.fd, r.send_off);
+        }
+    }
+}
+int http_conn::next_chunk()
+{
+    if (!m_encoder.active() || m_encoder.done())
+        return 0;
+    if (!m_encoder.next(m_chunk_data, m_chunk_len))
+        return -1;
+    m_iv_count = 0;
+    m_iv_idx = 0;
+    bytes_to_send = 0;
+    push_iov(m_chunk_data, m_chunk_len, -1, 0);
+    return 1;
+}
+//追加一块，相邻的内存块(如连续存放的响应头)合并为一块
+void http_conn::push_iov(char *base, size_t len, int fd, off_t off)
+{
+    if (0 == len)
+        return;
+    bytes_to_send += len;
+    if (fd < 0 && m_iv_count > 0 && m_iv_fd[m_iv_count - 1] < 0 &&
+        (char *)m_iv[m_iv_count - 1].iov_base + m_iv[m_iv_count - 1].iov_len == base)
+    {
+        m_iv[m_iv_count - 1].iov_len += len;
+        return;
+    }
+    m_iv[m_iv_count].iov_base = fd < 0 ? base : NULL;
+    m_iv[m_iv_count].iov_len = len;
+    m_iv_fd[m_iv_count] = fd;
+    m_iv_off[m_iv_count] = off;
+    ++m_iv_count;
+}
+int http_conn::iov_run()
+{
+    int i = m_iv_idx;
+    while (i < m_iv_count && m_iv_fd[i] < 0)
+        ++i;
+    return i - m_iv_idx;
+}
+//响应体在页缓存和socket之间直接传送，不经过用户态，也不需要建立和删除映射
+ssize_t http_conn::send_iov(int run, size_t limit)
+{
+    struct iovec *iv = m_iv + m_iv_idx;
+    size_t total = 0;
+    int n = 0;
+    while (limit > 0 && n < run && total + iv[n].iov_len <= limit)
+        total += iv[n++].iov_len;
+    if (0 == limit || n == run)
+        return writev(m_sockfd, iv, run);
+    //第n块只发送配额剩下的部分，发送后恢复长度，由advance按实际发送的字节数前移
+    size_t len = iv[n].iov_len;
+    iv[n].iov_len = limit - total;
+    ssize_t ret = writev(m_sockfd, iv, n + 1);
+    iv[n].iov_len = len;
+    return ret;
+}
+ssize_t http_conn::send_body(size_t limit)
+{
+    off_t offset = m_iv_off[m_iv_idx];
+    size_t len = m_iv[m_iv_idx].iov_len;
+    ssize_t ret = sendfile(m_sockfd, m_iv_fd[m_iv_idx], &offset, limit > 0 && limit < len ? limit : len);
+    if (0 == ret) //文件在发送过程中被截短，按发送失败处理，避免反复发送0字节
+    {
+        errno = EIO;
+        return -1;
+    }
+    return ret;
+}
+//所有排队的响应发送完毕，删除映射并清空队列，返回最后一个响应是否保持连接
+bool http_conn::finish_responses()
+{
+    //HTTP/2连接没有排队的响应，发送过GOAWAY或对方已GOAWAY且流都已结束时关闭
+    bool linger = m_resp_count > 0 ? m_resp[m_resp_count - 1].linger : !(m_h2 && m_h2->closing());
+    unmap();
+    m_resp_count = 0;
+    m_part_count = 0;
+    m_write_idx = 0;
+    m_iv_count = 0;
+    m_iv_idx = 0;
+    bytes_to_send = 0;
+    bytes_have_send = 0;
+    //保持连接时等待下一个请求，读缓冲区中已有下一个请求的一部分时请求头的期限从现在算起
+    set_phase(m_h2 || m_read_idx == m_start_line ? CONN_IDLE : CONN_HEADER);
+    return linger;
+}
+//记录io_uring完成的接收
+bool http_conn::read_complete(int bytes)
+{
+    if (bytes <= 0) //对方关闭连接或接收出错
+    {
+        return false;
+    }
+    if (CONN_IDLE == m_phase && !m_h2)
+        set_phase(CONN_HEADER);
+    if (CONN_HEADER == m_phase || CONN_BODY == m_phase)
+        m_recv_bytes.store(m_recv_bytes.load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+    m_read_idx += bytes;
+    return true;
+}
+//记录io_uring完成的发送
+int http_conn::write_complete(int bytes)
+{
+    if (bytes < 0) //发送出错
+    {
+        unmap();
+        return -1;
+    }
+    if (!advance(bytes))
+    {
+        return 0;
+    }
+    int more = m_h2 ? next_h2() : next_chunk(); //HTTP/2组织下一批帧，流式响应继续生成下一块
+    if (more > 0)
+        return 0;
+    if (more < 0)
+    {
+        unmap();
+        return -1;
+    }
+    //全部发送完成，删除映射
+    if (!finish_responses())
+    {
+        return -1;
+    }
+    return m_more ? 2 : 1;
+}
+//请求头和请求体的期限从进入该阶段时算起，期间收到数据不会延长，慢速发送的客户端无法长期占用连接
+//CONN_BUSY每次调用都顺延，只要响应还在发送就不会超时
+void http_conn::set_phase(CONN_PHASE phase)
+{
+    if (phase == m_phase && CONN_BUSY != phase)
+        return;
+    m_phase = phase;
+    long long now = timer_wheel::now_ms();
+    int timeout = CONN_HEADER == phase ? m_header_timeout : CONN_BODY == phase ? m_body_timeout : m_idle_timeout;
+    m_deadline.store(now + timeout, std::memory_order_relaxed);
+    //接收速率按整个请求计算，从请求头开始，读缓冲区中已有的部分(流水线中的下一个请求)一并计入
+    if (CONN_HEADER == phase)
+    {
+        m_recv_bytes.store(m_read_idx - m_start_line, std::memory_order_relaxed);
+        m_recv_since.store(now, std::memory_order_relaxed);
+    }
+    else if (CONN_BODY != phase)
+    {
+        m_recv_since.store(0, std::memory_order_relaxed);
+    }
+}
+bool http_conn::trickling(long long now) const
+{
+    long long since = m_recv_since.load(std::memory_order_relaxed);
+    if (0 == since)
+        return false;
+    if (now >= deadline())
+        return true;
+    long long elapsed = now - since;
+    return m_min_rate > 0 && elapsed >= RATE_GRACE &&
+           m_recv_bytes.load(std::memory_order_relaxed) * 1000LL < m_min_rate * elapsed;
+}
+//请求处理完后重新等待读或写事件
+void http_conn::rearm(int ev)
+{
+    if (m_epollfd >= 0)
+    {
+        modfd(m_epollfd, m_sockfd, ev, m_TRIGMode);
+        return;
     }
+    //io_uring后端：记录下一步是读还是写，工作线程处理完后放入所属循环的完成队列，由循环提交对应的请求
+    m_state = (ev == EPOLLOUT) ? 1 : 0;
 }
 bool http_conn::add_response(const char *format, ...)
 {
@@ -617,42 +1367,292 @@ bool http_conn::add_response(const char *format, ...)
     m_write_idx += len;
     va_end(arg_list);
 
-    LOG_INFO("request:%s", m_write_buf);
-
     return true;
 }
 bool http_conn::add_status_line(int status, const char *title)
 {
-    return add_response("%s %d %s\r\n", "HTTP/1.1", status, title); //添加状态行
+    const status_fragment *f = NULL;
+    for (size_t i = 0; i < sizeof(status_lines) / sizeof(status_lines[0]); ++i)
+    {
+        if (status_lines[i].status == status)
+        {
+            f = &status_lines[i];
+            break;
+        }
+    }
+    bool ok = f ? add_bytes(f->line, f->len) : add_response("%s %d %s\r\n", "HTTP/1.1", status, title); //添加状态行
+    //Date由0号循环每秒生成一次，这里只拷贝
+    return ok && add_bytes(m_date_header[m_date_idx.load(std::memory_order_acquire)], DATE_HEADER_LEN);
 }
-bool http_conn::add_headers(int content_len)  //添加响应头（包括响应体长度、连接状态、空行）
+bool http_conn::add_headers(size_t content_len)  //添加响应头（包括响应体长度、连接状态、空行）
 {
     return add_content_length(content_len) && add_linger() &&
            add_blank_line();
 }
-bool http_conn::add_content_length(int content_len) //添加响应体长度
+bool http_conn::add_content_length(size_t content_len) //添加响应体长度
 {
-    return add_response("Content-Length:%d\r\n", content_len);
+    char num[20];
+    return add_field("Content-Length:", 15, num, format_uint(num, content_len));
 }
 bool http_conn::add_content_type() //添加响应体类型
 {
-    return add_response("Content-Type:%s\r\n", "text/html");
+    return add_bytes("Content-Type:text/html\r\n", 24);
 }
 bool http_conn::add_linger() //添加连接状态
 {
-    return add_response("Connection:%s\r\n", (m_linger == true) ? "keep-alive" : "close");
+    return m_linger ? add_bytes("Connection:keep-alive\r\n", 23) : add_bytes("Connection:close\r\n", 18);
 }
 bool http_conn::add_blank_line() //添加空行
 {
-    return add_response("%s", "\r\n");
+    return add_bytes("\r\n", 2);
 }
 bool http_conn::add_content(const char *content) //添加响应体
 {
-    return add_response("%s", content);
+    if (HEAD == m_method) //HEAD的响应头与GET相同，但没有响应体
+        return true;
+    return add_bytes(content, strlen(content));
+}
+bool http_conn::add_field(const char *name, int name_len, const char *value, int value_len)
+{
+    if (name_len + value_len + 2 >= WRITE_BUFFER_SIZE - 1 - m_write_idx) //超出缓冲区剩余长度
+        return false;
+    char *p = m_write_buf + m_write_idx;
+    memcpy(p, name, name_len);
+    memcpy(p + name_len, value, value_len);
+    memcpy(p + name_len + value_len, "\r\n", 2);
+    m_write_idx += name_len + value_len + 2;
+    return true;
+}
+bool http_conn::wants_gzip()
+{
+    if (!file_cache::get_instance()->gzip_enabled() || !compressible(m_real_file))
+        return false;
+    m_vary = true; //不论这次是否压缩，缓存都需要按Accept-Encoding区分
+    //Range请求按原文件计算范围，不发送压缩版本
+    return m_headers.has(HDR_ACCEPT_ENCODING) && accepts_gzip(m_headers.get(HDR_ACCEPT_ENCODING).data()) &&
+           0 != m_file_stat.st_size && 0 == m_range_count;
+}
+bool http_conn::choose_gzip()
+{
+    if (!wants_gzip())
+        return false;
+    file_cache *cache = file_cache::get_instance();
+    file_cache::entry *gz = cache->acquire_gzip(m_real_file, m_file_stat);
+    if (!gz) //太大而不进入压缩缓存的，边读边压缩，以chunked编码发送；HTTP/2没有chunked编码，发送原文件
+        return !m_h2 && (size_t)m_file_stat.st_size > cache->gzip_max_file() && start_gzip_stream();
+    if (m_file_entry)
+        file_cache::release(m_file_entry);
+    m_file_entry = gz;
+    return true;
+}
+bool http_conn::start_gzip_stream()
+{
+    gzip_file_stream *s = new gzip_file_stream;
+    if (!s->open(m_real_file))
+    {
+        delete s;
+        return false;
+    }
+    if (m_file_entry) //不再需要原文件的缓存条目
+    {
+        file_cache::release(m_file_entry);
+        m_file_entry = 0;
+    }
+    m_encoder.start(s);
+    return true;
+}
+//Range: bytes=a-b,c-,-n，只支持bytes单位，格式错误或范围过多时按RFC 7233忽略整个请求头
+void http_conn::parse_range(const char *value)
+{
+    m_range_count = 0;
+    if (strncasecmp(value, "bytes=", 6) != 0)
+        return;
+    const char *p = value + 6;
+    while (true)
+    {
+        p += strspn(p, " \t");
+        if (m_range_count == MAX_RANGES)
+            break;
+        range &r = m_ranges[m_range_count];
+        char *end;
+        if ('-' == *p) //最后n个字节
+        {
+            r.first = -1;
+            r.last = strtoll(p + 1, &end, 10);
+            if (end == p + 1)
+                break;
+        }
+        else
+        {
+            r.first = strtoll(p, &end, 10);
+            if (end == p || '-' != *end || r.first < 0)
+                break;
+            p = end + 1;
+            r.last = strtoll(p, &end, 10);
+            if (end == p) //到文件结尾
+                r.last = -1;
+            else if (r.last < r.first)
+                break;
+        }
+        ++m_range_count;
+        p = end + strspn(end, " \t");
+        if ('\0' == *p) //全部解析成功
+            return;
+        if (',' != *p)
+            break;
+        ++p;
+    }
+    m_range_count = 0;
+}
+//按资源长度把Range范围换算为实际的起止位置，起点超出文件的范围无法满足
+//一个范围时发送206和Content-Range，多个范围时发送multipart/byteranges，全部无法满足时发送416
+bool http_conn::process_range(size_t size)
+{
+    size_t first[MAX_RANGES];
+    size_t last[MAX_RANGES];
+    int n = 0;
+    for (int i = 0; i < m_range_count; ++i)
+    {
+        range &r = m_ranges[i];
+        if (r.first < 0)
+        {
+            if (0 == r.last)
+                continue;
+            first[n] = (size_t)r.last >= size ? 0 : size - r.last;
+            last[n] = size - 1;
+        }
+        else
+        {
+            if ((size_t)r.first >= size)
+                continue;
+            first[n] = r.first;
+            last[n] = (r.last < 0 || (size_t)r.last >= size) ? size - 1 : r.last;
+        }
+        ++n;
+    }
+
+    m_send_off = 0;
+    m_send_len = 0;
+    if (0 == n)
+    {
+        char num[24] = "*/";
+        int len = 2 + format_uint(num + 2, size);
+        return add_status_line(416, error_416_title) && add_field("Content-Range:bytes ", 20, num, len) &&
+               add_content_length(0) && add_linger() && add_blank_line();
+    }
+    if (1 == n)
+    {
+        m_send_off = first[0];
+        m_send_len = last[0] - first[0] + 1;
+        char num[64];
+        int len = format_uint(num, first[0]);
+        num[len++] = '-';
+        len += format_uint(num + len, last[0]);
+        num[len++] = '/';
+        len += format_uint(num + len, size);
+        return add_status_line(206, ok_206_title) && add_field("Content-Range:bytes ", 20, num, len) &&
+               add_content_length(m_send_len) && add_validators() && add_encoding() && add_linger() && add_blank_line();
+    }
+
+    //分隔符由文件属性生成，同一文件的响应相同
+    char boundary[40];
+    snprintf(boundary, sizeof(boundary), "tws%llx%llx", (unsigned long long)m_file_stat.st_ino,
+             (unsigned long long)m_file_stat.st_mtime);
+    //先计算各部分分隔行的长度，得到响应体总长度
+    size_t total = snprintf(NULL, 0, "\r\n--%s--\r\n", boundary);
+    for (int i = 0; i < n; ++i)
+        total += snprintf(NULL, 0, "\r\n--%s\r\nContent-Range:bytes %zu-%zu/%zu\r\n\r\n", boundary, first[i], last[i], size) +
+                 last[i] - first[i] + 1;
+    if (!(add_status_line(206, ok_206_title) &&
+          add_response("Content-Type:multipart/byteranges; boundary=%s\r\n", boundary) &&
+          add_content_length(total) && add_validators() && add_encoding() && add_linger() && add_blank_line()))
+        return false;
+    for (int i = 0; i < n; ++i)
+    {
+        part &p = m_parts[i];
+        p.head_off = m_write_idx;
+        if (!add_response("\r\n--%s\r\nContent-Range:bytes %zu-%zu/%zu\r\n\r\n", boundary, first[i], last[i], size))
+            return false;
+        p.head_len = m_write_idx - p.head_off;
+        p.off = first[i];
+        p.len = last[i] - first[i] + 1;
+    }
+    m_tail_off = m_write_idx;
+    if (!add_response("\r\n--%s--\r\n", boundary))
+        return false;
+    m_tail_len = m_write_idx - m_tail_off;
+    m_part_count = n;
+    m_multipart = true;
+    return true;
+}
+bool http_conn::add_encoding()
+{
+    if ((m_encoder.active() || (m_file_entry && m_file_entry->gzip)) && !add_bytes("Content-Encoding:gzip\r\n", 23))
+        return false;
+    return !m_vary || add_bytes("Vary:Accept-Encoding\r\n", 22);
+}
+void http_conn::prepare_validators()
+{
+    if (m_file_entry) //命中缓存时使用预先生成的，压缩版本有自己的ETag
+    {
+        m_etag = m_file_entry->etag;
+        m_etag_len = m_file_entry->etag_len;
+        m_last_modified = m_file_entry->last_modified;
+        return;
+    }
+    //流式压缩与缓存的压缩版本内容相同，ETag也相同
+    m_etag_len = file_cache::format_etag(m_file_stat, m_encoder.active(), m_etag_buf, sizeof(m_etag_buf));
+    file_cache::format_http_date(m_file_stat.st_mtime, m_date_buf, sizeof(m_date_buf));
+    m_etag = m_etag_buf;
+    m_last_modified = m_date_buf;
+}
+//If-None-Match优先，存在时忽略If-Modified-Since
+bool http_conn::not_modified()
+{
+    if (GET != m_method && HEAD != m_method) //HEAD与GET的响应头相同，条件请求同样返回304
+        return false;
+    if (m_headers.has(HDR_IF_NONE_MATCH))
+        return etag_match(m_headers.get(HDR_IF_NONE_MATCH).data(), m_etag, m_etag_len);
+    if (!m_headers.has(HDR_IF_MODIFIED_SINCE))
+        return false;
+    time_t since = parse_http_date(m_headers.get(HDR_IF_MODIFIED_SINCE).data()); //格式错误时为-1
+    return since >= 0 && m_file_stat.st_mtime <= since;
+}
+//If-Range为ETag时按强比较，为日期时须与Last-Modified完全相同
+bool http_conn::if_range_match()
+{
+    if (!m_headers.has(HDR_IF_RANGE))
+        return true;
+    std::string_view value = m_headers.get(HDR_IF_RANGE);
+    if ('"' == value.data()[0]) //值后紧跟\0，空值时读到的是\0
+        return value.size() == (size_t)m_etag_len && memcmp(value.data(), m_etag, m_etag_len) == 0;
+    return parse_http_date(value.data()) == m_file_stat.st_mtime;
+}
+bool http_conn::add_validators()
+{
+    if (!(add_field("ETag:", 5, m_etag, m_etag_len) && add_field("Last-Modified:", 14, m_last_modified, strlen(m_last_modified))))
+        return false;
+    const char *path = m_real_file + strlen(doc_root);
+    for (size_t i = 0; i < m_cache_control.size(); ++i)
+    {
+        const string &prefix = m_cache_control[i].first;
+        if (strncmp(path, prefix.c_str(), prefix.size()) == 0)
+            return add_bytes(m_cache_control[i].second.c_str(), m_cache_control[i].second.size());
+    }
+    return true;
+}
+bool http_conn::add_bytes(const char *data, int len)
+{
+    if (len >= WRITE_BUFFER_SIZE - 1 - m_write_idx) //超出缓冲区剩余长度
+        return false;
+    memcpy(m_write_buf + m_write_idx, data, len);
+    m_write_idx += len;
+    return true;
 }
 
 bool http_conn::process_write(HTTP_CODE ret) //ret为do_request()返回值
 {
+    int head_off = m_write_idx; //本响应的响应头接在前面排队的响应之后
     switch (ret)
     {
     case INTERNAL_ERROR: //服务器错误
@@ -671,6 +1671,13 @@ bool http_conn::process_write(HTTP_CODE ret) //ret为do_request()返回值
             return false;
         break;
     }
+    case OPTIONS_REQUEST: //只回答允许的方法，没有响应体
+    {
+        if (!(add_status_line(204, ok_204_title) &&
+              add_bytes(allow_fields[m_allow].field, allow_fields[m_allow].len) && add_linger() && add_blank_line()))
+            return false;
+        break;
+    }
     case FORBIDDEN_REQUEST: //请求资源无权访问
     {
         add_status_line(403, error_403_title);
@@ -681,48 +1688,293 @@ bool http_conn::process_write(HTTP_CODE ret) //ret为do_request()返回值
     }
     case FILE_REQUEST: //请求资源可以正常访问
     {
+        prepare_validators();
+        if (not_modified()) //客户端缓存仍然有效，只发送304和验证信息，没有响应体
+        {
+            m_encoder.reset();
+            if (!(add_status_line(304, ok_304_title) && add_validators() &&
+                  (!m_vary || add_bytes("Vary:Accept-Encoding\r\n", 22)) && add_linger() && add_blank_line()))
+                return false;
+            break;
+        }
         add_status_line(200, ok_200_title); //把请求行写入缓冲区
-        if (m_file_stat.st_size != 0)  //m_file_stat.st_size为请求资源文件长度
-        {
-            add_headers(m_file_stat.st_size);  //把请求头写入缓冲区
-            m_iv[0].iov_base = m_write_buf;    //存储响应报文的写缓冲区
-            m_iv[0].iov_len = m_write_idx;
-            m_iv[1].iov_base = m_file_address; //请求资源文件映射到的内存地址
-            m_iv[1].iov_len = m_file_stat.st_size;
-            m_iv_count = 2;
-            //要发送的总字节数为写缓冲区内数据 + 请求资源文件长度
-            bytes_to_send = m_write_idx + m_file_stat.st_size; 
-            return true;
+        if (m_encoder.active()) //响应体长度未知，以chunked编码发送，响应头和第一块一起发出
+        {
+            if (!(add_bytes("Transfer-Encoding:chunked\r\n", 27) && add_validators() && add_encoding() &&
+                  add_linger() && add_blank_line()))
+                return false;
+            if (HEAD == m_method) //HEAD同样没有Content-Length，但不生成响应体
+                m_encoder.reset();
+            else if (!m_encoder.next(m_chunk_data, m_chunk_len))
+                return false;
+            break;
         }
-        else
+        //m_file_stat.st_size为请求资源文件长度，空文件同样按Content-Length:0发送，没有映射和响应体
+        size_t size = m_file_entry ? m_file_entry->length : m_file_stat.st_size;
+        //Range请求，状态行改为206或416；HTTP/2的响应体按帧发送，不生成multipart，多个范围时发送整个文件
+        if (size > 0 && m_range_count > 0 && GET == m_method && if_range_match() && !(m_h2 && m_range_count > 1))
         {
-            const char *ok_string = "<html><body></body></html>"; //请求体为空
-            add_headers(strlen(ok_string));
-            if (!add_content(ok_string))
+            m_write_idx = head_off;
+            if (!process_range(size))
                 return false;
+            break;
         }
+        m_send_off = 0;
+        m_send_len = size;
+        //命中缓存时直接拷贝预先生成的Content-Length，压缩版本的长度为压缩后的长度
+        bool ok = m_file_entry ? add_bytes(m_file_entry->length_header, m_file_entry->length_header_len)
+                               : add_content_length(m_file_stat.st_size);
+        if (!(ok && add_validators() && add_encoding() && add_linger() && add_blank_line()))  //把请求头写入缓冲区
+            return false;
+        break; //响应体为请求资源文件映射到的内存
     }
     default:
         return false;
     }
-    m_iv[0].iov_base = m_write_buf;  //请求资源无法正常访问，不再编写响应体
-    m_iv[0].iov_len = m_write_idx;
-    m_iv_count = 1;
-    bytes_to_send = m_write_idx;
+    if (HEAD == m_method) //响应头已由缓存条目或stat的结果生成，缓存引用随即归还
+        release_file();
+    //将响应放入发送队列，资源文件的映射交给队列管理，请求资源无法正常访问时没有响应体
+    response &r = m_resp[m_resp_count++];
+    r.head_off = head_off;
+    r.head_len = (m_multipart ? m_parts[0].head_off : m_write_idx) - head_off; //multipart各部分的分隔行另外记录
+    r.entry = m_file_entry;
+    if (m_file_entry)
+    {
+        r.body = m_file_entry->addr;
+        r.fd = m_file_entry->fd;
+        r.body_len = m_file_entry->length;
+    }
+    else
+    {
+        r.body = m_file_address;
+        r.fd = m_file_fd;
+        r.body_len = (m_file_address || m_file_fd >= 0) ? m_file_stat.st_size : 0;
+    }
+    r.send_off = m_send_off;
+    r.send_len = (r.body || r.fd >= 0) ? m_send_len : 0;
+    r.multipart = m_multipart;
+    r.stream = m_encoder.active();
+    r.linger = m_linger;
+    m_file_address = 0;
+    m_file_fd = -1;
+    m_file_entry = 0;
     return true;
 }
+//处理读缓冲区中所有完整的请求，支持HTTP/1.1流水线
+//每个请求的响应按顺序排入队列，之后一次writev批量发送，未处理完的数据保留到下一次
 void http_conn::process()
 {
-    HTTP_CODE read_ret = process_read();
-    if (read_ret == NO_REQUEST) //请求不完整，需要继续接收请求数据
+    //客户端以连接前言开始时直接按HTTP/2处理，正常的HTTP/1.1请求不会以PRI开头
+    if (!m_h2 && m_h2c && CHECK_STATE_REQUESTLINE == m_check_state)
     {
-        modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode); //修改文件描述符上的监听事件为读事件
+        int ret = h2_session::match_preface(m_read_buf + m_start_line, m_read_idx - m_start_line);
+        if (0 == ret) //还不能判断，继续接收
+        {
+            rearm(EPOLLIN);
+            return;
+        }
+        if (ret > 0)
+            m_h2 = new h2_session(m_read_max, false);
+    }
+    if (m_h2)
+    {
+        process_h2();
+        return;
+    }
+    m_more = false;
+    while (true)
+    {
+        unsigned long long allocs = heap_alloc_count;
+        HTTP_CODE read_ret = process_read();
+        if (read_ret == NO_REQUEST) //请求不完整，需要继续接收请求数据
+        {
+            break;
+        }
+        if (m_h2) //请求带有Upgrade: h2c，已切换为HTTP/2，在流1上响应，之后的数据按帧解析
+        {
+            respond_h2(m_h2->find(1), read_ret);
+            init_request();
+            process_h2();
+            return;
+        }
+        set_phase(CONN_BUSY);
+        if (m_max_keepalive > 0 && ++m_served >= m_max_keepalive) //达到单连接请求数上限，响应后关闭连接
+            m_linger = false;
+        int head_off = m_write_idx;
+        bool write_ret = process_write(read_ret); //完成响应报文并存入内存
+        count_allocs(allocs);
+        if (!write_ret)
+        {
+            release_file(); //删除本请求的资源文件映射
+            m_encoder.reset(); //流式响应同样排在一批的最后，失败的只能是它
+            m_part_count = 0; //一批中只有一个multipart响应，失败的只能是它
+            m_write_idx = head_off; //丢弃写了一半的响应头
+            if (0 == m_resp_count)
+            {
+                //响应报文失败，连接由所属循环关闭，工作线程不直接关闭文件描述符，避免与定时器重复关闭
+                timer_flag = 1;
+                return;
+            }
+            //已排队的响应照常发送，之后关闭连接
+            m_resp[m_resp_count - 1].linger = false;
+            break;
+        }
+        bool linger = m_linger;
+        init_request(); //保留读缓冲区中的后续请求
+        if (!linger) //该请求要求关闭连接，之后的数据不再处理
+        {
+            break;
+        }
+        //队列已满或写缓冲区空间不足，先发送已排队的响应，剩余请求在发送完成后处理
+        //multipart响应占用了m_parts，流式响应需要发送完最后一块才能接着发送后面的响应，也先发送
+        if (m_resp_count == MAX_PIPELINE || WRITE_BUFFER_SIZE - m_write_idx < RESPONSE_RESERVE || m_part_count > 0 ||
+            m_encoder.active())
+        {
+            m_more = m_checked_idx < m_read_idx;
+            break;
+        }
+    }
+    compact();
+    if (0 == m_resp_count)
+    {
+        rearm(EPOLLIN); //修改文件描述符上的监听事件为读事件
         return;
     }
-    bool write_ret = process_write(read_ret); //完成响应报文并存入内存
-    if (!write_ret)
+    build_iovec();
+    rearm(EPOLLOUT); //修改文件描述符上的监听事件为写事件
+}
+void http_conn::count_allocs(unsigned long long before)
+{
+    unsigned long long n = heap_alloc_count - before;
+    m_requests.fetch_add(1, std::memory_order_relaxed);
+    if (n)
     {
-        close_conn(); //响应报文失败，则关闭连接
+        m_alloc_requests.fetch_add(1, std::memory_order_relaxed);
+        m_heap_allocs.fetch_add(n, std::memory_order_relaxed);
     }
-    modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode); //修改文件描述符上的监听事件为写事件
+}
+void http_conn::get_alloc_stats(alloc_stats &s)
+{
+    s.requests = m_requests.load(std::memory_order_relaxed);
+    s.alloc_requests = m_alloc_requests.load(std::memory_order_relaxed);
+    s.heap_allocs = m_heap_allocs.load(std::memory_order_relaxed);
+    s.arena_blocks = arena::overflow_blocks();
+}
+//请求带有Upgrade: h2c且HTTP2-Settings格式正确时切换，先发送101响应和服务器的SETTINGS
+bool http_conn::h2_upgrade()
+{
+    m_h2 = new h2_session(m_read_max, true);
+    if (!m_h2->upgrade(m_headers.get(HDR_HTTP2_SETTINGS).data()))
+    {
+        delete m_h2;
+        m_h2 = 0;
+        return false;
+    }
+    LOG_INFO("upgrade to h2c");
+    return true;
+}
+//解析读缓冲区中所有完整的帧，请求完整的流依次生成响应，之后组织第一批待发送的帧
+void http_conn::process_h2()
+{
+    set_phase(CONN_BUSY); //HTTP/2连接有数据往来即顺延，请求头和请求体的期限不按流计算
+    h2_stream *s = 0;
+    while (m_h2->consume(m_read_buf, m_checked_idx, m_read_idx, s) == h2_session::H2_REQUEST)
+        serve_h2(s);
+    m_start_line = m_checked_idx;
+    compact();
+    build_h2_iovec();
+    if (bytes_to_send > 0)
+    {
+        rearm(EPOLLOUT);
+        return;
+    }
+    if (m_h2->closing()) //没有要发送的数据且连接需要关闭，由所属循环关闭
+    {
+        timer_flag = 1;
+        return;
+    }
+    rearm(EPOLLIN);
+}
+//伪首部换成HTTP/1.1的请求行字段，普通请求头与HTTP/1.1一样经过parse_field，之后的处理完全相同
+void http_conn::serve_h2(h2_stream *s)
+{
+    unsigned long long allocs = heap_alloc_count;
+    HTTP_CODE ret = NO_REQUEST;
+    if (s->method == "GET")
+        m_method = GET;
+    else if (s->method == "POST")
+    {
+        m_method = POST;
+        cgi = 1;
+    }
+    else if (s->method == "HEAD")
+        m_method = HEAD;
+    else if (s->method == "OPTIONS")
+        m_method = OPTIONS;
+    else
+        ret = BAD_REQUEST;
+    if (s->path.empty() || (s->path[0] != '/' && !(OPTIONS == m_method && s->path == "*")))
+        ret = BAD_REQUEST;
+    m_url = s->path == "/" ? "/judge.html" : s->path.c_str();
+    for (size_t i = 0; i < s->headers.size() && NO_REQUEST == ret; ++i)
+    {
+        hpack_header &h = s->headers[i];
+        if (parse_field(h.first.c_str(), h.first.size(), h.second.c_str(), h.second.size()) == BAD_REQUEST)
+            ret = BAD_REQUEST;
+    }
+    if (NO_REQUEST == ret)
+    {
+        //请求体已由DATA帧拼接完整，结尾有std::string保证的\0
+        if (POST == m_method)
+        {
+            m_content_length = s->content.size();
+            m_string = &s->content[0];
+        }
+        ret = do_request();
+        m_string = 0; //请求体属于流，不需要init_request恢复结尾的字节
+    }
+    LOG_INFO("h2 stream %u: %s %s", s->id, s->method.c_str(), s->path.c_str());
+    respond_h2(s, ret);
+    count_allocs(allocs);
+    init_request();
+}
+//响应头按HTTP/1.1格式生成后由会话转换为HEADERS帧，写缓冲区随即归还，响应体的文件交给流
+void http_conn::respond_h2(h2_stream *s, HTTP_CODE ret)
+{
+    int head_off = m_write_idx;
+    if (!process_write(ret))
+    {
+        release_file();
+        m_encoder.reset();
+        m_part_count = 0;
+        m_write_idx = head_off;
+        m_h2->reset(s, h2_session::H2_INTERNAL_ERROR);
+        return;
+    }
+    response &r = m_resp[--m_resp_count];
+    s->body = r.body;
+    s->fd = r.fd;
+    s->entry = r.entry;
+    s->body_len = r.body_len;
+    s->send_off = r.send_off;
+    s->send_left = r.send_len;
+    m_h2->respond(s, m_write_buf + r.head_off, m_write_idx - r.head_off);
+    m_write_idx = head_off;
+}
+void http_conn::build_h2_iovec()
+{
+    m_iv_count = 0;
+    m_iv_idx = 0;
+    bytes_to_send = 0;
+    bytes_have_send = 0;
+    h2_segment segs[MAX_IOV];
+    int n = m_h2->schedule(segs, MAX_IOV);
+    for (int i = 0; i < n; ++i)
+        push_iov(segs[i].base, segs[i].len, segs[i].fd, segs[i].off);
+}
+int http_conn::next_h2()
+{
+    m_h2->sent();
+    build_h2_iovec();
+    return bytes_to_send > 0 ? 1 : 0;
 }
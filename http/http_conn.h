@@ -19,19 +19,38 @@
 #include <errno.h>
 #include <sys/wait.h>
 #include <sys/uio.h>
+#include <sys/sendfile.h>
 #include <map>
+#include <vector>
+#include <atomic>
 
 #include "../lock/locker.h"
+#include "../threadpool/completion_queue.h"
 #include "../CGImysql/sql_connection_pool.h"
+#include "../CGImysql/user_table.h"
 #include "../timer/lst_timer.h"
 #include "../log/log.h"
+#include "../cache/file_cache.h"
+#include "../bundle/asset_bundle.h"
+#include "http_scan.h"
+#include "chunked.h"
+#include "http2.h"
+#include "router.h"
+#include "header_table.h"
 
 class http_conn
 {
 public:
     static const int FILENAME_LEN = 200; //请求资源名(去掉了开头的/) + 网站根目录长度
-    static const int READ_BUFFER_SIZE = 2048; //读缓冲区大小
-    static const int WRITE_BUFFER_SIZE = 1024; //写缓冲区大小
+    static const int READ_BUFFER_SIZE = 2048; //连接自带的读缓冲区大小，请求超过该长度时换用堆上更大的缓冲区
+    static const int READ_EXTRA_SIZE = 65536; //每次读取时附带的栈上溢出区大小，一次系统调用即可读入超出读缓冲区的数据
+    static const int WRITE_BUFFER_SIZE = 4096; //写缓冲区大小，流水线请求的响应头依次存放
+    static const int MAX_PIPELINE = 16; //一批最多排队发送的响应数
+    static const int RESPONSE_RESERVE = 512; //写缓冲区剩余空间少于该值时不再解析下一个流水线请求
+    static const int MAX_RANGES = 8; //一个请求最多支持的Range范围数，超过时忽略Range发送整个文件
+    static const int DATE_HEADER_LEN = 36; //"Date:" + IMF-fixdate(29字节) + "\r\n"
+    static const int MAX_IOV = 2 * MAX_PIPELINE + 2 * MAX_RANGES + 1; //iovec数组的长度
+    static const int RATE_GRACE = 2000; //开始接收请求后经过该时间(毫秒)才检查接收速率
     enum METHOD          //http请求方法
     {
         GET = 0,
@@ -58,6 +77,7 @@ public:
         NO_RESOURCE,
         FORBIDDEN_REQUEST,
         FILE_REQUEST,
+        OPTIONS_REQUEST, //OPTIONS请求，只返回Allow
         INTERNAL_ERROR,
         CLOSED_CONNECTION
     };
@@ -67,35 +87,152 @@ public:
         LINE_BAD,
         LINE_OPEN
     };
+    enum CONN_PHASE       //连接所处的阶段，决定定时器的超时时间
+    {
+        CONN_IDLE = 0, //等待下一个请求，m_idle_timeout后关闭
+        CONN_HEADER, //已收到请求的第一个字节，须在m_header_timeout内读完请求头
+        CONN_BODY, //请求头已读完，须在m_body_timeout内读完请求体
+        CONN_BUSY //正在处理或发送响应(HTTP/2连接有数据往来时同样)，每次有进展都顺延m_idle_timeout
+    };
 
 public:
-    http_conn() {}
-    ~http_conn() {}
+    http_conn() : m_read_buf(m_inline_buf), m_read_cap(READ_BUFFER_SIZE), m_file_address(0), m_file_fd(-1),
+                  m_file_entry(0), m_resp_count(0), m_h2(0) {}
+    ~http_conn()
+    {
+        unmap(); //连接在发送途中被关闭时，释放仍在排队的响应持有的映射、缓存引用和流式响应
+        delete m_h2; //HTTP/2各流的响应体由会话释放
+        if (m_read_buf != m_inline_buf)
+            free(m_read_buf);
+    }
 
 public:
     //初始化连接，即往内核事件表中注册socket的fd，并初始化接受新连接
-    void init(int sockfd, const sockaddr_in &addr, char *, int, int, string user, string passwd, string sqlname);
+    //epollfd为接受该连接的事件循环的内核事件表，cq为该循环的完成队列
+    //epollfd为-1表示连接由io_uring后端驱动，读写由所属循环提交给内核，不再注册epoll事件
+    void init(int sockfd, const sockaddr_in &addr, int epollfd, completion_queue<http_conn> *cq,
+              char *, int, int, string user, string passwd, string sqlname);
     void close_conn(bool real_close = true); //关闭连接，即从内核事件表中删除socket的fd
     void process(); //处理请求报文，并完成响应报文，存入内存
     bool read_once(); //循环从监听的socket上读取客户数据进入读缓冲区，直到无数据可读或对方关闭连接，区分LT和ET模式
     bool write(); //将内存中的请求报文发送到socket缓冲区
+    //响应全部发送完毕后，读缓冲区中是否还有已完整读入但尚未处理的流水线请求
+    //为true时write不会重新监听读事件，调用者需要再次调用process处理剩余请求
+    //响应只发送了一部分(等待写事件)时返回false
+    bool has_pending()
+    {
+        return m_more && 0 == m_resp_count;
+    }
+    //剩余待发送的数据超过一个写配额，属于大块传输，所属循环把它的写事件排在同一批其他事件之后
+    bool bulk() const
+    {
+        return m_write_quantum > 0 && bytes_to_send > (size_t)m_write_quantum;
+    }
     sockaddr_in *get_address()
     {
         return &m_address;
     }
-    void initmysql_result(connection_pool *connPool); //将数据库中所有的用户名和密码存入map
-    //记录Reactor模式下读写任务的处理情况
+    int get_sockfd()
+    {
+        return m_sockfd;
+    }
+    static void initmysql_result(connection_pool *connPool); //将数据库中所有的用户名和密码存入map
+    static void init_routes(); //注册内置路由(注册、登录等页面)，其他模块可在启动时另外向router注册
+    static int m_read_max; //每个连接读缓冲区的上限(字节)，单个请求超过该长度时关闭连接
+    static bool m_sendfile; //资源文件以sendfile发送，否则映射到内存后与响应头一起writev
+    static bool m_h2c; //接受HTTP/2明文连接，包括连接前言直接开始和Upgrade: h2c
+    static int m_idle_timeout; //keep-alive连接等待下一个请求的超时(毫秒)
+    static int m_header_timeout; //从收到请求的第一个字节起读完请求头的期限(毫秒)，陆续收到数据也不会延长
+    static int m_body_timeout; //读完请求头后读完请求体的期限(毫秒)
+    static int m_max_keepalive; //每个连接最多处理的请求数，达到后响应带Connection:close，0表示不限
+    static int m_min_rate; //接收请求(请求头和请求体)的最低速率(字节/秒)，0表示不限
+    static int m_write_quantum; //每次写事件最多发送的字节数，用完后重新等待写事件，0表示不限
+    static int min_timeout() //三种超时中最短的，连接阶段切换后的新期限不会早于切换时刻加上该值
+    {
+        int t = m_idle_timeout < m_header_timeout ? m_idle_timeout : m_header_timeout;
+        return t < m_body_timeout ? t : m_body_timeout;
+    }
+    //连接当前阶段的期限(单调时钟的绝对毫秒数)，由处理该连接的线程切换阶段时写入，所属循环的定时器到期时读取
+    long long deadline() const
+    {
+        return m_deadline.load(std::memory_order_relaxed);
+    }
+    //正在接收请求且已过期限，或者接收了RATE_GRACE之后平均速率仍低于m_min_rate
+    //由所属循环在把读事件交给工作线程之前调用，为true时直接关闭连接
+    bool trickling(long long now) const;
+    //解析Cache-Control配置，格式为"前缀=取值;前缀=取值"，如"/static/=max-age=86400;/=no-cache"
+    //资源路径(相对网站根目录)按最长前缀匹配，没有匹配的不发送Cache-Control，格式错误的项忽略
+    static void set_cache_control(const string &spec);
+    //由0号循环的定时器每次滴答时调用，秒数变化时重新生成共享的Date响应头
+    static void update_date();
+    //请求处理期间(解析、do_request、生成响应)的堆分配计数，只用于观察
+    //命中文件缓存的静态文件请求不应有任何堆分配
+    struct alloc_stats
+    {
+        unsigned long long requests; //处理的请求数
+        unsigned long long alloc_requests; //有堆分配的请求数
+        unsigned long long heap_allocs; //这些请求的堆分配总次数
+        unsigned long long arena_blocks; //arena申请的溢出块数
+    };
+    static void get_alloc_stats(alloc_stats &s);
+
+    //io_uring后端使用，读写由循环线程以提交队列项的方式完成，这里只负责缓冲区和发送进度
+    char *read_space(int &len) //读缓冲区中可写入的位置及剩余长度，已满时先扩大缓冲区
+    {
+        if (m_read_idx >= m_read_cap)
+            grow_read_buf(READ_BUFFER_SIZE);
+        len = m_read_cap - m_read_idx;
+        return m_read_buf + m_read_idx;
+    }
+    bool read_complete(int bytes); //记录内核完成的接收，对方关闭或出错返回false
+    struct iovec *write_iovec(int &count) //待发送的iovec数组
+    {
+        count = iov_run();
+        return m_iv + m_iv_idx;
+    }
+    //记录内核完成的发送，返回1表示响应发送完毕可以继续接收，2表示发送完毕且还有待处理的流水线请求，0表示还需发送，-1表示需要关闭连接
+    int write_complete(int bytes);
+    //读写任务或生成响应失败，需要由所属循环删除定时器并关闭连接
     int timer_flag; 
-    int improv;
+    //所属连接的代次，完成事件回到循环时与文件描述符表中的连接比较
+    unsigned m_gen;
+    //所属事件循环的完成队列，Reactor模式下工作线程处理完任务后将连接放入其中
+    completion_queue<http_conn> *m_cq;
 
 
 private:
+    //排队等待发送的一个响应，响应头位于写缓冲区中，响应体为资源文件的映射内存
+    struct response
+    {
+        int head_off; //响应头在写缓冲区中的起始位置
+        int head_len; //响应头长度
+        char *body; //资源文件映射到的内存地址，没有则为NULL
+        int fd; //以sendfile发送时资源文件的描述符，否则为-1
+        file_cache::entry *entry; //响应体来自文件缓存时为对应的条目，body和fd属于条目，发送完后只释放引用
+        size_t body_len; //资源文件长度
+        size_t send_off; //实际发送的部分在响应体中的起始位置，Range请求只发送其中一段
+        size_t send_len; //实际发送的长度
+        bool multipart; //多个Range范围，按m_parts以multipart/byteranges格式发送
+        bool stream; //响应体由m_encoder分块生成，一批响应中最多只有一个，且排在最后
+        bool linger; //该响应发送后是否保持连接
+    };
+
     void init(); //初始化接受新连接
+    void init_request(); //一个请求处理完后重置请求相关状态，保留读缓冲区中后续请求的数据
+    void compact(); //将未处理的数据移到读缓冲区开头
+    bool grow_read_buf(int need); //扩大读缓冲区使其至少有need字节空闲，受m_read_max限制，无法再扩大时返回false
+    void shrink_read_buf(); //剩余数据放得下时换回连接自带的读缓冲区
+    void rebase(const char *old_buf, char *new_buf); //读缓冲区搬移后，修正指向其中的请求字段
+    int readv_once(char *extra); //读缓冲区空闲部分加栈上溢出区一起读取一次，返回值同readv
+    void build_iovec(); //按排队顺序把各响应的响应头和响应体组织成iovec数组
+    bool finish_responses(); //所有响应发送完毕后释放映射并清空队列，返回是否保持连接
     LINE_STATUS parse_line(); //从状态机以行为单位解析请求报文
     HTTP_CODE process_read(); //主状态机解析http请求，若获得完整请求，调用do_request
     bool process_write(HTTP_CODE ret); //将请求报文写入写缓冲区，并利用iovec数组管理写缓冲区和资源文件的映射内存区域
     HTTP_CODE parse_request_line(char *text); //解析请求行
     HTTP_CODE parse_headers(char *text); //解析请求头
+    //记录一个请求头，决定请求体长度和连接状态的字段立即处理，HTTP/2的请求头也经过这里
+    HTTP_CODE parse_field(const char *name, int name_len, const char *value, int value_len);
     HTTP_CODE parse_content(char *text); //判断请求是否被完整读入，并用m_string取出请求体结尾的用户名密码字符串
 
     //解析完请求后，通过m_url判断请求类型，再通过修改m_url并组合网站根目录成为资源文件的完整地址
@@ -103,51 +240,154 @@ private:
     //最后利用stat获取文件属性，open文件，并利用mmap将文件内容映射进内存
     HTTP_CODE do_request();
 
+    bool advance(size_t bytes); //已发送bytes字节后更新iovec数组，全部发送完毕返回true
+    int iov_run(); //从m_iv_idx开始连续的内存块数量，遇到以sendfile发送的响应体为止
+    ssize_t send_iov(int run, size_t limit); //以writev发送m_iv_idx开始的run块，limit不为0时最多发送limit字节
+    ssize_t send_body(size_t limit); //以sendfile发送m_iv_idx处的响应体，limit不为0时最多发送limit字节，返回值同sendfile
+    void rearm(int ev); //请求处理完后重新等待读或写事件，epoll后端修改监听事件，io_uring后端通知所属循环
+    void set_phase(CONN_PHASE phase); //切换连接阶段并重新计算期限
     char *get_line() { return m_read_buf + m_start_line; }; //获取当前读入数据位置
-    void unmap(); //删除资源文件与内存的映射
+    void unmap(); //删除所有排队响应及当前请求的资源文件映射
+    void release_file(); //删除当前请求的资源文件映射，关闭文件，释放缓存引用
     bool add_response(const char *format, ...); //利用可变参数，为后续将响应报文各部分写入写缓冲区提供通用函数
     bool add_content(const char *content); //将响应体写入写缓冲区
+    bool add_bytes(const char *data, int len); //将预先生成的内容直接拷贝到写缓冲区
+    bool add_field(const char *name, int name_len, const char *value, int value_len); //写入一个响应头，name含冒号，结尾补\r\n
+    bool add_encoding(); //响应体为gzip压缩版本时写入Content-Encoding，可压缩的资源写入Vary
+    bool add_validators(); //写入ETag、Last-Modified，路径配置了缓存策略时写入Cache-Control
+    void prepare_validators(); //取出或生成当前资源的ETag和Last-Modified
+    bool not_modified(); //按If-None-Match、If-Modified-Since判断客户端缓存的版本是否仍然有效
+    bool if_range_match(); //If-Range与当前资源一致时Range才有效
+    bool wants_gzip(); //客户端接受gzip且资源可压缩时返回true，可压缩的资源同时标记Vary
+    bool choose_gzip(); //客户端接受gzip且资源可压缩时，把m_file_entry换成压缩版本，太大不缓存的改为边压缩边发送
+    bool start_gzip_stream(); //以chunked编码发送边读边压缩的文件
+    int next_chunk(); //流式响应的一块发送完后生成下一块，返回1表示有新数据待发送，0表示响应已结束，-1表示出错
+    HTTP_CODE parse_chunked(); //解码chunked请求体，完整后与Content-Length请求体一样交给do_request
+    void parse_range(const char *value); //解析Range请求头，格式不支持或范围过多时忽略
+    bool process_range(size_t size); //按资源长度换算Range范围，写入206或416的响应头
+    void push_iov(char *base, size_t len, int fd, off_t off); //向iovec数组追加一块，fd不为-1时表示以sendfile发送文件的一段
     bool add_status_line(int status, const char *title); //将状态行写入写缓冲区
-    bool add_headers(int content_length); //将响应头写入写缓冲区（包括响应体长度、连接状态、空行）
+    bool add_headers(size_t content_length); //将响应头写入写缓冲区（包括响应体长度、连接状态、空行）
     bool add_content_type(); //将响应体类型写入写缓冲区
-    bool add_content_length(int content_length); //将响应体长度写入写缓冲区
+    bool add_content_length(size_t content_length); //将响应体长度写入写缓冲区
     bool add_linger(); //将连接状态写入写缓冲区
     bool add_blank_line(); //将空行写入写缓冲区
+    int read_limit() const //读缓冲区上限，HTTP/2连接至少要放得下一个完整的帧
+    {
+        return m_h2 && m_read_max < h2_session::READ_MIN ? h2_session::READ_MIN : m_read_max;
+    }
+    bool h2_upgrade(); //请求带有Upgrade: h2c时切换为HTTP/2，该请求作为流1，HTTP2-Settings格式错误时不切换
+    void process_h2(); //HTTP/2连接的process，按帧解析读缓冲区，各流的请求依次生成响应
+    void serve_h2(h2_stream *s); //由流的请求头设置请求字段，按原有流程处理请求
+    void respond_h2(h2_stream *s, HTTP_CODE ret); //以process_write生成响应，转交给流发送
+    void build_h2_iovec(); //由会话组织下一批帧的iovec数组
+    int next_h2(); //一批帧发送完后组织下一批，返回值同next_chunk
+    static void count_allocs(unsigned long long before); //记录一个请求处理期间的堆分配，before为开始时heap_alloc_count的读数
 
 public:
-    static int m_epollfd; //epoll标识
-    static int m_user_count; //用户连接数
+    int m_epollfd; //所属事件循环的epoll标识
+    static std::atomic<int> m_user_count; //用户连接数，多个事件循环和工作线程共同增减
+    static std::atomic<unsigned long long> m_requests;
+    static std::atomic<unsigned long long> m_alloc_requests;
+    static std::atomic<unsigned long long> m_heap_allocs;
+    static std::atomic<unsigned long long> m_shed; //因接收请求过慢而关闭的连接数
     MYSQL *mysql;
     int m_state;  //读为0, 写为1
 
 private:
     int m_sockfd; //当前的连接socket
     sockaddr_in m_address; //当前的连接socket地址
-    char m_read_buf[READ_BUFFER_SIZE];
+    CONN_PHASE m_phase; //连接所处的阶段
+    std::atomic<long long> m_deadline; //当前阶段的期限，到期时由定时器关闭连接
+    //开始接收当前请求的时间及此后收到的字节数，不在接收请求(CONN_HEADER或CONN_BODY)时为0
+    //由读取数据的线程写入，Reactor模式下所属循环在下一次读事件时读取
+    std::atomic<long long> m_recv_since;
+    std::atomic<int> m_recv_bytes;
+    int m_served; //该连接已处理的请求数
+    char *m_read_buf; //读缓冲区，平时指向m_inline_buf，请求较大时指向堆上分配的缓冲区
+    int m_read_cap; //读缓冲区容量，实际分配时多留一位
+    char m_inline_buf[READ_BUFFER_SIZE + 1]; //多留一位，请求体恰好读满缓冲区时仍可在结尾写入\0
     int m_read_idx;  //已读的内容最后一位
     int m_checked_idx; //已解析的内容最后一位
     int m_start_line; //已读字节数
+    int m_line_end; //parse_line解析出的当前行结尾(\0)的位置
     char m_write_buf[WRITE_BUFFER_SIZE]; //写缓冲区
     int m_write_idx; //写入的内容最后一位
     CHECK_STATE m_check_state; //主状态机状态
     METHOD m_method; //HTTP请求方法 
     char m_real_file[FILENAME_LEN]; //读缓冲区
-    char *m_url; //统一资源标识，通常以/开头
+    const char *m_url; //统一资源标识，通常以/开头，指向读缓冲区或常量字符串，不会写入读缓冲区
     char *m_version; //HTTP版本
-    char *m_host;  //host
-    int m_content_length; //请求体长度
+    size_t m_content_length; //请求体长度，不超过m_read_max
     bool m_linger; //连接状态
     char *m_file_address; //资源文件地址
+    int m_file_fd; //以sendfile发送时打开的资源文件，否则为-1
+    file_cache::entry *m_file_entry; //命中文件缓存时的条目，此时不使用m_file_address和m_file_fd
     struct stat m_file_stat; //stat用于存储文件属性
-    struct iovec m_iv[2]; //管理两块内存，存储响应报文的写缓冲区和请求资源文件的映射内存区域
+    response m_resp[MAX_PIPELINE]; //按请求顺序排队的响应
+    int m_resp_count; //排队的响应数
+    bool m_more; //是否因队列已满而停止解析，读缓冲区中还有完整的请求
+    //每个响应一般占用两块：写缓冲区中的响应头和资源文件的映射内存区域(或以sendfile发送的文件)
+    //multipart响应每个范围再占用两块，另加结尾的分隔行
+    struct iovec m_iv[MAX_IOV];
     int m_iv_count; 
+    int m_iv_idx; //第一个尚未发送完的iovec
+    //每个iovec以sendfile发送时的文件描述符和当前文件偏移，内存块的描述符为-1
+    //这样的iovec只记录剩余长度，iov_base为NULL，不交给writev
+    int m_iv_fd[MAX_IOV];
+    off_t m_iv_off[MAX_IOV];
+    //请求头中的Range范围，first为-1表示最后last个字节，last为-1表示到文件结尾
+    struct range
+    {
+        long long first;
+        long long last;
+    };
+    range m_ranges[MAX_RANGES];
+    int m_range_count;
+    //multipart/byteranges响应的各部分，每部分的分隔行和Content-Range位于写缓冲区中
+    //一批响应中最多只有一个这样的响应
+    struct part
+    {
+        int head_off;
+        int head_len;
+        size_t off; //该部分在响应体中的起始位置
+        size_t len;
+    };
+    part m_parts[MAX_RANGES];
+    int m_part_count;
+    int m_tail_off; //结尾分隔行在写缓冲区中的位置
+    int m_tail_len;
+    size_t m_send_off; //当前请求实际发送的响应体范围
+    size_t m_send_len;
+    bool m_multipart; //当前请求的响应是否为multipart/byteranges
     int cgi;        //是否启用的POST
+    bool m_vary; //响应是否随Accept-Encoding变化，需要写入Vary
+    int m_allow; //OPTIONS请求路径接受的方法，ROUTE_METHOD的组合
+    bool m_chunked; //请求体使用chunked传输编码
+    chunked_decoder m_chunk_decoder;
+    int m_body_start; //chunked请求体在读缓冲区中的起始位置
+    int m_body_out; //已解码的请求体结尾
+    chunked_encoder m_encoder; //当前流式响应的编码器
+    char *m_chunk_data; //编码器生成的当前一块
+    int m_chunk_len;
+    header_table m_headers; //当前请求的请求头，指向读缓冲区
+    h2_session *m_h2; //切换为HTTP/2后的会话，HTTP/1.1连接为NULL
+    const char *m_etag; //当前资源的ETag，指向缓存条目或m_etag_buf
+    int m_etag_len;
+    const char *m_last_modified; //当前资源的Last-Modified，指向缓存条目或m_date_buf
+    char m_etag_buf[64]; //未命中缓存时生成的ETag
+    char m_date_buf[32]; //未命中缓存时生成的Last-Modified
+    static std::vector<std::pair<string, string> > m_cache_control; //前缀和对应的Cache-Control响应头，按前缀长度从长到短排列
+    static char m_date_header[2][DATE_HEADER_LEN + 1]; //两份Date响应头轮流更新
+    static std::atomic<int> m_date_idx; //当前可读的一份
+    static time_t m_date_sec; //Date对应的秒数，只由更新者访问
     char *m_string; //存储请求体最后一行的用户名和密码字符串：user=123&passwd=123
-    int bytes_to_send; //要发送的字节数
-    int bytes_have_send; //已发送的字节数
+    char m_content_saved; //请求体结尾被\0覆盖的字节，可能是下一个流水线请求的开头，请求处理完后恢复
+    arena m_arena; //请求期间的临时内存，init_request时整体归还
+    size_t bytes_to_send; //要发送的字节数，大文件的响应体可以超过4GB
+    size_t bytes_have_send; //已发送的字节数
     char *doc_root; //网站根目录，文件夹内存放请求的资源和跳转的html文件
 
-    map<string, string> m_users;
     int m_TRIGMode; //ET模式标志
     int m_close_log; //日志关闭标志
 
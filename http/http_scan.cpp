@@ -0,0 +1,83 @@
+#include "http_scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+//逐字节查找，也用于处理向量实现剩下的不足一个向量的尾部
+static const char *scan_scalar(const char *p, const char *end, char a, char b)
+{
+    for (; p < end; ++p)
+    {
+        if (*p == a || *p == b)
+            return p;
+    }
+    return end;
+}
+
+#ifdef SCAN_X86
+//每次比较16字节，两次比较结果相或后取掩码，最低的置位即第一个匹配的位置
+//只读取[begin, end)内的数据，不会越过缓冲区中已读入的部分
+__attribute__((target("sse2")))
+static const char *scan_sse2(const char *p, const char *end, char a, char b)
+{
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    for (; end - p >= 16; p += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+    return scan_scalar(p, end, a, b);
+}
+
+//同上，每次比较32字节
+__attribute__((target("avx2")))
+static const char *scan_avx2(const char *p, const char *end, char a, char b)
+{
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+    for (; end - p >= 32; p += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)));
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+    //尾部交给SSE2实现，编译器对尾调用不会自动插入vzeroupper
+    //不清空ymm高位时，之后的SSE指令(包括libc中的字符串函数)都要承受状态切换的惩罚
+    _mm256_zeroupper();
+    return scan_sse2(p, end, a, b);
+}
+#endif
+
+static scan_func pick_scan(const char **name)
+{
+#ifdef SCAN_X86
+    //可能在main之前的静态初始化阶段调用，需要先初始化CPU特性信息
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        *name = "avx2";
+        return scan_avx2;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        *name = "sse2";
+        return scan_sse2;
+    }
+#endif
+    *name = "scalar";
+    return scan_scalar;
+}
+
+static const char *scan_name;
+scan_func scan_either_impl = pick_scan(&scan_name);
+
+const char *scan_impl_name()
+{
+    return scan_name;
+}
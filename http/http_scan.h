@@ -0,0 +1,27 @@
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+#include <stddef.h>
+
+//请求报文扫描
+//在[begin, end)中查找第一个等于a或b的字节，返回其位置，找不到返回end
+//用于查找行结束符(\r \n)、请求行分隔符(空格 \t)和头部字段的冒号
+//启动时根据CPU支持的指令集选择AVX2、SSE2或逐字节的实现，之后每次调用只是一次间接跳转
+typedef const char *(*scan_func)(const char *begin, const char *end, char a, char b);
+
+extern scan_func scan_either_impl;
+
+inline const char *scan_either(const char *begin, const char *end, char a, char b)
+{
+    return scan_either_impl(begin, end, a, b);
+}
+
+inline char *scan_either(char *begin, char *end, char a, char b)
+{
+    return (char *)scan_either_impl(begin, end, a, b);
+}
+
+//当前使用的实现名称："avx2"、"sse2"或"scalar"
+const char *scan_impl_name();
+
+#endif
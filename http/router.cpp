@@ -0,0 +1,61 @@
+#include <string.h>
+
+#include "router.h"
+
+router::router() : m_count(0), m_prefix_lens(0)
+{
+    memset(m_slots, 0, sizeof(m_slots));
+}
+
+bool router::add(const route &r)
+{
+    if (m_count == MAX_ROUTES || (ROUTE_PREFIX == r.type && (0 == r.len || r.len > MAX_PREFIX)))
+        return false;
+    if (find(r.hash, r.path, r.len, r.type))
+        return false;
+    unsigned i = r.hash & (SLOTS - 1);
+    while (m_slots[i])
+        i = (i + 1) & (SLOTS - 1);
+    m_routes[m_count] = r;
+    m_slots[i] = ++m_count;
+    if (ROUTE_PREFIX == r.type)
+        m_prefix_lens |= 1ULL << r.len;
+    return true;
+}
+
+const route *router::find(uint64_t hash, const char *path, size_t len, ROUTE_TYPE type) const
+{
+    for (unsigned i = hash & (SLOTS - 1); m_slots[i]; i = (i + 1) & (SLOTS - 1))
+    {
+        const route &r = m_routes[m_slots[i] - 1];
+        if (r.hash == hash && r.len == len && r.type == type && memcmp(r.path, path, len) == 0)
+            return &r;
+    }
+    return NULL;
+}
+
+//只算一遍哈希，经过的前缀长度在掩码中时记下当时的值，最后依次探测整个路径和由长到短的前缀
+const route *router::match(const char *path, size_t len) const
+{
+    uint64_t prefix_hash[MAX_PREFIX + 1];
+    uint64_t h = ROUTE_HASH_BASIS;
+    for (size_t i = 0; i < len; ++i)
+    {
+        h = (h ^ (unsigned char)path[i]) * ROUTE_HASH_PRIME;
+        if (i + 1 <= MAX_PREFIX && (m_prefix_lens >> (i + 1) & 1))
+            prefix_hash[i + 1] = h;
+    }
+    const route *r = find(h, path, len, ROUTE_EXACT);
+    if (r)
+        return r;
+    //不超过路径长度的前缀长度，从最高位开始
+    uint64_t lens = len < MAX_PREFIX ? m_prefix_lens & ((2ULL << len) - 1) : m_prefix_lens;
+    while (lens)
+    {
+        int n = 63 - __builtin_clzll(lens);
+        if ((r = find(prefix_hash[n], path, n, ROUTE_PREFIX)))
+            return r;
+        lens &= ~(1ULL << n);
+    }
+    return NULL;
+}
@@ -0,0 +1,93 @@
+#ifndef HTTP_ROUTER_H
+#define HTTP_ROUTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <mysql/mysql.h>
+
+#include "../slab/arena.h"
+#include "header_table.h"
+
+//请求路径到页面或处理函数的路由表
+//精确路由匹配整个路径(不含?之后的查询串)，前缀路由匹配路径开头，精确路由优先，前缀路由取最长的
+//路径哈希为FNV-1a，内置路由的哈希由ROUTE_PATH在编译期算出，查找时沿路径算一遍哈希，途中记下各前缀长度处的值
+//路由只在启动时(事件循环开始之前)注册，之后只读，查找不加锁也不分配内存
+
+enum ROUTE_TYPE
+{
+    ROUTE_EXACT = 0,
+    ROUTE_PREFIX
+};
+//路由接受的请求方法
+enum ROUTE_METHOD
+{
+    ROUTE_GET = 1,
+    ROUTE_POST = 2,
+    ROUTE_ANY = ROUTE_GET | ROUTE_POST
+};
+
+static const uint64_t ROUTE_HASH_BASIS = 14695981039346656037ULL;
+static const uint64_t ROUTE_HASH_PRIME = 1099511628211ULL;
+
+constexpr uint64_t route_hash(const char *s, size_t len, uint64_t h = ROUTE_HASH_BASIS)
+{
+    return 0 == len ? h : route_hash(s + 1, len - 1, (h ^ (unsigned char)*s) * ROUTE_HASH_PRIME);
+}
+//路由表项的前三个字段，s须为字符串字面量
+#define ROUTE_PATH(s) s, sizeof(s) - 1, route_hash(s, sizeof(s) - 1)
+
+//交给处理函数的请求
+struct route_request
+{
+    int method; //ROUTE_GET或ROUTE_POST
+    const char *path;
+    size_t path_len;
+    const char *body; //请求体，以\0结尾，没有请求体时为NULL
+    size_t body_len;
+    MYSQL *mysql; //处理该请求的数据库连接
+    arena *mem; //请求期间有效的内存，处理函数的临时字符串和返回的页面路径都可以从这里分配
+    const header_table *headers; //请求头
+};
+//返回要发送的页面(以/开头，相对网站根目录)，返回NULL时按请求路径查找文件
+typedef const char *(*route_handler)(const route_request &req);
+
+struct route
+{
+    const char *path;
+    size_t len;
+    uint64_t hash; //route_hash(path, len)
+    ROUTE_TYPE type;
+    int methods; //ROUTE_METHOD的组合，方法不符时按请求路径查找文件
+    const char *page; //handler为NULL时直接发送的页面
+    route_handler handler;
+};
+
+class router
+{
+public:
+    static const int MAX_ROUTES = 32;
+    static const int SLOTS = 64; //开放寻址的槽数，为2的幂，至少是MAX_ROUTES的两倍
+    static const size_t MAX_PREFIX = 63; //前缀路由的最大长度，前缀长度记录在64位掩码中
+
+    static router *get_instance()
+    {
+        static router instance;
+        return &instance;
+    }
+
+    //注册一条路由，path须在程序运行期间一直有效；表满、前缀过长或路径重复时返回false
+    bool add(const route &r);
+    //查找path前len个字节对应的路由，没有时返回NULL
+    const route *match(const char *path, size_t len) const;
+
+private:
+    router();
+    const route *find(uint64_t hash, const char *path, size_t len, ROUTE_TYPE type) const;
+
+    route m_routes[MAX_ROUTES];
+    int m_count;
+    unsigned char m_slots[SLOTS]; //路由下标加1，0表示空槽
+    uint64_t m_prefix_lens; //第i位表示有长度为i的前缀路由
+};
+
+#endif
@@ -136,22 +136,23 @@ void Log::write_log(int level, const char *format, ...)
                      my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
                      my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, now.tv_usec, s);
     //利用valst获得后续可变参数，以format格式写入m_buf
-    int m = vsnprintf(m_buf + n, m_log_buf_size - 1, format, valst);
+    //剩余空间要扣除时间前缀并为换行符留位，超长的内容被截断
+    int m = vsnprintf(m_buf + n, m_log_buf_size - n - 1, format, valst);
+    if (m > m_log_buf_size - n - 2)
+        m = m_log_buf_size - n - 2;
     m_buf[n + m] = '\n';
     m_buf[n + m + 1] = '\0';
-    log_str = m_buf; //获取日志内容
 
-    m_mutex.unlock();
-
-    //异步则将日志内容放入阻塞队列
+    //异步则拷贝日志内容放入阻塞队列
     if (m_is_async && !m_log_queue->full())
     {
+        log_str = m_buf; //获取日志内容
+        m_mutex.unlock();
         m_log_queue->push(log_str);
     }
-    else //同步则直接写入日志文件
+    else //同步则在同一把锁内直接写入日志文件，不再拷贝成string
     {
-        m_mutex.lock();
-        fputs(log_str.c_str(), m_fp);
+        fputs(m_buf, m_fp);
         m_mutex.unlock();
     }
 
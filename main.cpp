@@ -16,7 +16,11 @@ int main(int argc, char *argv[])
     //初始化
     server.init(config.PORT, user, passwd, databasename, config.LOGWrite, 
                 config.OPT_LINGER, config.TRIGMode,  config.sql_num,  config.thread_num, 
-                config.close_log, config.actor_model);
+                config.close_log, config.actor_model, config.loop_num,
+                config.backend, config.read_max, config.send_file,
+                config.cache_mb, config.revalidate_ms, config.gzip_mb, config.cache_control,
+                config.h2c, config.idle_timeout, config.header_timeout, config.body_timeout,
+                config.max_requests, config.min_rate, config.write_quantum, config.bundle);
     
 
     //日志
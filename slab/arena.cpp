@@ -0,0 +1,71 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <new>
+
+#include "arena.h"
+
+thread_local unsigned long long heap_alloc_count = 0;
+std::atomic<unsigned long long> arena::m_overflow(0);
+
+//替换全局operator new，只多一次线程局部变量的自增；数组和nothrow版本默认转发到这里
+void *operator new(size_t size)
+{
+    ++heap_alloc_count;
+    void *p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+void *arena::alloc(size_t size)
+{
+    const size_t align = alignof(max_align_t);
+    size = (size + align - 1) & ~(align - 1);
+    if ((size_t)(m_end - m_ptr) < size)
+    {
+        //块头之后按对齐留出位置，新块至少BLOCK_SIZE，旧块剩余的部分不再使用
+        size_t head = (sizeof(block) + align - 1) & ~(align - 1);
+        size_t len = head + size > BLOCK_SIZE ? head + size : BLOCK_SIZE;
+        block *b = (block *)malloc(len);
+        if (!b)
+            throw std::bad_alloc();
+        ++heap_alloc_count;
+        m_overflow.fetch_add(1, std::memory_order_relaxed);
+        b->next = m_blocks;
+        m_blocks = b;
+        m_ptr = (char *)b + head;
+        m_end = (char *)b + len;
+    }
+    void *p = m_ptr;
+    m_ptr += size;
+    return p;
+}
+
+char *arena::strndup(const char *s, size_t len)
+{
+    char *p = (char *)alloc(len + 1);
+    memcpy(p, s, len);
+    p[len] = '\0';
+    return p;
+}
+
+void arena::reset()
+{
+    while (m_blocks)
+    {
+        block *next = m_blocks->next;
+        free(m_blocks);
+        m_blocks = next;
+    }
+    m_ptr = m_inline;
+    m_end = m_inline + INLINE_SIZE;
+}
@@ -0,0 +1,52 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <atomic>
+
+//本线程调用operator new(含std::string、容器等)以及arena申请溢出块的次数
+//由arena.cpp中替换的全局operator new累加，前后两次读数之差即为其间的堆分配次数
+extern thread_local unsigned long long heap_alloc_count;
+
+//按请求分配的内存(bump分配)
+//先在对象自带的内存中顺序切分，不够时从堆上申请更大的块串起来；不能单独释放，请求处理完后reset整体归还
+//reset释放所有溢出块，只保留自带的内存，请求再大也不会长期占用
+//不加锁，只由当前处理该连接的线程使用
+class arena
+{
+public:
+    static const size_t INLINE_SIZE = 512; //自带内存的大小，登录、注册等请求不会超出
+    static const size_t BLOCK_SIZE = 4096; //溢出块的最小大小
+
+    arena() : m_ptr(m_inline), m_end(m_inline + INLINE_SIZE), m_blocks(NULL) {}
+    ~arena()
+    {
+        reset();
+    }
+
+    //按max_align_t对齐，内存不足时抛出std::bad_alloc
+    void *alloc(size_t size);
+    //拷贝s的前len个字节并在结尾补\0
+    char *strndup(const char *s, size_t len);
+    void reset();
+
+    //所有arena申请过的溢出块数，只用于观察
+    static unsigned long long overflow_blocks()
+    {
+        return m_overflow.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct block
+    {
+        block *next;
+    };
+
+    char *m_ptr; //下一次分配的位置
+    char *m_end;
+    block *m_blocks; //溢出块链表，表头为正在切分的块
+    alignas(max_align_t) char m_inline[INLINE_SIZE];
+    static std::atomic<unsigned long long> m_overflow;
+};
+
+#endif
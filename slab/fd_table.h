@@ -0,0 +1,61 @@
+#ifndef FD_TABLE_H
+#define FD_TABLE_H
+
+#include <stdlib.h>
+#include <exception>
+
+//以文件描述符为下标的稀疏两级表，存放指向连接对象的指针
+//第一级固定为PAGE_NUM个页指针，第二级每页PAGE_SIZE个槽，页在第一次使用时才申请
+//只有实际出现过的文件描述符所在的页占用内存
+//不加锁，只由所属事件循环的线程使用
+//MAX_FD为文件描述符上限
+template <typename T, int MAX_FD>
+class fd_table
+{
+public:
+    static const int PAGE_SHIFT = 8;
+    static const int PAGE_SIZE = 1 << PAGE_SHIFT; //每页的槽数
+    static const int PAGE_NUM = (MAX_FD + PAGE_SIZE - 1) >> PAGE_SHIFT; //页数
+
+    fd_table()
+    {
+        for (int i = 0; i < PAGE_NUM; ++i)
+            m_pages[i] = NULL;
+    }
+    ~fd_table()
+    {
+        for (int i = 0; i < PAGE_NUM; ++i)
+            free(m_pages[i]);
+    }
+
+    //查找文件描述符对应的对象，不存在返回NULL
+    T *get(int fd) const
+    {
+        if (fd < 0 || fd >= MAX_FD)
+            return NULL;
+        T **page = m_pages[fd >> PAGE_SHIFT];
+        if (!page)
+            return NULL;
+        return page[fd & (PAGE_SIZE - 1)];
+    }
+
+    //设置文件描述符对应的对象，obj为NULL表示清除，调用者保证fd小于MAX_FD
+    void set(int fd, T *obj)
+    {
+        T **&page = m_pages[fd >> PAGE_SHIFT];
+        if (!page)
+        {
+            if (!obj)
+                return;
+            page = (T **)calloc(PAGE_SIZE, sizeof(T *));
+            if (!page)
+                throw std::exception();
+        }
+        page[fd & (PAGE_SIZE - 1)] = obj;
+    }
+
+private:
+    T **m_pages[PAGE_NUM]; //第一级页指针
+};
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdlib.h>
+#include <new>
+#include <vector>
+#include <exception>
+
+//对象slab分配器
+//按块向系统申请内存，每块容纳CHUNK_OBJS个对象，块内按顺序切分，释放的对象挂到空闲链表上优先复用
+//新块只申请不初始化，对象第一次被分配时才会写入对应的页面，常驻内存随同时存活的对象数增长
+//不加锁，只由所属事件循环的线程使用
+template <typename T>
+class slab
+{
+public:
+    static const int CHUNK_OBJS = 64; //每块容纳的对象数
+
+    slab() : m_free(NULL), m_cur(NULL), m_cur_used(CHUNK_OBJS), m_live(0) {}
+    ~slab()
+    {
+        for (size_t i = 0; i < m_chunks.size(); ++i)
+            free(m_chunks[i]);
+    }
+
+    //分配并构造一个对象
+    T *alloc()
+    {
+        node *n = m_free;
+        if (n)
+        {
+            m_free = n->next;
+        }
+        else
+        {
+            //当前块已切分完，申请新块
+            if (m_cur_used == CHUNK_OBJS)
+            {
+                m_cur = (node *)malloc(sizeof(node) * CHUNK_OBJS);
+                if (!m_cur)
+                    throw std::exception();
+                m_chunks.push_back(m_cur);
+                m_cur_used = 0;
+            }
+            n = m_cur + m_cur_used++;
+        }
+        ++m_live;
+        return new (n->obj) T();
+    }
+
+    //析构对象并归还到空闲链表
+    void release(T *obj)
+    {
+        obj->~T();
+        node *n = (node *)obj;
+        n->next = m_free;
+        m_free = n;
+        --m_live;
+    }
+
+    //当前存活的对象数
+    int live() const
+    {
+        return m_live;
+    }
+
+private:
+    //空闲时存放链表指针，分配后存放对象
+    union node
+    {
+        node *next;
+        alignas(T) char obj[sizeof(T)];
+    };
+
+    node *m_free; //空闲链表
+    node *m_cur; //正在切分的块
+    int m_cur_used; //当前块已切分的对象数
+    int m_live; //存活的对象数
+    std::vector<node *> m_chunks; //已申请的所有块
+};
+
+#endif
@@ -0,0 +1,263 @@
+//请求解析的微基准：把一个请求拷入缓冲区，切分请求行和请求头，统计每个请求的平均耗时
+//baseline为原来的写法：逐字节找\r\n，strpbrk切分请求行，strncasecmp逐个比较字段名
+//current与http_conn::parse_line/parse_request_line/parse_headers相同：scan_either跳到行尾，先找冒号再归并字段名
+//用法 parse_bench [迭代次数倍数]，在项目根目录执行make parse_bench生成
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#include "../http/http_scan.h"
+#include "../http/header_table.h"
+
+namespace
+{
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+enum LINE_STATUS
+{
+    LINE_OK = 0,
+    LINE_BAD,
+    LINE_OPEN
+};
+
+//解析状态，只保留与切分有关的部分
+struct parser
+{
+    char *buf;
+    int read_idx;
+    int checked_idx;
+    int start_line;
+    int line_end;
+    const char *url;
+    const char *version;
+    long content_length;
+    bool linger;
+    const char *host;
+    header_table headers;
+};
+
+LINE_STATUS baseline_line(parser &p)
+{
+    for (; p.checked_idx < p.read_idx; ++p.checked_idx)
+    {
+        char temp = p.buf[p.checked_idx];
+        if (temp == '\r')
+        {
+            if (p.checked_idx + 1 == p.read_idx)
+                return LINE_OPEN;
+            if (p.buf[p.checked_idx + 1] == '\n')
+            {
+                p.buf[p.checked_idx++] = '\0';
+                p.buf[p.checked_idx++] = '\0';
+                return LINE_OK;
+            }
+            return LINE_BAD;
+        }
+        if (temp == '\n')
+            return LINE_BAD;
+    }
+    return LINE_OPEN;
+}
+
+bool baseline_request_line(parser &p, char *text)
+{
+    char *url = strpbrk(text, " \t");
+    if (!url)
+        return false;
+    *url++ = '\0';
+    url += strspn(url, " \t");
+    char *version = strpbrk(url, " \t");
+    if (!version)
+        return false;
+    *version++ = '\0';
+    version += strspn(version, " \t");
+    p.url = url;
+    p.version = version;
+    return true;
+}
+
+void baseline_header(parser &p, char *text)
+{
+    if (strncasecmp(text, "Connection:", 11) == 0)
+    {
+        text += 11;
+        text += strspn(text, " \t");
+        if (strcasecmp(text, "keep-alive") == 0)
+            p.linger = true;
+    }
+    else if (strncasecmp(text, "Content-length:", 15) == 0)
+    {
+        text += 15;
+        text += strspn(text, " \t");
+        p.content_length = atol(text);
+    }
+    else if (strncasecmp(text, "Host:", 5) == 0)
+    {
+        text += 5;
+        text += strspn(text, " \t");
+        p.host = text;
+    }
+}
+
+LINE_STATUS current_line(parser &p)
+{
+    if (p.checked_idx >= p.read_idx)
+        return LINE_OPEN;
+    char *end = p.buf + p.read_idx;
+    p.checked_idx = scan_either(p.buf + p.checked_idx, end, '\r', '\n') - p.buf;
+    if (p.checked_idx == p.read_idx)
+        return LINE_OPEN;
+    if (p.buf[p.checked_idx] != '\r')
+        return LINE_BAD;
+    if (p.checked_idx + 1 == p.read_idx)
+        return LINE_OPEN;
+    if (p.buf[p.checked_idx + 1] != '\n')
+        return LINE_BAD;
+    p.line_end = p.checked_idx;
+    p.buf[p.checked_idx++] = '\0';
+    p.buf[p.checked_idx++] = '\0';
+    return LINE_OK;
+}
+
+bool current_request_line(parser &p, char *text)
+{
+    char *end = p.buf + p.line_end;
+    char *url = scan_either(text, end, ' ', '\t');
+    if (url == end)
+        return false;
+    *url++ = '\0';
+    url += strspn(url, " \t");
+    char *version = scan_either(url, end, ' ', '\t');
+    if (version == end)
+        return false;
+    *version++ = '\0';
+    version += strspn(version, " \t");
+    p.url = url;
+    p.version = version;
+    return true;
+}
+
+void current_header(parser &p, char *text)
+{
+    char *end = p.buf + p.line_end;
+    char *colon = scan_either(text, end, ':', ':');
+    char *value = colon == end ? end : colon + 1;
+    value += strspn(value, " \t");
+    switch (p.headers.add(text, colon == end ? 0 : colon - text, value, end - value))
+    {
+    case HDR_CONNECTION:
+        if (strcasecmp(value, "keep-alive") == 0)
+            p.linger = true;
+        break;
+    case HDR_CONTENT_LENGTH:
+        p.content_length = atol(value);
+        break;
+    case HDR_HOST:
+        p.host = value;
+        break;
+    default:
+        break;
+    }
+}
+
+//解析到空行为止，返回值只用于防止编译器把循环优化掉
+template <class LINE, class REQUEST_LINE, class HEADER>
+double run(const std::string &req, int iters, LINE line, REQUEST_LINE request_line, HEADER header, long &sink)
+{
+    std::vector<char> buf(req.size() + 1);
+    parser p;
+    double start = now();
+    for (int i = 0; i < iters; ++i)
+    {
+        memcpy(buf.data(), req.data(), req.size());
+        buf[req.size()] = '\0';
+        p.buf = buf.data();
+        p.read_idx = req.size();
+        p.checked_idx = p.start_line = p.line_end = 0;
+        p.url = p.version = p.host = NULL;
+        p.content_length = 0;
+        p.linger = false;
+        p.headers.clear();
+        bool first = true;
+        while (LINE_OK == line(p))
+        {
+            char *text = p.buf + p.start_line;
+            p.start_line = p.checked_idx;
+            if (first)
+            {
+                if (!request_line(p, text))
+                    break;
+                first = false;
+            }
+            else if (text[0])
+                header(p, text);
+            else
+                break;
+        }
+        sink += p.content_length + p.linger + (p.host ? p.host - p.buf : 0) + (p.url ? p.url - p.buf : 0);
+    }
+    return (now() - start) / iters * 1e9;
+}
+}
+
+int main(int argc, char *argv[])
+{
+    double scale = argc > 1 ? atof(argv[1]) : 1;
+    std::string curl = "GET /0 HTTP/1.1\r\nHost: 127.0.0.1:9006\r\nUser-Agent: curl/8.5.0\r\nAccept: */*\r\n\r\n";
+    std::string browser =
+        "GET /picture.html HTTP/1.1\r\n"
+        "Host: 127.0.0.1:9006\r\n"
+        "Connection: keep-alive\r\n"
+        "Cache-Control: max-age=0\r\n"
+        "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+        "sec-ch-ua-mobile: ?0\r\n"
+        "sec-ch-ua-platform: \"Linux\"\r\n"
+        "Upgrade-Insecure-Requests: 1\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 "
+        "Safari/537.36\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8,"
+        "application/signed-exchange;v=b3;q=0.7\r\n"
+        "Sec-Fetch-Site: same-origin\r\n"
+        "Sec-Fetch-Mode: navigate\r\n"
+        "Sec-Fetch-User: ?1\r\n"
+        "Sec-Fetch-Dest: document\r\n"
+        "Referer: http://127.0.0.1:9006/\r\n"
+        "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+        "Accept-Language: en-US,en;q=0.9,zh-CN;q=0.8,zh;q=0.7\r\n"
+        "Cookie: _ga=GA1.1.1234567890.1700000000; session=abcdef0123456789abcdef0123456789; theme=dark\r\n"
+        "\r\n";
+    std::string cookie = browser;
+    cookie.insert(cookie.size() - 2, "Cookie2: " + std::string(4000, 'z') + "\r\n");
+
+    struct
+    {
+        const char *name;
+        const std::string *req;
+    } cases[] = {{"curl-like", &curl}, {"browser", &browser}, {"browser + 4KB cookie", &cookie}};
+
+    printf("scan_either: %s\n", scan_impl_name());
+    long sink = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i)
+    {
+        const std::string &req = *cases[i].req;
+        int iters = (int)((req.size() > 2000 ? 200000 : 2000000) * scale);
+        if (iters < 1)
+            iters = 1;
+        run(req, iters / 10 + 1, baseline_line, baseline_request_line, baseline_header, sink); //预热
+        double base = run(req, iters, baseline_line, baseline_request_line, baseline_header, sink);
+        double cur = run(req, iters, current_line, current_request_line, current_header, sink);
+        printf("%-22s %5zu B  baseline %7.1f ns  current %7.1f ns  x%.2f\n", cases[i].name, req.size(), base, cur,
+               base / cur);
+    }
+    return sink == 42; //只为保留计算结果
+}
@@ -0,0 +1,328 @@
+//响应头生成的基准：不经过socket，用io_uring后端使用的接口驱动一个http_conn
+//每轮把一个请求放入读缓冲区，process()解析请求并生成响应头，再按全部发送完成调用write_complete回到等待下一个请求
+//请求和资源都很小，耗时主要是生成响应头(状态行、Date、Content-Length、ETag、Last-Modified等)
+//之后单独比较两种响应头写法，写入同样的字段：
+//baseline为原来的写法：每行一次vsnprintf(add_response)，每次调用后LOG_INFO整个写缓冲区，没有Date
+//current与http_conn::add_status_line/add_field/add_bytes相同：预先拼好的状态行、拷贝共享的Date、查表格式化数字
+//用法 response_bench [迭代次数] [close_log]，在项目根目录执行make response_bench生成，需要在项目根目录运行(读取./root)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include "../http/http_conn.h"
+#include "../cache/file_cache.h"
+#include "../bundle/asset_bundle.h"
+#include "../log/log.h"
+
+namespace
+{
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//一次完整的请求，返回响应的字节数，失败返回-1
+int round_trip(http_conn &conn, const char *req, size_t req_len)
+{
+    int space = 0;
+    char *buf = conn.read_space(space);
+    if (space < (int)req_len)
+        return -1;
+    memcpy(buf, req, req_len);
+    if (!conn.read_complete(req_len))
+        return -1;
+    conn.process();
+    int count = 0;
+    struct iovec *iov = conn.write_iovec(count);
+    int bytes = 0;
+    for (int i = 0; i < count; ++i)
+        bytes += iov[i].iov_len;
+    if (conn.write_complete(bytes) < 0)
+        return -1;
+    return bytes;
+}
+
+void run(http_conn &conn, const char *name, const char *method, const char *path, int iters)
+{
+    char req[256];
+    int len = snprintf(req, sizeof(req), "%s %s HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: keep-alive\r\n\r\n",
+                       method, path);
+    int bytes = round_trip(conn, req, len); //预热，文件缓存在这里装入
+    if (bytes < 0)
+    {
+        printf("%-18s failed\n", name);
+        return;
+    }
+    double start = now();
+    for (int i = 0; i < iters; ++i)
+    {
+        if (round_trip(conn, req, len) < 0)
+        {
+            printf("%-18s failed\n", name);
+            return;
+        }
+    }
+    printf("%-18s %7.1f ns/request (%d B)\n", name, (now() - start) / iters * 1e9, bytes);
+}
+
+//与http_conn.cpp中的format_uint相同
+int format_uint(char *buf, unsigned long long v)
+{
+    static const char digits[] = "00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+    char tmp[20];
+    char *p = tmp + sizeof(tmp);
+    while (v >= 100)
+    {
+        const char *d = digits + (v % 100) * 2;
+        v /= 100;
+        *--p = d[1];
+        *--p = d[0];
+    }
+    if (v >= 10)
+    {
+        *--p = digits[v * 2 + 1];
+        *--p = digits[v * 2];
+    }
+    else
+    {
+        *--p = '0' + v;
+    }
+    int len = tmp + sizeof(tmp) - p;
+    memcpy(buf, p, len);
+    return len;
+}
+
+//响应头用到的资源信息，file cache的情况下ETag、Last-Modified和Content-Length行已预先生成
+struct resource
+{
+    struct stat st;
+    char etag[64];
+    int etag_len;
+    char last_modified[32];
+    char length_header[48];
+    int length_header_len;
+};
+
+//只保留写缓冲区和写响应头需要的状态，LOG_INFO使用m_close_log
+struct writer
+{
+    char m_write_buf[http_conn::WRITE_BUFFER_SIZE];
+    int m_write_idx;
+    int m_close_log;
+    bool m_linger;
+    char m_date_header[http_conn::DATE_HEADER_LEN + 1];
+    char m_etag_buf[64];
+    char m_date_buf[32];
+
+    bool add_response(const char *format, ...)
+    {
+        if (m_write_idx >= http_conn::WRITE_BUFFER_SIZE)
+            return false;
+        va_list arg_list;
+        va_start(arg_list, format);
+        int len = vsnprintf(m_write_buf + m_write_idx, http_conn::WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list);
+        if (len >= (http_conn::WRITE_BUFFER_SIZE - 1 - m_write_idx))
+        {
+            va_end(arg_list);
+            return false;
+        }
+        m_write_idx += len;
+        va_end(arg_list);
+
+        LOG_INFO("request:%s", m_write_buf);
+
+        return true;
+    }
+    bool add_bytes(const char *data, int len)
+    {
+        if (len >= http_conn::WRITE_BUFFER_SIZE - 1 - m_write_idx)
+            return false;
+        memcpy(m_write_buf + m_write_idx, data, len);
+        m_write_idx += len;
+        return true;
+    }
+    bool add_field(const char *name, int name_len, const char *value, int value_len)
+    {
+        if (name_len + value_len + 2 >= http_conn::WRITE_BUFFER_SIZE - 1 - m_write_idx)
+            return false;
+        char *p = m_write_buf + m_write_idx;
+        memcpy(p, name, name_len);
+        memcpy(p + name_len, value, value_len);
+        memcpy(p + name_len + value_len, "\r\n", 2);
+        m_write_idx += name_len + value_len + 2;
+        return true;
+    }
+
+    //200，文件缓存命中时拷贝预先生成的Content-Length行，否则格式化长度、ETag和Last-Modified
+    bool baseline_ok(const resource &res, bool cached)
+    {
+        const char *etag = res.etag, *last_modified = res.last_modified;
+        int etag_len = res.etag_len;
+        if (!cached)
+        {
+            etag_len = file_cache::format_etag(res.st, false, m_etag_buf, sizeof(m_etag_buf));
+            file_cache::format_http_date(res.st.st_mtime, m_date_buf, sizeof(m_date_buf));
+            etag = m_etag_buf;
+            last_modified = m_date_buf;
+        }
+        bool ok = add_response("%s %d %s\r\n", "HTTP/1.1", 200, "OK") &&
+                  (cached ? add_bytes(res.length_header, res.length_header_len)
+                          : add_response("Content-Length:%d\r\n", (int)res.st.st_size));
+        return ok && add_response("ETag:%.*s\r\n", etag_len, etag) &&
+               add_response("Last-Modified:%s\r\n", last_modified) &&
+               add_response("Connection:%s\r\n", m_linger ? "keep-alive" : "close") && add_response("%s", "\r\n");
+    }
+    bool current_ok(const resource &res, bool cached)
+    {
+        const char *etag = res.etag, *last_modified = res.last_modified;
+        int etag_len = res.etag_len;
+        if (!cached)
+        {
+            etag_len = file_cache::format_etag(res.st, false, m_etag_buf, sizeof(m_etag_buf));
+            file_cache::format_http_date(res.st.st_mtime, m_date_buf, sizeof(m_date_buf));
+            etag = m_etag_buf;
+            last_modified = m_date_buf;
+        }
+        char num[20];
+        bool ok = add_bytes("HTTP/1.1 200 OK\r\n", 17) && add_bytes(m_date_header, http_conn::DATE_HEADER_LEN) &&
+                  (cached ? add_bytes(res.length_header, res.length_header_len)
+                          : add_field("Content-Length:", 15, num, format_uint(num, res.st.st_size)));
+        return ok && add_field("ETag:", 5, etag, etag_len) &&
+               add_field("Last-Modified:", 14, last_modified, strlen(last_modified)) &&
+               (m_linger ? add_bytes("Connection:keep-alive\r\n", 23) : add_bytes("Connection:close\r\n", 18)) &&
+               add_bytes("\r\n", 2);
+    }
+    //404及其页面
+    bool baseline_404(const char *form)
+    {
+        return add_response("%s %d %s\r\n", "HTTP/1.1", 404, "Not Found") &&
+               add_response("Content-Length:%d\r\n", (int)strlen(form)) &&
+               add_response("Connection:%s\r\n", m_linger ? "keep-alive" : "close") && add_response("%s", "\r\n") &&
+               add_response("%s", form);
+    }
+    bool current_404(const char *form)
+    {
+        char num[20];
+        size_t len = strlen(form);
+        return add_bytes("HTTP/1.1 404 Not Found\r\n", 24) && add_bytes(m_date_header, http_conn::DATE_HEADER_LEN) &&
+               add_field("Content-Length:", 15, num, format_uint(num, len)) &&
+               (m_linger ? add_bytes("Connection:keep-alive\r\n", 23) : add_bytes("Connection:close\r\n", 18)) &&
+               add_bytes("\r\n", 2) && add_bytes(form, len);
+    }
+};
+
+//每次从写缓冲区开头写一个响应，返回每个响应的平均耗时(ns)
+template <class WRITE>
+double time_writer(writer &w, int iters, WRITE write, long &sink)
+{
+    double start = now();
+    for (int i = 0; i < iters; ++i)
+    {
+        w.m_write_idx = 0;
+        if (!write(w))
+            return -1;
+        sink += w.m_write_idx;
+    }
+    return (now() - start) / iters * 1e9;
+}
+
+void compare_writers(const char *root, int iters, int close_log)
+{
+    static writer w;
+    w.m_close_log = close_log;
+    w.m_linger = true;
+    memcpy(w.m_date_header, "Date:", 5);
+    file_cache::format_http_date(time(NULL), w.m_date_header + 5, sizeof(w.m_date_header) - 5);
+    memcpy(w.m_date_header + http_conn::DATE_HEADER_LEN - 2, "\r\n", 3);
+
+    resource res;
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/judge.html", root);
+    if (stat(path, &res.st) < 0)
+    {
+        printf("stat %s failed\n", path);
+        return;
+    }
+    res.etag_len = file_cache::format_etag(res.st, false, res.etag, sizeof(res.etag));
+    file_cache::format_http_date(res.st.st_mtime, res.last_modified, sizeof(res.last_modified));
+    res.length_header_len = snprintf(res.length_header, sizeof(res.length_header), "Content-Length:%lld\r\n",
+                                     (long long)res.st.st_size);
+    const char *form = "The requested file was not found on this server.\n";
+
+    struct
+    {
+        const char *name;
+        bool (*baseline)(writer &, const resource &, const char *);
+        bool (*current)(writer &, const resource &, const char *);
+    } cases[] = {
+        {"200 file cache", [](writer &w, const resource &r, const char *) { return w.baseline_ok(r, true); },
+         [](writer &w, const resource &r, const char *) { return w.current_ok(r, true); }},
+        {"200 uncached", [](writer &w, const resource &r, const char *) { return w.baseline_ok(r, false); },
+         [](writer &w, const resource &r, const char *) { return w.current_ok(r, false); }},
+        {"404", [](writer &w, const resource &, const char *f) { return w.baseline_404(f); },
+         [](writer &w, const resource &, const char *f) { return w.current_404(f); }},
+    };
+
+    printf("header writer (close_log %d):\n", close_log);
+    long sink = 0;
+    //日志打开时baseline每个响应要写几次日志，减少迭代次数
+    int base_iters = close_log ? iters : iters / 100 + 1;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i)
+    {
+        auto base_fn = [&](writer &w) { return cases[i].baseline(w, res, form); };
+        auto cur_fn = [&](writer &w) { return cases[i].current(w, res, form); };
+        time_writer(w, base_iters / 10 + 1, base_fn, sink); //预热
+        double base = time_writer(w, base_iters, base_fn, sink);
+        double cur = time_writer(w, iters, cur_fn, sink);
+        printf("%-18s baseline %7.1f ns  current %7.1f ns  x%.2f\n", cases[i].name, base, cur, base / cur);
+    }
+    if (sink == 42) //只为保留计算结果
+        puts("");
+}
+}
+
+int main(int argc, char *argv[])
+{
+    int iters = argc > 1 ? atoi(argv[1]) : 500000;
+    int close_log = argc > 2 ? atoi(argv[2]) : 1;
+
+    Log::get_instance()->init("./BenchLog", close_log, 2000, 800000, 0);
+    http_conn::init_routes();
+    http_conn::update_date();
+    http_conn::m_max_keepalive = 0; //同一个连接上一直处理下去
+
+    static char root[PATH_MAX];
+    if (!getcwd(root, sizeof(root) - 6))
+        return 1;
+    strcat(root, "/root");
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    http_conn *conn = new http_conn;
+    conn->init(-1, addr, -1, NULL, root, 0, close_log, "", "", ""); //epollfd为-1，读写由调用者完成
+
+    //依次为：每次stat、打开和映射文件，文件缓存命中，只有响应头的HEAD，编译进程序的资源
+    file_cache::get_instance()->init(0, 1000, false, 0);
+    run(*conn, "GET uncached", "GET", "/judge.html", iters / 4);
+    file_cache::get_instance()->init(64 << 20, 1000, false, 0);
+    run(*conn, "GET file cache", "GET", "/judge.html", iters);
+    run(*conn, "HEAD file cache", "HEAD", "/judge.html", iters);
+    asset_bundle::get_instance()->init(true);
+    run(*conn, "GET bundle", "GET", "/judge.html", iters);
+
+    conn->close_conn();
+
+    compare_writers(root, iters, close_log);
+    return 0;
+}
@@ -0,0 +1,194 @@
+//用户表的基准和并发测试
+//bench：预先装入100万用户，多个线程按比例混合登录(check)和注册(insert)，输出每秒操作数
+//       table为CGImysql/user_table，rwmap为原来的map加读写锁，作为对照
+//stress：多个线程同时注册同一批用户名并立即登录，检查每个用户名恰好注册成功一次且随即可见
+//        用make user_table_tsan生成ThreadSanitizer版本运行，检查读写之间没有数据竞争
+//用法 user_table_bench bench <table|rwmap> <线程数> <注册百分比> [秒数]
+//     user_table_bench stress [线程数] [用户数]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../CGImysql/user_table.h"
+
+namespace
+{
+const int PRELOAD = 1000000;
+
+struct table_store
+{
+    user_table *table = user_table::get_instance();
+    void reserve(size_t n)
+    {
+        table->reserve(n);
+    }
+    bool check(const char *name, const char *password)
+    {
+        return table->check(name, password);
+    }
+    bool insert(const char *name, const char *password)
+    {
+        return table->insert(name, password);
+    }
+};
+
+struct rwmap_store
+{
+    std::map<std::string, std::string, std::less<>> users;
+    pthread_rwlock_t lock = PTHREAD_RWLOCK_INITIALIZER;
+    void reserve(size_t)
+    {
+    }
+    bool check(const char *name, const char *password)
+    {
+        pthread_rwlock_rdlock(&lock);
+        auto it = users.find(std::string_view(name));
+        bool ok = it != users.end() && it->second == password;
+        pthread_rwlock_unlock(&lock);
+        return ok;
+    }
+    bool insert(const char *name, const char *password)
+    {
+        pthread_rwlock_wrlock(&lock);
+        bool ok = users.emplace(name, password).second;
+        pthread_rwlock_unlock(&lock);
+        return ok;
+    }
+};
+
+//用户u<k>的密码为p<k>
+template <class STORE>
+void preload(STORE &store)
+{
+    char name[32], password[32];
+    auto start = std::chrono::steady_clock::now();
+    store.reserve(PRELOAD);
+    for (int i = 0; i < PRELOAD; ++i)
+    {
+        snprintf(name, sizeof(name), "u%d", i);
+        snprintf(password, sizeof(password), "p%d", i);
+        store.insert(name, password);
+    }
+    printf("load %d users: %.0f ms\n", PRELOAD,
+           std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+}
+
+//注册的用户名从PRELOAD开始递增，不会重复；登录在已装入的用户中随机选择
+template <class STORE>
+void mixed(const char *name, STORE &store, int threads, int register_pct, double seconds)
+{
+    std::atomic<long> total(0), failures(0);
+    std::atomic<int> next_user(PRELOAD);
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&, t] {
+            unsigned x = t * 7919 + 1;
+            long n = 0, failed = 0;
+            char user[32], password[32];
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                for (int k = 0; k < 256; ++k, ++n)
+                {
+                    x = x * 1103515245 + 12345;
+                    unsigned r = x >> 8;
+                    int u = (int)(r % 100) < register_pct ? next_user++ : (int)((r * 2654435761u) % PRELOAD);
+                    snprintf(user, sizeof(user), "u%d", u);
+                    snprintf(password, sizeof(password), "p%d", u);
+                    bool ok = u >= PRELOAD ? store.insert(user, password) : store.check(user, password);
+                    failed += !ok;
+                }
+            }
+            total += n;
+            failures += failed;
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i].join();
+    printf("%-6s threads %2d register %2d%%: %6.2f Mops/s, failures %ld\n", name, threads, register_pct,
+           total / seconds / 1e6, failures.load());
+}
+
+std::atomic<long> persisted(0);
+
+bool count_persist(const char *, const char *, void *)
+{
+    ++persisted;
+    return true;
+}
+
+int stress(int threads, int users)
+{
+    user_table *table = user_table::get_instance();
+    std::atomic<long> registered(0), missing(0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&] {
+            char name[32];
+            for (int i = 0; i < users; ++i)
+            {
+                snprintf(name, sizeof(name), "d%d", i);
+                if (table->insert(name, "x", count_persist, NULL))
+                    ++registered;
+                if (!table->check(name, "x")) //不论是否由本线程注册，insert返回后都必须能查到
+                    ++missing;
+            }
+        });
+    }
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i].join();
+    printf("registered %ld, persisted %ld, size %zu, missing %ld (expected %d registered)\n", registered.load(),
+           persisted.load(), table->size(), missing.load(), users);
+    bool ok = registered == users && persisted == users && table->size() == (size_t)users && missing == 0;
+    puts(ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s bench <table|rwmap> <threads> <register%%> [seconds]\n", prog);
+    fprintf(stderr, "       %s stress [threads] [users]\n", prog);
+}
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc >= 5 && strcmp(argv[1], "bench") == 0)
+    {
+        int threads = atoi(argv[3]);
+        int register_pct = atoi(argv[4]);
+        double seconds = argc > 5 ? atof(argv[5]) : 2;
+        if (strcmp(argv[2], "table") == 0)
+        {
+            table_store store;
+            preload(store);
+            mixed("table", store, threads, register_pct, seconds);
+            return 0;
+        }
+        if (strcmp(argv[2], "rwmap") == 0)
+        {
+            rwmap_store store;
+            preload(store);
+            mixed("rwmap", store, threads, register_pct, seconds);
+            return 0;
+        }
+    }
+    else if (argc >= 2 && strcmp(argv[1], "stress") == 0)
+    {
+        return stress(argc > 2 ? atoi(argv[2]) : 4, argc > 3 ? atoi(argv[3]) : 200000);
+    }
+    usage(argv[0]);
+    return 1;
+}
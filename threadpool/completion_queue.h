@@ -0,0 +1,82 @@
+#ifndef COMPLETION_QUEUE_H
+#define COMPLETION_QUEUE_H
+
+#include <list>
+#include <exception>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "../lock/locker.h"
+
+//完成队列，每个事件循环一个
+//Reactor模式下工作线程处理完读写任务后，把连接放入所属循环的完成队列，并通过eventfd唤醒该循环
+//循环线程将eventfd注册在自己的epoll中，可读时一次取出全部完成的任务，在循环线程内统一处理后续工作(如删除定时器)
+//这样循环无需等待工作线程，可以继续分发其他就绪的文件描述符
+template <typename T>
+class completion_queue
+{
+public:
+    completion_queue()
+    {
+        m_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (m_eventfd < 0)
+        {
+            throw std::exception();
+        }
+    }
+    ~completion_queue()
+    {
+        close(m_eventfd);
+    }
+    //用于注册到epoll的eventfd
+    int get_fd() const
+    {
+        return m_eventfd;
+    }
+    //工作线程调用，放入一个完成的任务
+    //只有队列由空变为非空时才写eventfd，减少唤醒循环的系统调用
+    void push(T *item)
+    {
+        m_lock.lock();
+        bool was_empty = m_items.empty();
+        m_items.push_back(item);
+        m_lock.unlock();
+
+        if (was_empty)
+        {
+            uint64_t one = 1;
+            ssize_t ret = write(m_eventfd, &one, sizeof(one));
+            (void)ret;
+        }
+    }
+    //不放入任务，只唤醒循环，用于通知循环检查停止标志
+    void notify()
+    {
+        uint64_t one = 1;
+        ssize_t ret = write(m_eventfd, &one, sizeof(one));
+        (void)ret;
+    }
+    //循环线程调用，先清空eventfd计数，再取出所有已完成的任务
+    void drain(std::list<T *> &items)
+    {
+        uint64_t count = 0;
+        ssize_t ret = read(m_eventfd, &count, sizeof(count));
+        (void)ret;
+
+        take(items);
+    }
+    //只取出已完成的任务，eventfd计数已由调用者读走(如io_uring后端提交的读请求)
+    void take(std::list<T *> &items)
+    {
+        m_lock.lock();
+        items.swap(m_items);
+        m_lock.unlock();
+    }
+
+private:
+    int m_eventfd; //用于唤醒事件循环的eventfd
+    std::list<T *> m_items; //已完成的任务
+    locker m_lock; //保护任务链表的互斥锁
+};
+
+#endif
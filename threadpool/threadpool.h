@@ -137,33 +137,37 @@ void threadpool<T>::run()
             {
                 if (request->read_once()) //循环从监听的socket上读取客户数据进入读缓冲区，直到无数据可读或对方关闭连接
                 {
-                    request->improv = 1;
                     connectionRAII mysqlcon(&request->mysql, m_connPool); //RAII模式获取连接
                     request->process(); //处理请求报文并将响应报文存入写缓冲区
                 }
                 else
                 {
-                    request->improv = 1;
                     request->timer_flag = 1; 
                 }
             }
             else //写任务
             {
-                if (request->write()) //将响应报文发送到socket的缓冲区
+                if (!request->write()) //将响应报文发送到socket的缓冲区
                 {
-                    request->improv = 1;
+                    request->timer_flag = 1;
                 }
-                else
+                else if (request->has_pending()) //读缓冲区中还有流水线请求，继续处理
                 {
-                    request->improv = 1;
-                    request->timer_flag = 1;
+                    connectionRAII mysqlcon(&request->mysql, m_connPool);
+                    request->process();
                 }
             }
+            //放入所属事件循环的完成队列，由循环线程异步处理结果
+            request->m_cq->push(request);
         }
         else //事件处理模式为Proactor，仅有读事件需要线程参与，写事件由主线程处理
         {
-            connectionRAII mysqlcon(&request->mysql, m_connPool);
-            request->process(); //线程处理请求报文并将响应报文存入写缓冲区
+            {
+                connectionRAII mysqlcon(&request->mysql, m_connPool);
+                request->process(); //线程处理请求报文并将响应报文存入写缓冲区
+            }
+            //不论成败都放回所属事件循环的完成队列，之后不再访问该连接，循环收到后才能关闭和释放它
+            request->m_cq->push(request);
         }
     }
 }
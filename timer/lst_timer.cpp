@@ -26,21 +26,21 @@ void timer_wheel::add_timer(util_timer *timer)
     {
         return;
     }
-    int timeout = timer->expire;
-    if(timeout < 0){
-        return;
-    }
-    int ticks = 0; //计算定时器需要滴答几次后触发
-    if(timeout < SI){
-        ticks = 1;
-    }
-    else{
-        ticks = timeout / SI;
+    //expire是绝对时间，先换算为距现在的毫秒数
+    long long timeout = timer->expire - now_ms();
+    //计算定时器需要滴答几次后触发，向上取整保证不会提前超时，最多推迟一个槽间隔
+    //已经超时的定时器放在当前槽，下一次滴答即触发
+    int ticks = 0;
+    if(timeout > 0){
+        ticks = (timeout + SI - 1) / SI;
     }
     int rotation = ticks / N; //计算定时器需要时间轮转动几圈后触发
     int ts = (cur_slot + (ticks % N)) % N; //计算定时器所在的槽
     timer->rotation = rotation;
     timer->time_slot = ts;
+    //调整定时器时会重新插入，先清除旧链表中的前后指针
+    timer->prev = NULL;
+    timer->next = NULL;
     //将定时器插入对应槽的定时器链表
     if(!slots[ts]){ //若该链表为空
         slots[ts] = timer;
@@ -80,7 +80,7 @@ void timer_wheel::del_timer(util_timer *timer) //从链表中删除定时器
         return;
     }
     int ts = timer->time_slot;
-    if(timer = slots[ts]){ //该定时器是ts槽定时器链表的头节点
+    if(timer == slots[ts]){ //该定时器是ts槽定时器链表的头节点
         slots[ts] = slots[ts]->next;
         if(slots[ts]){
             slots[ts]->prev = NULL;
@@ -104,6 +104,16 @@ void timer_wheel::tick() //定时任务处理函数
             tmp = tmp->next;
         }
         else{ //定时器超时，执行定时任务并删除定时器
+            if(tmp->deadline_func){ //连接的期限已推迟，重新插入时间轮
+                long long deadline = tmp->deadline_func(tmp->user_data);
+                if(deadline > now_ms()){
+                    util_timer* tmp2 = tmp->next;
+                    tmp->expire = deadline;
+                    adjust_timer(tmp); //至少推迟一个槽，插入其他槽或当前槽链表头部，不会在本次滴答中再次遇到
+                    tmp = tmp2;
+                    continue;
+                }
+            }
             tmp->cb_func(tmp->user_data);
             if(tmp == slots[cur_slot]){
                 slots[cur_slot] = tmp->next;
@@ -124,12 +134,13 @@ void timer_wheel::tick() //定时任务处理函数
             }
         }
     }
-    cur_slot = ++cur_slot % N; //转动时间轮，即滴答一次
+    cur_slot = (cur_slot + 1) % N; //转动时间轮，即滴答一次
 }
-
-void Utils::init(int timeslot) //初始化alarm函数触发的时间间隔
+long long timer_wheel::now_ms()
 {
-    m_TIMESLOT = timeslot;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
 //对文件描述符设置非阻塞
@@ -158,20 +169,6 @@ void Utils::addfd(int epollfd, int fd, bool one_shot, int TRIGMode)
     setnonblocking(fd);
 }
 
-//信号处理函数
-//信号处理函数中仅仅通过管道发送信号值，不处理信号对应的逻辑，缩短异步执行时间，减少对主程序的影响
-void Utils::sig_handler(int sig)
-{
-    //为保证函数的可重入性，保留原来的errno
-    //可重入性表示中断后再次进入该函数，环境变量与之前相同，不会丢失数据
-    int save_errno = errno;
-    int msg = sig;
-    //将信号值从管道写端写入，传输字符类型，而非整型
-    //将信号值存储的内存地址作为发送缓冲区，发送字节数为1
-    send(u_pipefd[1], (char *)&msg, 1, 0); 
-    errno = save_errno;
-}
-
 //设置信号函数
 void Utils::addsig(int sig, void(handler)(int), bool restart)
 {
@@ -187,11 +184,27 @@ void Utils::addsig(int sig, void(handler)(int), bool restart)
     assert(sigaction(sig, &sa, NULL) != -1); //对信号sig设置新的处理方式，参数类型为sigaction结构体指针
 }
 
-//定时处理任务，重新定时以不断触发SIGALRM信号
-void Utils::timer_handler()
+//创建按时间轮槽间隔周期触发的timerfd，使用单调时钟，不受系统时间调整影响
+int Utils::create_timerfd()
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = timer_wheel::SI / 1000;
+    its.it_value.tv_nsec = (timer_wheel::SI % 1000) * 1000000;
+    its.it_interval = its.it_value;
+    timerfd_settime(fd, 0, &its, NULL);
+    return fd;
+}
+
+//定时处理任务，timerfd每到期一次时间轮滴答一次
+void Utils::timer_handler(uint64_t expirations)
 {
-    m_timer_wheel.tick(); //处理任务
-    alarm(m_TIMESLOT); //重新设定alarm
+    for (uint64_t i = 0; i < expirations; ++i)
+        m_timer_wheel.tick(); //处理任务
 }
 
 void Utils::show_error(int connfd, const char *info) 
@@ -201,18 +214,20 @@ void Utils::show_error(int connfd, const char *info)
     close(connfd);
 }
 
-int *Utils::u_pipefd = 0;
-int Utils::u_epollfd = 0;
-
 class Utils;
 //定时器回调函数:从内核事件表删除事件，关闭文件描述符，释放连接资源
 void cb_func(client_data *user_data) 
 {
-    //从u_epollfd中删除sockfd
-    epoll_ctl(Utils::u_epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
     assert(user_data);
+    //从连接所属循环的内核事件表中删除sockfd
+    if (user_data->epollfd >= 0)
+        epoll_ctl(user_data->epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
+    else
+        shutdown(user_data->sockfd, SHUT_RDWR); //io_uring后端：让仍在内核中等待的接收请求立即完成
     //关闭连接，解除占用
     close(user_data->sockfd);
+    //定时器随后由调用者删除，这里先解除绑定，避免之后的事件再次删除同一个定时器
+    user_data->timer = NULL;
     //连接数-1
     http_conn::m_user_count--;
 }
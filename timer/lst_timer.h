@@ -22,6 +22,8 @@
 #include <sys/uio.h>
 
 #include <time.h>
+#include <stdint.h>
+#include <sys/timerfd.h>
 #include "../log/log.h"
 /* 双向链表实现定时器   
 //时间复杂度：添加定时器O(n)，删除定时器O(1)，执行定时任务O(1)
@@ -117,26 +119,32 @@ void cb_func(client_data *user_data); //定时器回调函数
 //槽数越多，每条链表上的定时器越少，使用多个时间轮能接近O(1))
 
 class util_timer; //前向声明定时器类
+struct connection; //前向声明连接对象
 
 struct client_data //连接资源,绑定socket和定时器
 {
     sockaddr_in address; //socket地址
     int sockfd; //文件描述符
+    int epollfd; //连接所属事件循环的epoll标识
     util_timer *timer;  //定时器类指针指向连接对应的定时器
+    connection *conn; //所在的连接对象，连接关闭后由定时器回调归还给所属循环
 };
 
 class util_timer //定时器类，利用双向链表实现
 {
 public:
-    util_timer(int rot, int ts) : prev(NULL), next(NULL), rotation(rot), time_slot(ts){}
+    util_timer(int rot, int ts) : prev(NULL), next(NULL), rotation(rot), time_slot(ts), deadline_func(NULL){}
 
 public:
     int rotation; //记录定时器在时间轮转多少圈后生效
     int time_slot; //记录定时器位于时间轮哪个槽
-    time_t expire; //超时时间
+    long long expire; //超时时间，单调时钟的绝对毫秒数
     //回调函数，从内核事件表删除事件，关闭文件描述符，释放连接资源
     //定义函数指针cb_func，使用时指向要使用的函数，该函数的参数为client_data*类型
     void (* cb_func)(client_data *); 
+    //到期时先调用，返回连接真正的期限，尚未到达时把定时器顺延到该时间而不执行回调；为NULL时直接回调
+    //连接的期限可能在其他线程中推迟，定时器不必每次都随之调整
+    long long (* deadline_func)(client_data *);
     client_data *user_data;  //连接资源
     util_timer *prev;  //前向定时器
     util_timer *next;  //后向定时器
@@ -153,9 +161,13 @@ public:
     void del_timer(util_timer *timer); //删除定时器
     void tick(); //定时任务处理函数
 
+    static long long now_ms(); //单调时钟的当前毫秒数，定时器的超时时间以此为基准
+
+public:
+    static const int N = 600; //时间轮的槽数
+    static const int SI = 100; //时间轮每隔100ms转动一次，即槽间隔为100ms，转动一圈为60s
+
 private:
-    static const int N = 60; //时间轮的槽数
-    static const int SI = 1; //时间轮每隔一秒转动一次，即槽间隔为1s
     util_timer* slots[N]; //时间轮的槽，每个槽指向一个定时器链表，链表无序
     int cur_slot; //时间轮的当前槽
 };
@@ -166,33 +178,27 @@ public:
     Utils() {}
     ~Utils() {}
 
-    void init(int timeslot);
-
     //对文件描述符设置非阻塞
     int setnonblocking(int fd);
 
     //将内核事件表注册读事件，ET模式，选择开启EPOLLONESHOT
     void addfd(int epollfd, int fd, bool one_shot, int TRIGMode);
 
-    //信号处理函数
-    static void sig_handler(int sig);
-
     //设置信号函数
     void addsig(int sig, void(handler)(int), bool restart = true);
 
-    //定时处理任务，重新定时以不断触发SIGALRM信号
-    void timer_handler();
+    //创建按时间轮槽间隔周期触发的timerfd
+    int create_timerfd();
+
+    //定时处理任务，expirations为从timerfd读出的到期次数，循环繁忙错过的滴答在这里补上
+    void timer_handler(uint64_t expirations);
 
     void show_error(int connfd, const char *info);
 
 public:
-    //使用管道通知主循环执行定时器链表的任务
-    //逻辑顺序，设置信号后，触发时调用信号处理函数，信号处理函数通过管道将sig发送到主循环
-    //主循环通过管道接收sig，得知有定时器超时，再调用定时器处理任务函数timer_handler()处理，并且再次设定ALARM信号触发，形成循环
-    static int *u_pipefd; //管道，用于存储文件描述符
+    //定时器和信号都以文件描述符的形式统一进入事件循环，不再使用alarm和信号处理函数
+    //每个循环用自己的timerfd驱动时间轮，SIGTERM在所有线程中被屏蔽，由0号循环的signalfd接收
     timer_wheel m_timer_wheel; //定时器容器
-    static int u_epollfd; //epoll标识
-    int m_TIMESLOT; //alarm函数触发的时间间隔
 };
 
 void cb_func(client_data *user_data); //定时器回调函数
@@ -0,0 +1,175 @@
+#include "io_ring.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+io_ring::io_ring() : m_ring_fd(-1), m_sqes(NULL), m_sq_ptr(MAP_FAILED), m_cq_ptr(MAP_FAILED)
+{
+}
+
+io_ring::~io_ring()
+{
+    if (m_sqes)
+        munmap(m_sqes, m_sqes_len);
+    if (m_cq_ptr != MAP_FAILED && m_cq_ptr != m_sq_ptr)
+        munmap(m_cq_ptr, m_cq_len);
+    if (m_sq_ptr != MAP_FAILED)
+        munmap(m_sq_ptr, m_sq_len);
+    if (m_ring_fd >= 0)
+        close(m_ring_fd);
+}
+
+bool io_ring::init(unsigned entries)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    m_ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (m_ring_fd < 0)
+        return false;
+
+    //映射提交队列和完成队列，内核支持时两者共用一块映射
+    m_sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cq_len = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (m_cq_len > m_sq_len)
+            m_sq_len = m_cq_len;
+        m_cq_len = m_sq_len;
+    }
+
+    m_sq_ptr = mmap(0, m_sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING);
+    if (m_sq_ptr == MAP_FAILED)
+        return false;
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        m_cq_ptr = m_sq_ptr;
+    else
+    {
+        m_cq_ptr = mmap(0, m_cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_CQ_RING);
+        if (m_cq_ptr == MAP_FAILED)
+            return false;
+    }
+
+    m_sqes_len = params.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = mmap(0, m_sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+        return false;
+    m_sqes = (io_uring_sqe *)sqes;
+
+    char *sq = (char *)m_sq_ptr;
+    m_sq_head = (unsigned *)(sq + params.sq_off.head);
+    m_sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    m_sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    m_sq_array = (unsigned *)(sq + params.sq_off.array);
+    m_sq_entries = params.sq_entries;
+    m_sqe_tail = *m_sq_tail;
+
+    char *cq = (char *)m_cq_ptr;
+    m_cq_head = (unsigned *)(cq + params.cq_off.head);
+    m_cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    m_cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+    return true;
+}
+
+io_uring_sqe *io_ring::get_sqe()
+{
+    unsigned head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    if (m_sqe_tail - head >= m_sq_entries)
+    {
+        //提交队列已满，先提交已填写的项腾出空间
+        submit_and_wait(0);
+        head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+        if (m_sqe_tail - head >= m_sq_entries)
+            return NULL;
+    }
+
+    unsigned index = m_sqe_tail & *m_sq_mask;
+    io_uring_sqe *sqe = &m_sqes[index];
+    m_sq_array[index] = index;
+    ++m_sqe_tail;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+bool io_ring::prep_accept(int fd, sockaddr *addr, socklen_t *addrlen, unsigned long long data)
+{
+    io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)addr;
+    sqe->addr2 = (unsigned long)addrlen;
+    sqe->user_data = data;
+    return true;
+}
+
+bool io_ring::prep_recv(int fd, void *buf, unsigned len, unsigned long long data)
+{
+    io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = len;
+    sqe->user_data = data;
+    return true;
+}
+
+bool io_ring::prep_writev(int fd, const iovec *iov, int iovcnt, unsigned long long data)
+{
+    io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)iov;
+    sqe->len = iovcnt;
+    sqe->off = (unsigned long long)-1; //socket不使用偏移
+    sqe->user_data = data;
+    return true;
+}
+
+bool io_ring::prep_read(int fd, void *buf, unsigned len, unsigned long long data)
+{
+    io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = len;
+    sqe->off = (unsigned long long)-1;
+    sqe->user_data = data;
+    return true;
+}
+
+int io_ring::submit_and_wait(unsigned wait_nr)
+{
+    //发布本地填写的提交队列项，内核尚未取走的项都需要提交
+    __atomic_store_n(m_sq_tail, m_sqe_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = m_sqe_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    if (to_submit == 0 && wait_nr == 0)
+        return 0;
+
+    unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+    return syscall(__NR_io_uring_enter, m_ring_fd, to_submit, wait_nr, flags, NULL, 0);
+}
+
+io_uring_cqe *io_ring::peek_cqe()
+{
+    unsigned head = *m_cq_head;
+    if (head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &m_cqes[head & *m_cq_mask];
+}
+
+void io_ring::cqe_seen()
+{
+    __atomic_store_n(m_cq_head, *m_cq_head + 1, __ATOMIC_RELEASE);
+}
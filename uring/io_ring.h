@@ -0,0 +1,65 @@
+#ifndef IO_RING_H
+#define IO_RING_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+//io_uring的简单封装，直接使用io_uring_setup/io_uring_enter系统调用，不依赖liburing
+//只由所属事件循环的线程使用，不需要加锁
+//使用方式：get_sqe取出提交队列项并用prep_*填写，submit_and_wait一次性提交并等待完成，
+//再用peek_cqe/cqe_seen批量收割完成队列项
+class io_ring
+{
+public:
+    io_ring();
+    ~io_ring();
+
+    //创建entries大小的提交队列，失败返回false
+    bool init(unsigned entries);
+
+    //取出一个空闲的提交队列项，提交队列已满时先提交已有的项
+    io_uring_sqe *get_sqe();
+
+    //填写各类请求，data原样出现在对应完成队列项的user_data中
+    //取不到提交队列项(提交后仍然已满，如内核因完成队列溢出拒绝提交)时返回false，请求没有填写，由调用者稍后重试或关闭连接
+    bool prep_accept(int fd, sockaddr *addr, socklen_t *addrlen, unsigned long long data);
+    bool prep_recv(int fd, void *buf, unsigned len, unsigned long long data);
+    bool prep_writev(int fd, const iovec *iov, int iovcnt, unsigned long long data);
+    bool prep_read(int fd, void *buf, unsigned len, unsigned long long data);
+
+    //提交所有待提交的请求，并等待至少wait_nr个完成事件，返回值同io_uring_enter
+    int submit_and_wait(unsigned wait_nr);
+
+    //取出一个完成队列项，没有则返回NULL；处理完后调用cqe_seen归还
+    io_uring_cqe *peek_cqe();
+    void cqe_seen();
+
+private:
+    int m_ring_fd; //io_uring实例的文件描述符
+
+    //提交队列
+    unsigned *m_sq_head;
+    unsigned *m_sq_tail;
+    unsigned *m_sq_mask;
+    unsigned *m_sq_array;
+    unsigned m_sq_entries;
+    unsigned m_sqe_tail; //本地已填写但未发布的队尾
+    io_uring_sqe *m_sqes;
+
+    //完成队列
+    unsigned *m_cq_head;
+    unsigned *m_cq_tail;
+    unsigned *m_cq_mask;
+    io_uring_cqe *m_cqes;
+
+    //内核共享的映射区域
+    void *m_sq_ptr;
+    size_t m_sq_len;
+    void *m_cq_ptr;
+    size_t m_cq_len;
+    size_t m_sqes_len;
+};
+
+#endif
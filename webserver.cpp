@@ -1,10 +1,22 @@
 #include "webserver.h"
 
-WebServer::WebServer()
+//io_uring完成事件的类型，和文件描述符、连接代次一起编码在user_data中
+enum URING_OP
+{
+    URING_ACCEPT = 0,
+    URING_RECV,
+    URING_WRITEV,
+    URING_SIGNAL,
+    URING_NOTIFY,
+    URING_TIMER
+};
+static inline unsigned long long uring_data(int op, int fd, unsigned gen)
 {
-    //http_conn类对象，用于存储用户连接
-    users = new http_conn[MAX_FD];
+    return ((unsigned long long)gen << 32) | ((unsigned long long)fd << 3) | op;
+}
 
+WebServer::WebServer()
+{
     //root文件夹路径
     char server_path[200];
     //getcwd用于将当前的工作目录存入参数1指定缓冲区中，参数2为缓冲区大小
@@ -15,25 +27,32 @@ WebServer::WebServer()
     strcpy(m_root, server_path);
     strcat(m_root, root);
 
-    //定时器
-    users_timer = new client_data[MAX_FD]; //定时器数量也和文件描述符数量上限有关
+    m_loop_num = 0;
+    m_loops = NULL;
 }
 
 WebServer::~WebServer() //服务器资源释放
 {
-    close(m_epollfd); //关闭epoll
-    close(m_listenfd); //停止监听
-    //关闭用于给主循环发送信号，通知其处理定时器的管道
-    close(m_pipefd[1]); 
-    close(m_pipefd[0]);
-    delete[] users; //删除http_conn类对象
-    delete[] users_timer; //删除定时器
+    for (int i = 0; i < m_loop_num && m_loops; ++i)
+    {
+        if (m_loops[i].m_epollfd >= 0)
+            close(m_loops[i].m_epollfd); //关闭epoll
+        close(m_loops[i].m_listenfd); //停止监听
+        close(m_loops[i].m_timerfd); //关闭驱动时间轮的timerfd
+        if (m_loops[i].m_signalfd >= 0)
+            close(m_loops[i].m_signalfd);
+    }
+    delete[] m_loops; //删除事件循环，连同各循环的连接对象
     delete m_pool; //删除线程池
 }
 
 //构造函数初始化
 void WebServer::init(int port, string user, string passWord, string databaseName, int log_write, 
-                     int opt_linger, int trigmode, int sql_num, int thread_num, int close_log, int actor_model)
+                     int opt_linger, int trigmode, int sql_num, int thread_num, int close_log, int actor_model,
+                     int loop_num, int backend, int read_max, int send_file,
+                     int cache_mb, int revalidate_ms, int gzip_mb, string cache_control, int h2c,
+                     int idle_timeout, int header_timeout, int body_timeout, int max_requests, int min_rate,
+                     int write_quantum, int bundle)
 {
     m_port = port;
     m_user = user;
@@ -46,6 +65,52 @@ void WebServer::init(int port, string user, string passWord, string databaseName
     m_TRIGMode = trigmode;
     m_close_log = close_log;
     m_actormodel = actor_model;
+
+    //事件循环数量限制在[1, MAX_LOOP_NUM]
+    m_loop_num = loop_num;
+    if (m_loop_num < 1)
+        m_loop_num = 1;
+    if (m_loop_num > MAX_LOOP_NUM)
+        m_loop_num = MAX_LOOP_NUM;
+    m_backend = backend;
+
+    //读缓冲区上限不小于连接自带的缓冲区
+    http_conn::m_read_max = read_max * 1024;
+    if (http_conn::m_read_max < http_conn::READ_BUFFER_SIZE)
+        http_conn::m_read_max = http_conn::READ_BUFFER_SIZE;
+
+    //io_uring没有sendfile操作，该后端始终使用mmap
+    http_conn::m_sendfile = (1 == send_file && 0 == backend);
+
+    //文件缓存，sendfile方式下缓存打开的文件，否则缓存映射；gzip压缩版本单独计算容量
+    file_cache::get_instance()->init(cache_mb > 0 ? (size_t)cache_mb << 20 : 0, revalidate_ms, http_conn::m_sendfile,
+                                     gzip_mb > 0 ? (size_t)gzip_mb << 20 : 0);
+    //编译进程序的静态资源，先于文件缓存查找
+    asset_bundle::get_instance()->init(1 == bundle);
+    m_stats_time = timer_wheel::now_ms();
+
+    //静态资源按路径前缀附带的Cache-Control
+    http_conn::set_cache_control(cache_control);
+    http_conn::init_routes();
+    http_conn::update_date();
+
+    //连接前言或Upgrade: h2c开始的连接按HTTP/2处理
+    http_conn::m_h2c = (1 == h2c);
+
+    //keep-alive策略，超时不小于时间轮的槽间隔
+    http_conn::m_idle_timeout = idle_timeout > timer_wheel::SI ? idle_timeout : timer_wheel::SI;
+    http_conn::m_header_timeout = header_timeout > timer_wheel::SI ? header_timeout : timer_wheel::SI;
+    http_conn::m_body_timeout = body_timeout > timer_wheel::SI ? body_timeout : timer_wheel::SI;
+    http_conn::m_max_keepalive = max_requests > 0 ? max_requests : 0;
+    http_conn::m_min_rate = min_rate > 0 ? min_rate : 0;
+    http_conn::m_write_quantum = write_quantum > 0 ? write_quantum * 1024 : 0;
+
+    //在创建日志、线程池和循环线程之前屏蔽SIGTERM，之后创建的线程都继承该信号掩码
+    //SIGTERM只能通过0号循环的signalfd读出，不会再打断任何线程的系统调用
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
 }
 
 //设置epoll触发模式(考虑监听和连接事件是否开启ET模式)
@@ -96,31 +161,53 @@ void WebServer::sql_pool()
     m_connPool->init("localhost", m_user, m_passWord, m_databaseName, 3306, m_sql_num, m_close_log);
 
     //初始化数据库读取表
-    users->initmysql_result(m_connPool);
+    http_conn::initmysql_result(m_connPool);
 }
 
 void WebServer::thread_pool()
 {
+    //io_uring后端由循环线程完成读写，工作线程只处理请求报文，相当于Proactor模式
+    if (1 == m_backend)
+        m_actormodel = 0;
+
     //线程池
     m_pool = new threadpool<http_conn>(m_actormodel, m_connPool, m_thread_num);
 }
 //监听相关
 void WebServer::eventListen()
+{
+    m_loops = new event_loop[m_loop_num];
+    for (int i = 0; i < m_loop_num; ++i)
+    {
+        m_loops[i].m_id = i;
+        m_loops[i].m_server = this;
+        m_loops[i].m_backend = m_backend;
+        m_loops[i].m_next_gen = 0;
+        m_loops[i].m_uring_retry = 0;
+        m_loops[i].m_stop = false;
+        loopListen(m_loops + i);
+    }
+
+    m_loops[0].utils.addsig(SIGPIPE, SIG_IGN); //往读端被关闭的管道或者socket连接写数据，则忽略信号
+}
+
+//为单个循环创建监听socket、epoll内核事件表和timerfd
+void WebServer::loopListen(event_loop *loop)
 {
     //创建socket
-    m_listenfd = socket(PF_INET, SOCK_STREAM, 0);
-    assert(m_listenfd >= 0);
+    loop->m_listenfd = socket(PF_INET, SOCK_STREAM, 0);
+    assert(loop->m_listenfd >= 0);
 
     //优雅关闭TCP连接
     if (0 == m_OPT_LINGER)
     {
         struct linger tmp = {0, 1};
-        setsockopt(m_listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+        setsockopt(loop->m_listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
     }
     else if (1 == m_OPT_LINGER)
     {
         struct linger tmp = {1, 1};
-        setsockopt(m_listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+        setsockopt(loop->m_listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
     }
 
     int ret = 0;
@@ -135,110 +222,225 @@ void WebServer::eventListen()
 
     //能够让m_listenfd即使处于TIME_WAIT的状态，与之绑定的socket地址也能立即被重用
     int flag = 1;
-    setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    setsockopt(loop->m_listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+
+    //多个循环时每个循环绑定同一端口的独立监听socket，由内核在它们之间做连接负载均衡
+    if (m_loop_num > 1)
+    {
+        ret = setsockopt(loop->m_listenfd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag));
+        assert(ret >= 0);
+    }
 
     //socket命名，将文件描述符与socket地址绑定
-    ret = bind(m_listenfd, (struct sockaddr *)&address, sizeof(address));
+    ret = bind(loop->m_listenfd, (struct sockaddr *)&address, sizeof(address));
     assert(ret >= 0);
 
     //监听socket, 设置内核监听队列长度为5
-    ret = listen(m_listenfd, 5);
+    ret = listen(loop->m_listenfd, 5);
     assert(ret >= 0);
 
-    utils.init(TIMESLOT); //初始化alarm函数触发的时间间隔
+    //每个循环用自己的timerfd驱动时间轮
+    loop->m_timerfd = loop->utils.create_timerfd();
+    assert(loop->m_timerfd >= 0);
 
-    //epoll_wait会将就绪事件从内核事件表中取出放入events数组中
-    epoll_event events[MAX_EVENT_NUMBER];
+    //SIGTERM已在init中屏蔽，由0号循环通过signalfd读取
+    loop->m_signalfd = -1;
+    if (0 == loop->m_id)
+    {
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGTERM);
+        loop->m_signalfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        assert(loop->m_signalfd >= 0);
+    }
+
+    //io_uring后端不使用epoll，监听socket、timerfd、signalfd和eventfd都以提交队列项的形式交给内核
+    if (1 == loop->m_backend)
+    {
+        if (loop->m_ring.init(4096))
+        {
+            loop->m_epollfd = -1;
+            return;
+        }
+        //内核不支持io_uring时退回epoll
+        LOG_ERROR("%s:errno is:%d", "io_uring setup failure, fall back to epoll", errno);
+        loop->m_backend = 0;
+    }
 
     //epoll创建内核事件表
-    m_epollfd = epoll_create(5);
-    assert(m_epollfd != -1);
+    loop->m_epollfd = epoll_create(5);
+    assert(loop->m_epollfd != -1);
 
     //往内核事件表中注册监听事件(实则为读事件，不开启oneshot)
-    utils.addfd(m_epollfd, m_listenfd, false, m_LISTENTrigmode);
-    http_conn::m_epollfd = m_epollfd;
-    
-    //在管道中创建一对互相连接的匿名socket,从任意一端写入,都能从另一端读
-    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, m_pipefd);
-    assert(ret != -1);
-    utils.setnonblocking(m_pipefd[1]); //第二个socket设置非阻塞用于写入
-    utils.addfd(m_epollfd, m_pipefd[0], false, 0); //epoll监听第一个socket上的读事件
-
-    //分别设置三种信号的处理方式
-    utils.addsig(SIGPIPE, SIG_IGN); //往读端被关闭的管道或者socket连接写数据，则忽略信号
-    utils.addsig(SIGALRM, utils.sig_handler, false); //由alarm超时引起
-    utils.addsig(SIGTERM, utils.sig_handler, false); //term信号，终止进程
-
-    alarm(TIMESLOT); //初始化alarm
-
-    //工具类,信号和描述符基础操作
-    Utils::u_pipefd = m_pipefd;
-    Utils::u_epollfd = m_epollfd;
+    loop->utils.addfd(loop->m_epollfd, loop->m_listenfd, false, m_LISTENTrigmode);
+
+    loop->utils.addfd(loop->m_epollfd, loop->m_timerfd, false, 0); //epoll监听timerfd的到期事件
+    if (loop->m_signalfd >= 0)
+        loop->utils.addfd(loop->m_epollfd, loop->m_signalfd, false, 0); //epoll监听signalfd上的信号
+
+    //epoll监听完成队列的eventfd，工作线程完成任务后唤醒循环
+    loop->utils.addfd(loop->m_epollfd, loop->m_cq.get_fd(), false, 0);
 }
 //初始化定时器
 //第二个参数为被接受连接的远端socket地址
-void WebServer::timer(int connfd, struct sockaddr_in client_address)
+void WebServer::timer(event_loop *loop, int connfd, struct sockaddr_in client_address)
 {
+    //从循环的slab中取出连接对象，登记到文件描述符表
+    connection *c = loop->m_slab.alloc();
+    c->loop = loop;
+    c->gen = ++loop->m_next_gen;
+    c->busy = false;
+    c->closing = false;
+    c->deferred = 0;
+    loop->m_conns.set(connfd, c);
+
     //初始化用户连接，用户连接数+1
-    users[connfd].init(connfd, client_address, m_root, m_CONNTrigmode, m_close_log, m_user, m_passWord, m_databaseName);
+    c->conn.init(connfd, client_address, loop->m_epollfd, &loop->m_cq, m_root, m_CONNTrigmode,
+                 m_close_log, m_user, m_passWord, m_databaseName);
+    c->conn.m_gen = c->gen;
 
     //初始化client_data数据
     //创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到链表中
-    users_timer[connfd].address = client_address;
-    users_timer[connfd].sockfd = connfd;
+    c->data.address = client_address;
+    c->data.sockfd = connfd;
+    c->data.epollfd = loop->m_epollfd;
+    c->data.conn = c;
     util_timer *timer = new util_timer(0, 0);
-    timer->user_data = &users_timer[connfd];
-    timer->cb_func = cb_func; //将定时器类中的函数指针指向回调函数cb_func
-    time_t cur = time(NULL);
-    timer->expire = cur + 3 * TIMESLOT; //定时器向后延时三个单位
-    users_timer[connfd].timer = timer;
-    utils.m_timer_wheel.add_timer(timer); //将定时器插入链表
+    timer->user_data = &c->data;
+    timer->cb_func = close_cb; //关闭连接后还需归还连接对象
+    timer->deadline_func = conn_deadline;
+    timer->expire = c->conn.deadline(); //新连接的空闲超时
+    c->data.timer = timer;
+    loop->utils.m_timer_wheel.add_timer(timer); //将定时器插入链表
+}
+
+//定时器回调：从内核事件表删除事件并关闭连接，再把连接对象归还给所属循环的slab
+//只在所属循环的线程中调用(时间轮滴答或deal_timer)
+//连接正由工作线程处理时不能关闭文件描述符(可能被新连接复用)，也不能释放对象，只shutdown让工作线程的读写尽快失败，
+//从内核事件表删除后不再有事件，等完成事件回到循环(complete)时再真正关闭
+void WebServer::close_cb(client_data *user_data)
+{
+    connection *c = user_data->conn;
+    if (c->busy)
+    {
+        if (user_data->epollfd >= 0)
+            epoll_ctl(user_data->epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
+        shutdown(user_data->sockfd, SHUT_RDWR);
+        user_data->timer = NULL; //定时器随后由调用者删除
+        c->closing = true;
+        return;
+    }
+    cb_func(user_data);
+    c->loop->m_conns.set(user_data->sockfd, NULL);
+    c->loop->m_slab.release(c);
+}
+//交给工作线程之前标记，工作线程处理完总会把连接放回完成队列，由complete清除
+bool WebServer::dispatch(connection *c, int state)
+{
+    c->busy = true;
+    bool ok = 1 == m_actormodel ? m_pool->append(&c->conn, state) : m_pool->append_p(&c->conn);
+    if (!ok)
+        c->busy = false;
+    return ok;
+}
+//完成队列中的连接对象在工作线程处理期间不会被释放，这里按文件描述符和代次确认后解除标记
+//处理期间被要求关闭的现在关闭，生成响应失败的删除定时器并关闭
+connection *WebServer::complete(event_loop *loop, http_conn *conn)
+{
+    int sockfd = conn->get_sockfd();
+    connection *c = sockfd >= 0 ? loop->m_conns.get(sockfd) : NULL;
+    if (!c || c->gen != conn->m_gen || !c->busy)
+    {
+        LOG_ERROR("stale completion on fd %d", sockfd);
+        return NULL;
+    }
+    c->busy = false;
+    if (c->closing)
+    {
+        LOG_INFO("close fd %d", sockfd);
+        close_cb(&c->data);
+        return NULL;
+    }
+    if (1 == conn->timer_flag)
+    {
+        conn->timer_flag = 0;
+        deal_timer(loop, c->data.timer, sockfd);
+        return NULL;
+    }
+    return c;
 }
 
-//若有数据传输，则将定时器往后延迟3个单位
-//并对新的定时器在链表上的位置进行调整
-void WebServer::adjust_timer(util_timer *timer)
+//连接的期限由所处阶段决定(空闲、读请求头、读请求体、发送响应)，定时器到期时再按当时的期限决定关闭还是顺延
+//接收请求过慢的连接返回当前时间，随即被关闭并计入m_shed
+long long WebServer::conn_deadline(client_data *user_data)
+{
+    http_conn &conn = user_data->conn->conn;
+    long long now = timer_wheel::now_ms();
+    if (conn.trickling(now))
+    {
+        http_conn::m_shed.fetch_add(1, std::memory_order_relaxed);
+        return now;
+    }
+    return conn.deadline();
+}
+//慢速客户端每次只发送几个字节，逐个交给工作线程解析的代价远大于检查一次速率
+//在循环线程中按连接记录的期限和接收速率判断，不满足时直接关闭，不进入请求队列
+bool WebServer::shed_slow(event_loop *loop, connection *c)
 {
-    time_t cur = time(NULL);
-    timer->expire = cur + 3 * TIMESLOT;
-    utils.m_timer_wheel.adjust_timer(timer);
+    if (!c->conn.trickling(timer_wheel::now_ms()))
+        return false;
+    http_conn::m_shed.fetch_add(1, std::memory_order_relaxed);
+    LOG_INFO("shed slow client(%s)", inet_ntoa(c->conn.get_address()->sin_addr));
+    deal_timer(loop, c->data.timer, c->data.sockfd);
+    return true;
+}
+
+//若有数据传输，定时器取连接当前期限与现在加上最短超时中较早的一个
+//Reactor模式下读写和阶段切换随后在工作线程中进行，新的期限不会早于后者，定时器不会晚于期限到期
+void WebServer::adjust_timer(event_loop *loop, util_timer *timer)
+{
+    long long expire = timer_wheel::now_ms() + http_conn::min_timeout();
+    long long deadline = timer->user_data->conn->conn.deadline();
+    timer->expire = deadline < expire ? deadline : expire;
+    loop->utils.m_timer_wheel.adjust_timer(timer);
 
     LOG_INFO("%s", "adjust timer once");
 }
 
 //删除定时器
-void WebServer::deal_timer(util_timer *timer, int sockfd)
+void WebServer::deal_timer(event_loop *loop, util_timer *timer, int sockfd)
 {
-    timer->cb_func(&users_timer[sockfd]); //调用回调函数从内核事件表中删除事件
-    if (timer)
+    if (!timer) //定时器已到期被删除，连接已经关闭
     {
-        utils.m_timer_wheel.del_timer(timer); //从链表中删除定时器
+        return;
     }
+    LOG_INFO("close fd %d", sockfd);
 
-    LOG_INFO("close fd %d", users_timer[sockfd].sockfd);
+    timer->cb_func(timer->user_data); //调用回调函数从内核事件表中删除事件，连接对象随之归还
+    loop->utils.m_timer_wheel.del_timer(timer); //从链表中删除定时器
 }
 
 //接受连接并分配定时器
-bool WebServer::dealclinetdata()
+bool WebServer::dealclinetdata(event_loop *loop)
 {
     struct sockaddr_in client_address; //被接受连接的远端socket地址
     socklen_t client_addrlength = sizeof(client_address); //client_address地址长度,为socklen_t类型
     if (0 == m_LISTENTrigmode) //监听为LT模式
     {
         //从内核监听队列中取出一个连接，并用connfd唯一地表示这个连接
-        int connfd = accept(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength);
+        int connfd = accept(loop->m_listenfd, (struct sockaddr *)&client_address, &client_addrlength);
         if (connfd < 0) //accept连接失败
         {
             LOG_ERROR("%s:errno is:%d", "accept error", errno);
             return false;
         }
-        if (http_conn::m_user_count >= MAX_FD) //连接数量达到上限
+        if (http_conn::m_user_count >= MAX_FD || connfd >= MAX_FD) //连接数量达到上限
         {
-            utils.show_error(connfd, "Internal server busy"); //将内部错误send到connfd的缓冲区
+            loop->utils.show_error(connfd, "Internal server busy"); //将内部错误send到connfd的缓冲区
             LOG_ERROR("%s", "Internal server busy");
             return false;
         }
-        timer(connfd, client_address); //为该连接初始化一个定时器并放入链表中
+        timer(loop, connfd, client_address); //为该连接初始化一个定时器并放入链表中
     }
 
     else //监听为ET模式，由于只会通知一次，所以需要循环accept
@@ -246,170 +448,290 @@ bool WebServer::dealclinetdata()
         //不断地尝试从内核监听队列中取出一个连接，并用connfd唯一地表示这个连接,直到连接失败或者连接数量达到上限
         while (1) 
         {
-            int connfd = accept(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength);
+            int connfd = accept(loop->m_listenfd, (struct sockaddr *)&client_address, &client_addrlength);
             if (connfd < 0) //accept连接失败
             {
                 LOG_ERROR("%s:errno is:%d", "accept error", errno);
                 break;
             }
-            if (http_conn::m_user_count >= MAX_FD) //连接数量达到上限
+            if (http_conn::m_user_count >= MAX_FD || connfd >= MAX_FD) //连接数量达到上限
             {
-                utils.show_error(connfd, "Internal server busy");
+                loop->utils.show_error(connfd, "Internal server busy");
                 LOG_ERROR("%s", "Internal server busy");
                 break;
             }
-            timer(connfd, client_address); //为该连接初始化一个定时器并放入链表中
+            timer(loop, connfd, client_address); //为该连接初始化一个定时器并放入链表中
         }
         return false;
     }
     return true;
 }
 //信号处理
-bool WebServer::dealwithsignal(bool &timeout, bool &stop_server)
+//只有0号循环持有signalfd，收到SIGTERM后通知所有循环退出
+bool WebServer::dealwithsignal(event_loop *loop)
 {
-    int ret = 0;
-    int sig;
-    char signals[1024];
-    ret = recv(m_pipefd[0], signals, sizeof(signals), 0); //从第一个管道读入信号并放入signals缓冲区，返回读到的数量
-    if (ret == -1)
+    int ret = read(loop->m_signalfd, &loop->m_siginfo, sizeof(loop->m_siginfo));
+    if (ret != sizeof(loop->m_siginfo))
     {
         return false;
     }
-    else if (ret == 0)
+    if (SIGTERM == loop->m_siginfo.ssi_signo) //终止信号
     {
-        return false;
+        stop_loops();
     }
-    else
+    return true;
+}
+//设置所有循环的停止标志，并通过完成队列的eventfd唤醒阻塞中的循环
+void WebServer::stop_loops()
+{
+    for (int i = 0; i < m_loop_num; ++i)
     {
-        for (int i = 0; i < ret; ++i)
-        {
-            switch (signals[i])
-            {
-            case SIGALRM: //alarm超时触发
-            {
-                timeout = true;
-                break;
-            }
-            case SIGTERM: //终止信号
-            {
-                stop_server = true;
-                break;
-            }
-            }
-        }
+        m_loops[i].m_stop = true;
+        m_loops[i].m_cq.notify();
     }
-    return true;
+}
+//定时器处理
+//读出timerfd的到期次数，时间轮按次数滴答，处理超时定时器，从内核事件表删除不活跃连接的文件描述符
+void WebServer::dealwithtimer(event_loop *loop)
+{
+    uint64_t expirations = 0;
+    int ret = read(loop->m_timerfd, &expirations, sizeof(expirations));
+    if (ret != sizeof(expirations))
+    {
+        return;
+    }
+    on_timer(loop, expirations);
+}
+void WebServer::on_timer(event_loop *loop, uint64_t expirations)
+{
+    loop->utils.timer_handler(expirations);
+    if (0 != loop->m_id)
+        return;
+    http_conn::update_date(); //时间轮每100ms滴答一次，Date最多滞后一个滴答
+    if (timer_wheel::now_ms() - m_stats_time >= CACHE_STATS_INTERVAL)
+    {
+        m_stats_time = timer_wheel::now_ms();
+        log_cache_stats();
+    }
+}
+void WebServer::log_cache_stats()
+{
+    http_conn::alloc_stats a;
+    http_conn::get_alloc_stats(a);
+    LOG_INFO("request memory: %llu requests, %llu with heap allocations (%llu allocations), arena overflow %llu",
+             a.requests, a.alloc_requests, a.heap_allocs, a.arena_blocks);
+    LOG_INFO("connections: %d open, %llu slow clients shed", (int)http_conn::m_user_count,
+             http_conn::m_shed.load(std::memory_order_relaxed));
+    asset_bundle *bundle = asset_bundle::get_instance();
+    if (bundle->enabled())
+        LOG_INFO("asset bundle: %d files %zu bytes, hit %llu", bundle->count(), bundle->bytes(), bundle->hits());
+    file_cache *cache = file_cache::get_instance();
+    if (!cache->enabled() && !cache->gzip_enabled())
+        return;
+    file_cache::stats s;
+    cache->get_stats(s);
+    LOG_INFO("file cache: %d files %zu bytes, hit %llu miss %llu evict %llu revalidate %llu invalidate %llu",
+             s.entries, s.bytes, s.hits, s.misses, s.evictions, s.revalidations, s.invalidations);
+    LOG_INFO("gzip cache: %zu bytes, hit %llu from .gz %llu compressed %llu",
+             s.gzip_bytes, s.gzip_hits, s.gzip_siblings, s.gzip_compressions);
 }
 //读事件处理
-void WebServer::dealwithread(int sockfd)
+void WebServer::dealwithread(event_loop *loop, int sockfd)
 {
-    util_timer *timer = users_timer[sockfd].timer; //取出读事件的定时器
+    connection *c = loop->m_conns.get(sockfd);
+    if (!c) //连接已关闭
+    {
+        return;
+    }
+    if (c->busy) //工作线程仍在处理该连接，完成后再处理本次事件
+    {
+        c->deferred |= EPOLLIN;
+        return;
+    }
+    util_timer *timer = c->data.timer; //取出读事件的定时器
 
     //reactor
     if (1 == m_actormodel)
     {
+        //读取和解析都在工作线程中，先用上次读取后记录的速率判断，慢速连接不再交给工作线程
+        if (shed_slow(loop, c))
+        {
+            return;
+        }
         if (timer)
         {
-            adjust_timer(timer); //延时定时器并调整位置
+            adjust_timer(loop, timer); //延时定时器并调整位置
         }
 
         //若监测到读事件，将该事件放入请求队列，等待线程进行I/O操作
-        m_pool->append(users + sockfd, 0);
-
-        while (true) //循环等待读事件被处理
+        //处理结果由工作线程放入完成队列，循环不再等待，继续处理其他就绪事件
+        if (!dispatch(c, 0))
         {
-            if (1 == users[sockfd].improv)
-            {
-                if (1 == users[sockfd].timer_flag)
-                {
-                    //读事件read_once失败，则删除定时器
-                    deal_timer(timer, sockfd);
-                    users[sockfd].timer_flag = 0;
-                }
-                //成功处理，则重置improv,并结束循环
-                users[sockfd].improv = 0;
-                break;
-            }
+            deal_timer(loop, timer, sockfd); //请求队列已满，关闭连接
         }
     }
     else
     {
         //proactor
-        if (users[sockfd].read_once()) //由主线程进行读取数据
+        if (c->conn.read_once()) //由主线程进行读取数据
         {
+            if (shed_slow(loop, c))
+            {
+                return;
+            }
             //inet_ntoa将网络地址转化为'.'间隔的字符串
-            LOG_INFO("deal with the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
+            LOG_INFO("deal with the client(%s)", inet_ntoa(c->conn.get_address()->sin_addr));
 
             //若监测到读事件，将该事件放入请求队列，等待线程处理请求报文
-            m_pool->append_p(users + sockfd);
+            if (!dispatch(c, 0))
+            {
+                deal_timer(loop, timer, sockfd); //请求队列已满，关闭连接
+                return;
+            }
 
             if (timer)
             {
-                adjust_timer(timer); //延时定时器并调整位置
+                adjust_timer(loop, timer); //延时定时器并调整位置
             }
         }
         else
         {
-            deal_timer(timer, sockfd); //主线程读取数据失败，删除定时器
+            deal_timer(loop, timer, sockfd); //主线程读取数据失败，删除定时器
         }
     }
 }
 //写事件处理
-void WebServer::dealwithwrite(int sockfd)
+void WebServer::dealwithwrite(event_loop *loop, int sockfd)
 {
-    util_timer *timer = users_timer[sockfd].timer;
+    connection *c = loop->m_conns.get(sockfd);
+    if (!c) //连接已关闭
+    {
+        return;
+    }
+    if (c->busy) //工作线程仍在处理该连接，完成后再处理本次事件
+    {
+        c->deferred |= EPOLLOUT;
+        return;
+    }
+    util_timer *timer = c->data.timer;
     //reactor
     if (1 == m_actormodel)
     {
         if (timer)
         {
-            adjust_timer(timer);
+            adjust_timer(loop, timer);
         }
 
-        m_pool->append(users + sockfd, 1);
-
-        while (true)
+        if (!dispatch(c, 1))
         {
-            if (1 == users[sockfd].improv)
-            {
-                if (1 == users[sockfd].timer_flag)
-                {
-                    deal_timer(timer, sockfd);
-                    users[sockfd].timer_flag = 0;
-                }
-                users[sockfd].improv = 0;
-                break;
-            }
+            deal_timer(loop, timer, sockfd);
         }
     }
     else
     {
         //proactor
-        if (users[sockfd].write()) //主线程完成写数据，无需再进入请求队列分配线程
+        if (c->conn.write()) //主线程完成写数据，无需再进入请求队列分配线程
         {
-            LOG_INFO("send data to the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
+            LOG_INFO("send data to the client(%s)", inet_ntoa(c->conn.get_address()->sin_addr));
+
+            //读缓冲区中还有流水线请求，直接交给工作线程处理
+            if (c->conn.has_pending() && !dispatch(c, 0))
+            {
+                deal_timer(loop, timer, sockfd);
+                return;
+            }
 
             if (timer)
             {
-                adjust_timer(timer);
+                adjust_timer(loop, timer);
             }
         }
         else
         {
-            deal_timer(timer, sockfd);
+            deal_timer(loop, timer, sockfd);
+        }
+    }
+}
+//处理工作线程完成的读写任务
+//工作线程读写或生成响应失败时只设置timer_flag，由所属循环在这里删除定时器并关闭连接
+//处理期间推迟的读写事件在这里重新处理，工作线程重新注册的事件不会丢失
+void WebServer::dealwithcompletion(event_loop *loop)
+{
+    std::list<http_conn *> done;
+    loop->m_cq.drain(done);
+
+    for (std::list<http_conn *>::iterator it = done.begin(); it != done.end(); ++it)
+    {
+        connection *c = complete(loop, *it);
+        if (!c)
+        {
+            continue;
         }
+        int deferred = c->deferred;
+        c->deferred = 0;
+        if (deferred & EPOLLIN)
+            dealwithread(loop, c->data.sockfd);
+        //读事件可能已关闭连接或再次交给工作线程，写事件按当时的状态处理或继续推迟
+        if ((deferred & EPOLLOUT) && loop->m_conns.get(c->data.sockfd) == c)
+            dealwithwrite(loop, c->data.sockfd);
     }
 }
 //事件回环(即服务器主线程)
+//1至m_loop_num-1号循环各自运行在独立线程上，0号循环运行在主线程上，主线程退出前等待其余循环结束
 void WebServer::eventLoop()
 {
-    bool timeout = false; //信号处理后alarm是否超时
-    bool stop_server = false; //是否关闭服务器
+    for (int i = 1; i < m_loop_num; ++i)
+    {
+        if (pthread_create(&m_loops[i].m_tid, NULL, loop_worker, m_loops + i) != 0)
+        {
+            LOG_ERROR("%s", "create event loop thread failure");
+            throw std::exception();
+        }
+    }
+
+    m_loops[0].m_tid = pthread_self();
+    runLoop(m_loops);
 
-    while (!stop_server)
+    for (int i = 1; i < m_loop_num; ++i)
+        pthread_join(m_loops[i].m_tid, NULL);
+    log_cache_stats();
+}
+
+//从循环线程的入口函数
+void *WebServer::loop_worker(void *arg)
+{
+    event_loop *loop = (event_loop *)arg;
+    loop->m_server->runLoop(loop);
+    return loop;
+}
+
+//单个循环的事件回环
+void WebServer::runLoop(event_loop *loop)
+{
+    //多个循环时将循环线程绑定到不同的CPU上，使连接始终在同一个核上处理
+    if (m_loop_num > 1)
+    {
+        int cpu_num = sysconf(_SC_NPROCESSORS_ONLN);
+        if (cpu_num > 0)
+        {
+            cpu_set_t cpuset;
+            CPU_ZERO(&cpuset);
+            CPU_SET(loop->m_id % cpu_num, &cpuset);
+            pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+        }
+    }
+
+    if (1 == loop->m_backend)
+    {
+        runUringLoop(loop);
+        return;
+    }
+
+    while (!loop->m_stop)
     {
         //number为就绪事件数量
-        int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, -1);
+        int number = epoll_wait(loop->m_epollfd, loop->events, MAX_EVENT_NUMBER, -1);
+        int bulk_count = 0;
         //EINTR为系统中断信号
         if (number < 0 && errno != EINTR)
         {
@@ -419,47 +741,280 @@ void WebServer::eventLoop()
 
         for (int i = 0; i < number; i++)
         {
-            int sockfd = events[i].data.fd;
+            int sockfd = loop->events[i].data.fd;
 
             //处理新到的客户连接
-            if (sockfd == m_listenfd) //判断该就绪事件是否来自于监听socket
+            if (sockfd == loop->m_listenfd) //判断该就绪事件是否来自于监听socket
             {
-                bool flag = dealclinetdata(); //接受连接并分配定时器
+                bool flag = dealclinetdata(loop); //接受连接并分配定时器
                 if (false == flag)
                     continue;
             }
             //对端被关闭或文件描述符被挂断/出现错误
-            else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            else if (loop->events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
             {
                 //服务器端关闭连接，移除对应的定时器
-                util_timer *timer = users_timer[sockfd].timer;
-                deal_timer(timer, sockfd);
+                connection *c = loop->m_conns.get(sockfd);
+                if (c)
+                    deal_timer(loop, c->data.timer, sockfd);
+            }
+            //处理定时器，timerfd到期
+            else if (sockfd == loop->m_timerfd)
+            {
+                dealwithtimer(loop);
             }
             //处理信号
-            //该就绪事件为管道的读入信号
-            else if ((sockfd == m_pipefd[0]) && (events[i].events & EPOLLIN))
+            else if (sockfd == loop->m_signalfd)
             {
-                bool flag = dealwithsignal(timeout, stop_server);
+                bool flag = dealwithsignal(loop);
                 if (false == flag)
-                    LOG_ERROR("%s", "dealclientdata failure");
+                    LOG_ERROR("%s", "dealwithsignal failure");
+            }
+            //处理工作线程完成的读写任务
+            else if (sockfd == loop->m_cq.get_fd())
+            {
+                dealwithcompletion(loop);
             }
             //处理客户连接上接收到的数据
-            else if (events[i].events & EPOLLIN) //就绪事件为读事件
+            else if (loop->events[i].events & EPOLLIN) //就绪事件为读事件
             {
-                dealwithread(sockfd);
+                dealwithread(loop, sockfd);
             }
-            else if (events[i].events & EPOLLOUT) //就绪事件为写事件
+            else if (loop->events[i].events & EPOLLOUT) //就绪事件为写事件
             {
-                dealwithwrite(sockfd);
+                //剩余数据超过一个写配额的连接排到本批最后，小响应、新连接和读事件先处理
+                connection *c = loop->m_conns.get(sockfd);
+                if (c && !c->busy && c->conn.bulk())
+                {
+                    loop->m_bulk[bulk_count].fd = sockfd;
+                    loop->m_bulk[bulk_count++].gen = c->gen;
+                }
+                else
+                    dealwithwrite(loop, sockfd);
             }
         }
-        if (timeout) //超时
+        for (int i = 0; i < bulk_count; ++i)
+        {
+            connection *c = loop->m_conns.get(loop->m_bulk[i].fd);
+            if (c && c->gen == loop->m_bulk[i].gen)
+                dealwithwrite(loop, loop->m_bulk[i].fd);
+        }
+    }
+}
+//为连接提交接收请求，数据直接写入http_conn的读缓冲区
+void WebServer::uringRecv(event_loop *loop, connection *c)
+{
+    int sockfd = c->data.sockfd;
+    int len = 0;
+    char *buf = c->conn.read_space(len);
+    if (len <= 0) //读缓冲区已满，请求过大
+    {
+        deal_timer(loop, c->data.timer, sockfd);
+        return;
+    }
+    //提交队列满到无法腾出空间时关闭连接，不能让连接既没有请求在内核中又不在工作线程手里
+    if (!loop->m_ring.prep_recv(sockfd, buf, len, uring_data(URING_RECV, sockfd, c->gen)))
+    {
+        LOG_ERROR("io_uring submission queue full, close fd %d", sockfd);
+        deal_timer(loop, c->data.timer, sockfd);
+    }
+}
+//为连接提交发送请求，发送http_conn中已组织好的iovec数组
+void WebServer::uringSend(event_loop *loop, connection *c)
+{
+    int sockfd = c->data.sockfd;
+    int count = 0;
+    struct iovec *iov = c->conn.write_iovec(count);
+    if (!loop->m_ring.prep_writev(sockfd, iov, count, uring_data(URING_WRITEV, sockfd, c->gen)))
+    {
+        LOG_ERROR("io_uring submission queue full, close fd %d", sockfd);
+        deal_timer(loop, c->data.timer, sockfd);
+    }
+}
+//accept、timerfd、signalfd和eventfd的请求每次完成后重新提交，任何一个丢失循环都会停止接受连接或不再响应定时器和通知
+void WebServer::uringArm(event_loop *loop, int op)
+{
+    io_ring &ring = loop->m_ring;
+    bool ok = false;
+    switch (op)
+    {
+    case URING_ACCEPT:
+        loop->m_accept_len = sizeof(loop->m_accept_addr);
+        ok = ring.prep_accept(loop->m_listenfd, (struct sockaddr *)&loop->m_accept_addr, &loop->m_accept_len,
+                              uring_data(URING_ACCEPT, loop->m_listenfd, 0));
+        break;
+    case URING_TIMER:
+        ok = ring.prep_read(loop->m_timerfd, &loop->m_timer_count, sizeof(loop->m_timer_count),
+                            uring_data(URING_TIMER, loop->m_timerfd, 0));
+        break;
+    case URING_SIGNAL:
+        ok = ring.prep_read(loop->m_signalfd, &loop->m_siginfo, sizeof(loop->m_siginfo),
+                            uring_data(URING_SIGNAL, loop->m_signalfd, 0));
+        break;
+    case URING_NOTIFY:
+        ok = ring.prep_read(loop->m_cq.get_fd(), &loop->m_cq_count, sizeof(loop->m_cq_count),
+                            uring_data(URING_NOTIFY, loop->m_cq.get_fd(), 0));
+        break;
+    }
+    if (ok)
+        loop->m_uring_retry &= ~(1 << op);
+    else
+        loop->m_uring_retry |= 1 << op;
+}
+//io_uring后端的事件回环
+//accept、recv、writev以及timerfd、signalfd和完成队列的eventfd都作为提交队列项交给内核，
+//每轮只调用一次io_uring_enter，同时提交本轮产生的所有请求并等待完成事件，之后成批收割
+//接收完成后交给工作线程解析，工作线程处理完通过完成队列通知循环提交下一次发送或接收
+void WebServer::runUringLoop(event_loop *loop)
+{
+    io_ring &ring = loop->m_ring;
+
+    uringArm(loop, URING_ACCEPT);
+    uringArm(loop, URING_TIMER);
+    if (loop->m_signalfd >= 0)
+        uringArm(loop, URING_SIGNAL);
+    uringArm(loop, URING_NOTIFY);
+
+    while (!loop->m_stop)
+    {
+        //上一轮没能提交的循环级请求在这里重试，此时本轮的完成事件已收割，提交队列有了空间
+        for (int op = URING_ACCEPT; loop->m_uring_retry && op <= URING_TIMER; ++op)
+        {
+            if (loop->m_uring_retry & (1 << op))
+                uringArm(loop, op);
+        }
+        //仍有请求没能提交时不阻塞等待，收割完成事件后再试
+        int ret = ring.submit_and_wait(loop->m_uring_retry ? 0 : 1);
+        //EINTR为系统中断信号，EBUSY为完成队列溢出，内核暂不接受新的提交，收割之后即可恢复
+        if (ret < 0 && errno != EINTR && errno != EBUSY)
+        {
+            LOG_ERROR("%s", "io_uring failure");
+            break;
+        }
+
+        io_uring_cqe *cqe;
+        while ((cqe = ring.peek_cqe()) != NULL)
         {
-            utils.timer_handler(); //处理超时定时器，从内核事件表删除不活跃连接的文件描述符
+            unsigned long long data = cqe->user_data;
+            int res = cqe->res;
+            ring.cqe_seen();
+
+            int op = data & 7;
+            int sockfd = (data >> 3) & 0x1fffffff;
+            unsigned gen = data >> 32;
 
-            LOG_INFO("%s", "timer tick");
+            //连接已关闭，文件描述符可能已被新连接复用，丢弃迟到的完成事件
+            connection *c = NULL;
+            if (URING_RECV == op || URING_WRITEV == op)
+            {
+                c = loop->m_conns.get(sockfd);
+                if (!c || gen != c->gen)
+                    continue;
+            }
 
-            timeout = false;
+            switch (op)
+            {
+            case URING_ACCEPT: //接受新连接
+            {
+                if (res < 0)
+                {
+                    LOG_ERROR("%s:errno is:%d", "accept error", -res);
+                }
+                else if (http_conn::m_user_count >= MAX_FD || res >= MAX_FD) //连接数量达到上限
+                {
+                    loop->utils.show_error(res, "Internal server busy");
+                    LOG_ERROR("%s", "Internal server busy");
+                }
+                else
+                {
+                    timer(loop, res, loop->m_accept_addr); //为该连接初始化一个定时器并放入时间轮中
+                    uringRecv(loop, loop->m_conns.get(res));
+                }
+                uringArm(loop, URING_ACCEPT);
+                break;
+            }
+            case URING_RECV: //接收完成，交给工作线程处理请求报文
+            {
+                util_timer *timer = c->data.timer;
+                if (c->conn.read_complete(res))
+                {
+                    if (shed_slow(loop, c))
+                        break;
+                    LOG_INFO("deal with the client(%s)", inet_ntoa(c->conn.get_address()->sin_addr));
+                    if (!dispatch(c, 0))
+                    {
+                        deal_timer(loop, timer, sockfd);
+                        break;
+                    }
+                    if (timer)
+                    {
+                        adjust_timer(loop, timer);
+                    }
+                }
+                else
+                {
+                    deal_timer(loop, timer, sockfd);
+                }
+                break;
+            }
+            case URING_WRITEV: //发送完成，继续发送剩余数据或等待下一个请求
+            {
+                util_timer *timer = c->data.timer;
+                int state = c->conn.write_complete(res);
+                if (0 == state)
+                {
+                    uringSend(loop, c);
+                }
+                else if (1 == state || 2 == state)
+                {
+                    LOG_INFO("send data to the client(%s)", inet_ntoa(c->conn.get_address()->sin_addr));
+                    if (timer)
+                    {
+                        adjust_timer(loop, timer);
+                    }
+                    if (2 != state) //读缓冲区中还有流水线请求时直接交给工作线程处理
+                        uringRecv(loop, c);
+                    else if (!dispatch(c, 0))
+                        deal_timer(loop, timer, sockfd);
+                }
+                else
+                {
+                    deal_timer(loop, timer, sockfd);
+                }
+                break;
+            }
+            case URING_TIMER: //timerfd到期，推进时间轮
+            {
+                if (res == sizeof(loop->m_timer_count))
+                    on_timer(loop, loop->m_timer_count);
+                uringArm(loop, URING_TIMER);
+                break;
+            }
+            case URING_SIGNAL: //signalfd读到信号
+            {
+                if (res == sizeof(loop->m_siginfo) && SIGTERM == loop->m_siginfo.ssi_signo)
+                    stop_loops();
+                uringArm(loop, URING_SIGNAL);
+                break;
+            }
+            case URING_NOTIFY: //工作线程处理完请求，按连接的下一步提交接收或发送
+            {
+                std::list<http_conn *> done;
+                loop->m_cq.take(done);
+                for (std::list<http_conn *>::iterator it = done.begin(); it != done.end(); ++it)
+                {
+                    connection *conn = complete(loop, *it); //处理期间被关闭或生成响应失败时已关闭
+                    if (!conn)
+                        continue;
+                    if (1 == conn->conn.m_state)
+                        uringSend(loop, conn);
+                    else
+                        uringRecv(loop, conn);
+                }
+                uringArm(loop, URING_NOTIFY);
+                break;
+            }
+            }
         }
     }
-}
\ No newline at end of file
+}
@@ -11,13 +11,76 @@
 #include <stdlib.h>
 #include <cassert>
 #include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <atomic>
 
 #include "./threadpool/threadpool.h"
 #include "./http/http_conn.h"
+#include "./uring/io_ring.h"
+#include "./slab/slab.h"
+#include "./slab/fd_table.h"
 
 const int MAX_FD = 65536;           //最大文件描述符
 const int MAX_EVENT_NUMBER = 10000; //最大事件数
-const int TIMESLOT = 5;             //最小超时单位
+const int MAX_LOOP_NUM = 64;        //事件循环数量上限
+const int CACHE_STATS_INTERVAL = 60000; //文件缓存计数器写入日志的间隔(毫秒)
+
+class WebServer;
+struct event_loop;
+
+//连接对象，http_conn和它的定时器数据在接受连接时从所属循环的slab中分配，连接关闭时归还
+struct connection
+{
+    http_conn conn; //http连接
+    client_data data; //定时器绑定的连接资源
+    event_loop *loop; //所属事件循环
+    unsigned gen; //连接的代次，io_uring后端用于丢弃已关闭连接迟到的完成事件，完成队列用于确认连接没有被替换
+    //以下只由所属循环的线程读写
+    bool busy; //已交给工作线程，完成事件回到循环之前对象和文件描述符都不能释放
+    bool closing; //工作线程处理期间被要求关闭，socket已shutdown，完成事件回来后再关闭和释放
+    int deferred; //工作线程处理期间到达的EPOLLIN/EPOLLOUT事件，完成后重新处理
+};
+
+//事件循环(反应堆)，每个循环独占epoll内核事件表、监听socket、timerfd和时间轮
+//多个循环时各自的监听socket开启SO_REUSEPORT，由内核将新连接分散到各循环，连接的整个生命周期都留在同一线程
+struct event_loop
+{
+    int m_id; //循环编号，0号循环运行在主线程
+    int m_backend; //I/O后端，0为epoll，1为io_uring
+    int m_epollfd; //epoll标志
+    int m_listenfd; //监听socket
+    int m_timerfd; //按时间轮槽间隔周期触发的timerfd
+    int m_signalfd; //接收SIGTERM的signalfd，只有0号循环创建，其余为-1
+    std::atomic<bool> m_stop; //是否停止循环，0号循环收到SIGTERM后设置所有循环的标志
+    completion_queue<http_conn> m_cq; //Reactor模式下工作线程的完成队列
+    pthread_t m_tid; //运行该循环的线程
+    WebServer *m_server; //所属服务器
+    Utils utils; //设置定时器的实例，每个循环拥有自己的时间轮
+
+    //该循环接受的连接，按文件描述符索引的稀疏表，对象来自循环自己的slab
+    fd_table<connection, MAX_FD> m_conns;
+    slab<connection> m_slab;
+
+    //epoll_wait会将就绪事件从内核事件表中取出放入events数组中
+    epoll_event events[MAX_EVENT_NUMBER];
+    //本批中推迟处理的大块传输的写事件，连接的代次用于跳过期间已关闭(文件描述符可能已被复用)的连接
+    struct deferred_write
+    {
+        int fd;
+        unsigned gen;
+    };
+    deferred_write m_bulk[MAX_EVENT_NUMBER];
+
+    //io_uring后端相关
+    io_ring m_ring; //提交队列和完成队列
+    sockaddr_in m_accept_addr; //等待中的accept请求填写的客户地址
+    socklen_t m_accept_len;
+    uint64_t m_cq_count; //读取完成队列eventfd计数的缓冲区
+    uint64_t m_timer_count; //读取timerfd到期次数的缓冲区
+    signalfd_siginfo m_siginfo; //读取signalfd的缓冲区
+    unsigned m_next_gen; //下一个连接的代次
+    int m_uring_retry; //提交队列已满没能重新提交的循环级请求(accept、timerfd、signalfd、eventfd)，按1 << URING_OP记录
+};
 
 class WebServer
 {
@@ -27,21 +90,43 @@ public:
     //初始化用户名、数据库等相关成员变量
     void init(int port , string user, string passWord, string databaseName,
               int log_write , int opt_linger, int trigmode, int sql_num,
-              int thread_num, int close_log, int actor_model);
+              int thread_num, int close_log, int actor_model, int loop_num, int backend,
+              int read_max, int send_file, int cache_mb, int revalidate_ms, int gzip_mb, string cache_control,
+              int h2c, int idle_timeout, int header_timeout, int body_timeout, int max_requests,
+              int min_rate, int write_quantum, int bundle);
 
     void thread_pool(); //创建线程池
     void sql_pool(); //初始化数据库连接池
     void log_write(); //初始化日志系统
     void trig_mode(); //设置epoll的触发模式
     void eventListen(); //开启epoll监听
-    void eventLoop(); //事件回环（即服务器主线程）
-    void timer(int connfd, struct sockaddr_in client_address); //初始化定时器
-    void adjust_timer(util_timer *timer); //调整定时器
-    void deal_timer(util_timer *timer, int sockfd); //删除定时器
-    bool dealclinetdata(); //http 处理用户数据
-    bool dealwithsignal(bool& timeout, bool& stop_server); //处理定时器信号
-    void dealwithread(int sockfd); //处理客户连接上接收到的数据
-    void dealwithwrite(int sockfd); //写操作
+    void eventLoop(); //事件回环（0号循环运行在主线程，其余循环各占一个线程）
+    void timer(event_loop *loop, int connfd, struct sockaddr_in client_address); //初始化定时器
+    void adjust_timer(event_loop *loop, util_timer *timer); //调整定时器
+    void deal_timer(event_loop *loop, util_timer *timer, int sockfd); //删除定时器
+    bool dealclinetdata(event_loop *loop); //http 处理用户数据
+    bool dealwithsignal(event_loop *loop); //处理signalfd上的信号
+    void dealwithtimer(event_loop *loop); //处理timerfd到期，推进时间轮
+    void dealwithread(event_loop *loop, int sockfd); //处理客户连接上接收到的数据
+    void dealwithwrite(event_loop *loop, int sockfd); //写操作
+    void dealwithcompletion(event_loop *loop); //处理工作线程完成的读写任务
+
+private:
+    void loopListen(event_loop *loop); //为单个循环创建监听socket、epoll内核事件表和timerfd
+    void runLoop(event_loop *loop); //单个循环的事件回环
+    void runUringLoop(event_loop *loop); //io_uring后端的事件回环
+    void uringRecv(event_loop *loop, connection *c); //为连接提交接收请求
+    void uringSend(event_loop *loop, connection *c); //为连接提交发送请求
+    void uringArm(event_loop *loop, int op); //提交循环级的请求，失败时记录下来，下一轮提交之前重试
+    static void *loop_worker(void *arg); //从循环线程的入口函数
+    void stop_loops(); //通知所有循环退出
+    static void close_cb(client_data *user_data); //定时器回调，关闭连接并归还连接对象
+    bool dispatch(connection *c, int state); //把连接交给工作线程，state为Reactor模式的读写类型，队列已满时返回false
+    connection *complete(event_loop *loop, http_conn *conn); //工作线程的完成事件回到循环，连接已关闭或需要关闭时返回NULL
+    static long long conn_deadline(client_data *user_data); //定时器到期时取出连接当前阶段的期限
+    bool shed_slow(event_loop *loop, connection *c); //接收请求过慢的连接在交给工作线程之前直接关闭
+    void on_timer(event_loop *loop, uint64_t expirations); //推进时间轮，0号循环顺带定期记录文件缓存计数器
+    void log_cache_stats(); //将请求内存分配和文件缓存计数器写入日志
 
 public:
     //基础
@@ -51,9 +136,10 @@ public:
     int m_close_log; //日志关闭标志
     int m_actormodel; //事件处理模式
 
-    int m_pipefd[2]; //管道,[0]用于读,[1]用于写
-    int m_epollfd; //epoll标志
-    http_conn *users; //大小与文件描述符上限相等
+    int m_loop_num; //事件循环数量
+    int m_backend; //I/O后端，0为epoll，1为io_uring
+    event_loop *m_loops; //事件循环数组
+    long long m_stats_time; //上次记录文件缓存计数器的时间，只由0号循环访问
 
     //数据库相关
     connection_pool *m_connPool;
@@ -66,18 +152,9 @@ public:
     threadpool<http_conn> *m_pool;
     int m_thread_num; //线程池容量
 
-    //epoll_event相关
-    //epoll_wait会将就绪事件从内核事件表中取出放入events数组中
-    epoll_event events[MAX_EVENT_NUMBER];
-
-    int m_listenfd; //监听socket
     int m_OPT_LINGER; //是否优雅关闭监听socket的连接
     int m_TRIGMode; //epoll触发模式，包括下面的监听和连接
     int m_LISTENTrigmode; //监听触发模式
     int m_CONNTrigmode; //连接触发模式
-
-    //定时器相关
-    client_data *users_timer; //用于存储初始化后的定时器
-    Utils utils; //设置定时器的实例
 };
 #endif